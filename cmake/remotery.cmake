@@ -0,0 +1,14 @@
+if( TARGET remotery )
+	return()
+endif()
+
+# Built only with VOXELBAND_PROFILER, linking it turns on the zones of
+# include/voxelband/profiler.hh and the Remotery server of the entry layer
+add_library( remotery STATIC ${VOXELBAND_DIR}/extlibs/remotery/lib/Remotery.c )
+target_include_directories( remotery PUBLIC ${VOXELBAND_DIR}/extlibs )
+target_compile_definitions( remotery PUBLIC "-DENTRY_CONFIG_PROFILER=1" )
+target_link_libraries( remotery PUBLIC Threads::Threads )
+if( UNIX )
+	target_link_libraries( remotery PUBLIC m )
+endif()
+set_target_properties( remotery PROPERTIES FOLDER "extlibs" )
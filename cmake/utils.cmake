@@ -291,13 +291,22 @@ function( add_bgfx_shader FILE FOLDER INCLUDES )
 		set( COMMON FILE ${FILE} ${TYPE} INCLUDES ${INCLUDES} )
 		set( OUTPUTS "" )
 		set( OUTPUTS_PRETTY "" )
-		if( WIN32 )
+		# Shaders with the BGFX_INTEGER_OPS source property use unsigned
+		# integers and bit operations. They are built for GLSL 130 and not at
+		# all for DX9 and GLES 2, which lack them.
+		get_source_file_property( INTEGER_OPS ${FILE} BGFX_INTEGER_OPS )
+		set( GLSL_PROFILE 120 )
+		if( INTEGER_OPS )
+			set( GLSL_PROFILE 130 )
+		endif()
+		if( WIN32 AND NOT INTEGER_OPS )
 			# dx9
 			set( DX9_OUTPUT ${CMAKE_BINARY_DIR}/shaders/dx9/${FILENAME}.bin )
 			shaderc_parse( DX9 ${COMMON} WINDOWS PROFILE ${D3D_PREFIX}_3_0 OUTPUT ${DX9_OUTPUT} )
 			list( APPEND OUTPUTS "DX9" )
 			set( OUTPUTS_PRETTY "${OUTPUTS_PRETTY}DX9, " )
-
+		endif()
+		if( WIN32 )
 			# dx11
 			set( DX11_OUTPUT ${CMAKE_BINARY_DIR}/shaders/dx11/${FILENAME}.bin )
 			shaderc_parse( DX11 ${COMMON} WINDOWS PROFILE ${D3D_PREFIX}_4_0 OUTPUT ${DX11_OUTPUT})
@@ -311,14 +320,16 @@ function( add_bgfx_shader FILE FOLDER INCLUDES )
 			list( APPEND OUTPUTS "METAL" )
 			set( OUTPUTS_PRETTY "${OUTPUTS_PRETTY}Metal, " )
 		endif()
-		# gles
-		set( GLES_OUTPUT ${CMAKE_BINARY_DIR}/shaders/gles/${FILENAME}.bin )
-		shaderc_parse( GLES ${COMMON} ANDROID OUTPUT ${GLES_OUTPUT})
-		list( APPEND OUTPUTS "GLES" )
-		set( OUTPUTS_PRETTY "${OUTPUTS_PRETTY}GLES, " )
+		if( NOT INTEGER_OPS )
+			# gles
+			set( GLES_OUTPUT ${CMAKE_BINARY_DIR}/shaders/gles/${FILENAME}.bin )
+			shaderc_parse( GLES ${COMMON} ANDROID OUTPUT ${GLES_OUTPUT})
+			list( APPEND OUTPUTS "GLES" )
+			set( OUTPUTS_PRETTY "${OUTPUTS_PRETTY}GLES, " )
+		endif()
 		# glsl
 		set( GLSL_OUTPUT ${CMAKE_BINARY_DIR}/shaders/glsl/${FILENAME}.bin )
-		shaderc_parse( GLSL ${COMMON} LINUX PROFILE 120 OUTPUT ${GLSL_OUTPUT})
+		shaderc_parse( GLSL ${COMMON} LINUX PROFILE ${GLSL_PROFILE} OUTPUT ${GLSL_OUTPUT})
 		list( APPEND OUTPUTS "GLSL" )
 		set( OUTPUTS_PRETTY "${OUTPUTS_PRETTY}GLSL" )
 		set( OUTPUT_FILES "" )
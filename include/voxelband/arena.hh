@@ -0,0 +1,108 @@
+#ifndef arena_hh__
+#define arena_hh__
+
+#include <cstdint>
+#include <array>
+#include <map>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "voxel.hh"
+
+//Large vertex pages shared by every chunk mesh. Each page holds a single
+//region and material, so allocations that sit next to each other in a page
+//can be drawn with one submit and one transform. Vertices are stored region
+//local, see write. Unused vertices are zero and draw as degenerate quads.
+//Face records get pages of their own, uploaded as pairs of records that
+//are drawn as instance data.
+class GeometryArena {
+public:
+	//Quads are drawn with a shared 16 bit index buffer
+	static const uint32_t PAGE_VERTICES = MAX_DRAW_VERTICES;
+
+	GeometryArena();
+	GeometryArena(GeometryArena const&) = delete;
+	GeometryArena& operator=(GeometryArena const&) = delete;
+	~GeometryArena();
+
+	//First fit from the pages of region and type, a new page when none has
+	//room. Face record allocations are rounded up to whole pairs.
+	ArenaAllocation allocate(uint64_t region, VoxelType type, uint32_t num_vertices, bool face_records = false);
+	void free(ArenaAllocation& allocation);
+
+	//Copy vertices to [offset, offset + count) of the allocation, moving
+	//their corners by origin to make them region local
+	void write(ArenaAllocation const& allocation, uint32_t offset,
+		PackedVoxelVertex const* vertices, uint32_t count, std::array<uint8_t, 3> const& origin);
+	//Zero [offset, offset + count) of the allocation
+	void clear(ArenaAllocation const& allocation, uint32_t offset, uint32_t count);
+
+	//Vertices and indices a flush copied to the GPU
+	struct Uploads {
+		uint32_t vertices = 0;
+		uint32_t indices = 0;
+	};
+
+	//Upload what changed since the last flush, once per frame before rendering
+	Uploads flush();
+
+	DynamicVertexBuffer const& get_page_buffer(uint32_t page) const {
+		return m_pages[page]->buffer;
+	}
+
+	uint64_t get_page_region(uint32_t page) const {
+		return m_pages[page]->region;
+	}
+
+	//Elements of the page's buffer are pairs of face records
+	bool has_face_records(uint32_t page) const {
+		return m_pages[page]->face_records;
+	}
+
+	//Indices of PAGE_VERTICES / 4 quads, valid after the first flush
+	IndexBuffer const& get_quad_indices() const {
+		return m_quad_indices;
+	}
+
+	size_t num_pages() const {
+		return m_pages.size();
+	}
+
+	//Vertex bytes held on the GPU by all pages
+	size_t memory_usage() const;
+
+private:
+	struct Range {
+		uint32_t start;
+		uint32_t size;
+	};
+
+	struct Page {
+		uint64_t region = 0;
+		VoxelType type = VoxelType::V_EMPTY;
+		bool face_records = false;
+		//CPU copy of the page, the GPU buffer is rebuilt from it when it grows
+		std::vector<PackedVoxelVertex> shadow;
+		//Sorted by start and coalesced
+		std::vector<Range> free_ranges;
+		uint32_t used = 0;
+		uint32_t dirty_begin = UINT32_MAX;
+		uint32_t dirty_end = 0;
+		uint32_t gpu_capacity = 0;
+		DynamicVertexBuffer buffer;
+	};
+
+	using Bucket = std::tuple<uint64_t, VoxelType, bool>;
+
+	uint32_t take_page(uint64_t region, VoxelType type, bool face_records);
+	void mark_dirty(Page& page, uint32_t begin, uint32_t end);
+
+	std::vector<std::unique_ptr<Page>> m_pages;
+	std::map<Bucket, std::vector<uint32_t>> m_buckets;
+	//Pages without allocations, reused by any region and type
+	std::vector<uint32_t> m_free_pages;
+	IndexBuffer m_quad_indices;
+};
+
+#endif // !arena_hh__
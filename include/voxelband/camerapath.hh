@@ -0,0 +1,42 @@
+#ifndef camerapath_hh__
+#define camerapath_hh__
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+//Scripted camera for unattended runs. Keys are placed at frame numbers
+//rather than times and the camera moves linearly between them, so every run
+//sees the same views at the same frames however fast it renders.
+class CameraPath {
+public:
+	struct Key {
+		uint32_t frame;
+		//In voxels
+		std::array<float, 3> position;
+		//Radians, as cameraSetHorizontalAngle and cameraSetVerticalAngle
+		float yaw;
+		float pitch;
+	};
+
+	//Keys in increasing frame order, at least one
+	explicit CameraPath(std::vector<Key> keys);
+
+	//Loads a JSON array of {"frame": n, "position": [x, y, z], "yaw": a,
+	//"pitch": b} objects, throws std::runtime_error when it can not
+	static CameraPath load(boost::filesystem::path const& path);
+
+	//Camera at frame, frames past the last key stay there
+	Key sample(uint32_t frame) const;
+
+	//Scripted runs end after this frame
+	uint32_t last_frame() const {
+		return m_keys.back().frame;
+	}
+
+private:
+	std::vector<Key> m_keys;
+};
+
+#endif // !camerapath_hh__
@@ -0,0 +1,133 @@
+#ifndef chunkmap_hh__
+#define chunkmap_hh__
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+#include "voxel.hh"
+
+class LightEngine;
+
+//Loaded chunks keyed by chunk coordinates, an open addressing hash table
+//with linear probing. Chunks are heap allocated so pointers and neighbour
+//links stay valid while the table grows. Links of the six adjacent chunks
+//are updated on insert and erase.
+class ChunkMap {
+	friend class VoxelChunk;
+public:
+	//Chunk coordinates are packed 21 bits per axis
+	static const int COORD_BITS = 21;
+	static const int MIN_COORD = -(1 << (COORD_BITS - 1));
+	static const int MAX_COORD = (1 << (COORD_BITS - 1)) - 1;
+
+	static uint64_t pack_key(int x, int y, int z);
+	static void unpack_key(uint64_t key, int& x, int& y, int& z);
+
+	//Chunks are also grouped in cubic regions of REGION_SIZE chunks a side
+	//for coarse visibility tests and arena pages
+	static const int REGION_SHIFT = 2;
+	static const int REGION_SIZE = 1 << REGION_SHIFT;
+	//Region local vertex corners are 8 bit
+	static_assert(REGION_SIZE * VOXEL_CHUNK_WIDTH <= 255 && REGION_SIZE * VOXEL_CHUNK_HEIGHT <= 255
+		&& REGION_SIZE * VOXEL_CHUNK_DEPTH <= 255, "Region too large for arena vertices");
+	using Region = std::vector<VoxelChunk*>;
+
+	//Key of the region holding chunk x, y, z, in the same packing as pack_key
+	static uint64_t region_key(int x, int y, int z);
+
+	ChunkMap();
+	ChunkMap(ChunkMap const&) = delete;
+	ChunkMap& operator=(ChunkMap const&) = delete;
+	~ChunkMap();
+
+	VoxelChunk* find(int x, int y, int z) const;
+
+	//Replaces the voxels of an existing chunk in place
+	VoxelChunk& insert(int x, int y, int z, VoxelChunk chunk);
+	bool erase(int x, int y, int z);
+	void clear();
+
+	//Arena that inserted chunks upload their meshes to
+	void set_arena(GeometryArena* arena) {
+		m_arena = arena;
+	}
+
+	//Light engine told about every inserted, edited and erased chunk
+	void set_light_engine(LightEngine* light) {
+		m_light = light;
+	}
+
+	//Relight around chunk x, y, z after its voxels were edited in place,
+	//see WorldEdit::commit
+	void voxels_changed(int x, int y, int z);
+
+	size_t size() const {
+		return m_size;
+	}
+
+	//fun(x, y, z, VoxelChunk&) for every chunk in table order
+	template<typename Tfun>
+	void for_each(Tfun fun) {
+		for (auto& slot : m_slots) {
+			if (!slot.chunk)
+				continue;
+			int x, y, z;
+			unpack_key(slot.key, x, y, z);
+			fun(x, y, z, *slot.chunk);
+		}
+	}
+
+	//fun(x, y, z, VoxelChunk&) for the chunks that turned dirty without a
+	//mesh job pending since the last call, each once. Chunks fun leaves dirty
+	//and without a job are handed out again by the next call.
+	template<typename Tfun>
+	void for_each_dirty(Tfun fun) {
+		m_mesh_queue.swap(m_draining);
+		for (auto key : m_draining) {
+			int x, y, z;
+			unpack_key(key, x, y, z);
+			auto* chunk = find(x, y, z);
+			//Erased since, or queued again after being reinserted
+			if (!chunk || !chunk->m_mesh_queued)
+				continue;
+			chunk->m_mesh_queued = false;
+			fun(x, y, z, *chunk);
+			chunk->queue_meshing();
+		}
+		m_draining.clear();
+	}
+
+	//fun(rx, ry, rz, Region const&) for every region holding a chunk
+	template<typename Tfun>
+	void for_each_region(Tfun fun) const {
+		for (auto const& region : m_regions) {
+			int x, y, z;
+			unpack_key(region.first, x, y, z);
+			fun(x, y, z, region.second);
+		}
+	}
+
+private:
+	struct Slot {
+		uint64_t key = 0;
+		std::unique_ptr<VoxelChunk> chunk;
+	};
+
+	size_t home_slot(uint64_t key) const;
+	size_t find_slot(uint64_t key) const;
+	void grow();
+	void link(int x, int y, int z, VoxelChunk* chunk);
+
+	std::vector<Slot> m_slots;
+	size_t m_size = 0;
+	std::unordered_map<uint64_t, Region> m_regions;
+	GeometryArena* m_arena = nullptr;
+	LightEngine* m_light = nullptr;
+	//Keys of chunks queued by VoxelChunk::queue_meshing, see for_each_dirty
+	std::vector<uint64_t> m_mesh_queue;
+	std::vector<uint64_t> m_draining;
+};
+
+#endif // !chunkmap_hh__
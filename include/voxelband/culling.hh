@@ -0,0 +1,72 @@
+#ifndef culling_hh__
+#define culling_hh__
+
+#include <cstdint>
+#include <vector>
+#include <unordered_set>
+
+#include "bounds.h"
+#include "voxel.hh"
+#include "chunkmap.hh"
+
+//View frustum planes of a view-projection matrix, see buildFrustumPlanes
+class Frustum {
+public:
+	enum Containment {
+		OUTSIDE,
+		INTERSECTS,
+		INSIDE
+	};
+
+	explicit Frustum(float const* view_proj);
+
+	Containment test(Aabb const& aabb) const;
+
+private:
+	Plane m_planes[6];
+};
+
+struct CullStats {
+	uint32_t regions = 0;
+	uint32_t regions_culled = 0;
+	uint32_t chunks = 0;
+	uint32_t chunks_culled = 0;
+	//Chunks reached by ConnectivityCuller
+	uint32_t chunks_visited = 0;
+	//Chunks hidden by OcclusionCuller, also counted in chunks_culled
+	uint32_t chunks_occluded = 0;
+};
+
+//World space box of a chunk's mesh, false when it has nothing to draw
+bool chunk_world_bounds(VoxelChunk const& chunk, Aabb& aabb);
+
+//Collect chunks with a mesh inside the frustum. Whole regions are rejected
+//or accepted first, only chunks of regions crossing the frustum are tested
+//one by one.
+void cull_chunks(ChunkMap const& chunks, Frustum const& frustum,
+	std::vector<VoxelChunk const*>& visible, CullStats& stats);
+
+//Breadth first search from the camera chunk through chunks in the frustum.
+//A chunk entered across one face is only left across faces its air connects
+//to that face, and the search never steps back against a direction it has
+//already moved in, so chunks behind solid rock are never reached.
+class ConnectivityCuller {
+public:
+	//eye is the camera position in world units. Falls back to cull_chunks
+	//when the camera is outside the loaded chunks.
+	void cull(ChunkMap const& chunks, Frustum const& frustum, float const* eye,
+		std::vector<VoxelChunk const*>& visible, CullStats& stats);
+
+private:
+	struct Step {
+		VoxelChunk const* chunk;
+		VoxelFace entry;
+		//1 << VoxelFace bits of every step taken so far
+		uint32_t directions;
+	};
+
+	std::vector<Step> m_queue;
+	std::unordered_set<VoxelChunk const*> m_visited;
+};
+
+#endif // !culling_hh__
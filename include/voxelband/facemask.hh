@@ -0,0 +1,45 @@
+#ifndef facemask_hh__
+#define facemask_hh__
+
+#include <cstdint>
+#include <array>
+
+#include "voxel.hh"
+
+static_assert(VOXEL_CHUNK_WIDTH == 32, "Face masks store one 32 bit row of voxels along x");
+
+const int VOXEL_ROWS = VOXEL_CHUNK_HEIGHT * VOXEL_CHUNK_DEPTH;
+const int OCCUPANCY_PADDED_HEIGHT = VOXEL_CHUNK_HEIGHT + 2;
+const int OCCUPANCY_ROWS = OCCUPANCY_PADDED_HEIGHT * (VOXEL_CHUNK_DEPTH + 2);
+
+//Solid bits of a chunk, one row along x per (y,z). Rows are padded by one
+//in y and z with the bordering rows of the neighbour chunks, the x borders
+//are kept per row in left_edge (bit 0) and right_edge (bit 31).
+struct ChunkOccupancy {
+	std::array<uint32_t, OCCUPANCY_ROWS> rows;
+	std::array<uint32_t, VOXEL_ROWS> left_edge;
+	std::array<uint32_t, VOXEL_ROWS> right_edge;
+};
+
+//Visible faces per direction, bit x of row z*VOXEL_CHUNK_HEIGHT + y
+struct FaceMasks {
+	std::array<uint32_t, VOXEL_ROWS> face[NUM_FACES];
+};
+
+inline int occupancy_row(int y, int z) {
+	return (z + 1) * OCCUPANCY_PADDED_HEIGHT + (y + 1);
+}
+
+inline int voxel_row(int y, int z) {
+	return z * VOXEL_CHUNK_HEIGHT + y;
+}
+
+//Pack one row of VOXEL_CHUNK_WIDTH voxels into solid bits
+uint32_t pack_solid_row(VoxelType const* row);
+
+//Derive every visible face of slices [z_begin, z_end) from the occupancy
+//with shifts and and-nots
+void build_face_masks(ChunkOccupancy const& occupancy, FaceMasks& masks,
+	int z_begin = 0, int z_end = VOXEL_CHUNK_DEPTH);
+
+#endif // !facemask_hh__
@@ -0,0 +1,185 @@
+#ifndef light_hh__
+#define light_hh__
+
+#include <cstdint>
+#include <array>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "voxel.hh"
+
+//Light levels run from 0 to MAX_LIGHT_LEVEL and drop by one per voxel, except
+//full sky light which falls straight down without dimming
+const int MAX_LIGHT_LEVEL = 15;
+
+//Sky light in the high and block light in the low four bits of every voxel
+//of a chunk. Published by LightEngine and never changed afterwards, so mesh
+//jobs share it without copying.
+struct ChunkLight {
+	std::array<uint8_t, NUM_VOXELS> levels;
+};
+
+inline uint8_t make_light(int sky, int block) {
+	return uint8_t(sky << 4 | block);
+}
+
+inline int sky_light(uint8_t light) {
+	return light >> 4;
+}
+
+inline int block_light(uint8_t light) {
+	return light & 15;
+}
+
+//Meshed for chunks and neighbours the LightEngine has not lit yet
+const uint8_t UNLIT_LIGHT = make_light(MAX_LIGHT_LEVEL, 0);
+
+//Voxel a, b of the border plane of a chunk at face, a and b run along the
+//other two axes in x, y, z order
+inline unsigned int border_voxel_index(int face, int a, int b) {
+	static_assert(VOXEL_CHUNK_WIDTH == VOXEL_CHUNK_HEIGHT && VOXEL_CHUNK_HEIGHT == VOXEL_CHUNK_DEPTH,
+		"Border planes assume cubic chunks");
+	const int size = VOXEL_CHUNK_WIDTH;
+	const int last = size - 1;
+	switch (face) {
+	case FACE_LEFT: return unsigned((b * size + a) * size);
+	case FACE_RIGHT: return unsigned((b * size + a) * size + last);
+	case FACE_BOTTOM: return unsigned(b * VOXEL_SLICE_SIZE + a);
+	case FACE_TOP: return unsigned(b * VOXEL_SLICE_SIZE + last * size + a);
+	case FACE_FRONT: return unsigned(b * size + a);
+	default: return unsigned(last * VOXEL_SLICE_SIZE + b * size + a);
+	}
+}
+
+//Block light given off by a voxel type, 0 for most
+int voxel_emission(VoxelType type);
+
+class ChunkMap;
+
+//Flood fills sky and block light through the chunks of a ChunkMap on its own
+//thread. ChunkMap reports inserted, edited and erased chunks; only the
+//voxels whose opacity or emission changed start a breadth first removal and
+//refill, so an edit relights the few chunks its light reaches. Sky light
+//enters through the top of chunks with no chunk above. Finished light is
+//handed to the chunks by apply, which marks the slabs it changed for
+//remeshing. Light that reached a chunk from an unloaded neighbour is kept.
+class LightEngine {
+public:
+	LightEngine();
+	LightEngine(LightEngine const&) = delete;
+	LightEngine& operator=(LightEngine const&) = delete;
+	//Updates not processed yet are dropped
+	~LightEngine();
+
+	//Chunk x, y, z was inserted or its voxels were replaced
+	void update_chunk(int x, int y, int z, PalettedVoxels const& voxels);
+	void remove_chunk(int x, int y, int z);
+	void clear();
+
+	//Give the chunks the light finished since the last call, main thread only
+	void apply(ChunkMap& chunks);
+
+	//Updates queued or being lit
+	unsigned int num_pending() const {
+		std::lock_guard<std::mutex> lock(m_command_mutex);
+		return unsigned(m_commands.size()) + m_num_processing;
+	}
+
+private:
+	enum class CommandKind {
+		Update,
+		Remove,
+		Clear
+	};
+
+	struct Command {
+		CommandKind kind;
+		int x, y, z;
+		PalettedVoxels voxels;
+	};
+
+	struct Result {
+		std::shared_ptr<ChunkLight const> light;
+		uint32_t changed_slices = 0;
+		uint32_t border_faces = 0;
+		//First light of a chunk, changes are relative to UNLIT_LIGHT
+		bool initial = false;
+	};
+
+	//Light thread copy of a chunk. Opacity and light are kept as a single
+	//value until the voxels differ, as most chunks are all air or all rock.
+	struct LightChunk {
+		using OpacityRows = std::array<uint32_t, VOXEL_CHUNK_HEIGHT * VOXEL_CHUNK_DEPTH>;
+
+		uint64_t key;
+		std::array<LightChunk*, NUM_FACES> neighbours = {};
+		//Bit x of row z * VOXEL_CHUNK_HEIGHT + y is set for voxels light can
+		//not enter, null when all voxels are uniform_opaque
+		std::unique_ptr<OpacityRows> opaque;
+		bool uniform_opaque = false;
+		//Block light emitted per voxel, empty when no voxel emits
+		std::vector<uint8_t> emission;
+		//Null when all voxels have uniform_light. Once published it is shared
+		//with the mesh jobs and copied before the next change.
+		std::shared_ptr<ChunkLight> light;
+		uint8_t uniform_light = 0;
+		bool light_published = false;
+		//Not published yet, its VoxelChunk is meshed with UNLIT_LIGHT so far
+		bool unlit = true;
+		//Changes not published yet, as for VoxelChunk::apply_edit
+		uint32_t changed_slices = 0;
+		uint32_t border_faces = 0;
+		bool touched = false;
+	};
+
+	struct Node {
+		LightChunk* chunk;
+		uint16_t index;
+		//Level before removal, unused when adding
+		uint8_t level;
+	};
+
+	void worker();
+	void process(std::vector<Command>& commands);
+
+	void add_chunk(Command& command);
+	void edit_chunk(LightChunk& chunk, Command& command);
+	void erase_chunk(int x, int y, int z);
+	void check_sky(LightChunk& chunk);
+
+	void set_level(LightChunk& chunk, unsigned int index, uint8_t light);
+	template<typename Tchannel>
+	void remove_light(std::vector<Node>& removals, std::vector<Node>& additions);
+	template<typename Tchannel>
+	void add_light(std::vector<Node>& additions);
+	void propagate();
+	void publish();
+
+	std::thread m_thread;
+
+	mutable std::mutex m_command_mutex;
+	std::condition_variable m_command_ready;
+	std::vector<Command> m_commands;
+	unsigned int m_num_processing = 0;
+	bool m_stopping = false;
+
+	std::mutex m_result_mutex;
+	//Newer results for a chunk replace older ones and merge their changes
+	std::unordered_map<uint64_t, Result> m_results;
+
+	//Light thread only
+	std::unordered_map<uint64_t, std::unique_ptr<LightChunk>> m_chunks;
+	std::vector<Node> m_sky_removals, m_sky_additions;
+	std::vector<Node> m_block_removals, m_block_additions;
+	//Chunks whose top row may hold sky light from before the chunk above arrived
+	std::vector<uint64_t> m_sky_checks;
+	std::vector<LightChunk*> m_touched;
+	//Published light of chunks at one level throughout, shared between them
+	std::array<std::shared_ptr<ChunkLight const>, 256> m_uniform_lights;
+};
+
+#endif // !light_hh__
@@ -0,0 +1,92 @@
+#ifndef mesher_hh__
+#define mesher_hh__
+
+#include <cstdint>
+#include <array>
+#include <memory>
+
+#include "voxel.hh"
+#include "light.hh"
+
+//Solid bits of the neighbour voxels touching a chunk. Missing neighbours are
+//all solid so no faces are emitted against them, see
+//VoxelChunk::gather_borders for neighbours at another level of detail.
+struct ChunkBorders {
+	//Row y = VOXEL_CHUNK_HEIGHT - 1 of the chunk below and row y = 0 of the
+	//chunk above, per z
+	std::array<uint32_t, VOXEL_CHUNK_DEPTH> below;
+	std::array<uint32_t, VOXEL_CHUNK_DEPTH> above;
+	//Slice z = VOXEL_CHUNK_DEPTH - 1 of the front chunk and z = 0 of the back chunk, per y
+	std::array<uint32_t, VOXEL_CHUNK_HEIGHT> front;
+	std::array<uint32_t, VOXEL_CHUNK_HEIGHT> back;
+	//One bit per row z * VOXEL_CHUNK_HEIGHT + y for the facing column of the
+	//left and right chunks
+	std::array<uint32_t, VOXEL_CHUNK_HEIGHT * VOXEL_CHUNK_DEPTH / 32> left;
+	std::array<uint32_t, VOXEL_CHUNK_HEIGHT * VOXEL_CHUNK_DEPTH / 32> right;
+	//Light of the neighbour voxels in front of the border faces per VoxelFace,
+	//laid out as border_voxel_index with b * VOXEL_CHUNK_WIDTH + a
+	std::array<std::array<uint8_t, VOXEL_SLICE_SIZE>, NUM_FACES> light;
+};
+
+//Vertices of the remeshed slabs of one chunk, indexed by slab
+struct ChunkMeshResult {
+	int x = 0, y = 0, z = 0;
+	//VoxelChunk::get_generation of the chunk the job was made from
+	uint64_t generation = 0;
+	//Mode the meshes were built with, lod > 0 always meshes greedily
+	MeshingMode mode = MeshingMode::PerFace;
+	uint32_t slabs = 0;
+	std::array<SlabMesh, NUM_VOXEL_SLABS> meshes;
+	std::array<MeshBounds, NUM_VOXEL_SLABS> bounds;
+	FaceConnectivity connectivity;
+	MeshBounds occluder;
+};
+
+//Immutable copy of everything needed to mesh a chunk away from the main thread
+struct ChunkMeshJob {
+	int x = 0, y = 0, z = 0;
+	uint64_t generation = 0;
+	MeshingMode mode = MeshingMode::PerFace;
+	int lod = 0;
+	uint32_t slabs = 0;
+	PalettedVoxels voxels;
+	std::shared_ptr<ChunkLight const> light;
+	ChunkBorders borders;
+};
+
+//Build the vertices of the given slabs with the light of the voxel in front
+//of every face baked in, UNLIT_LIGHT throughout when light is null. Only
+//reads its arguments and writes result, so any number of chunks can be
+//meshed in parallel.
+void mesh_chunk(VoxelType const* voxels, ChunkBorders const& borders, ChunkLight const* light,
+	MeshingMode mode, uint32_t slabs, ChunkMeshResult& result);
+//Decodes the slices the slabs need into a per-thread buffer first. Meshes
+//with lod > 0 are built greedily from downsample_voxels, always whole and
+//unlit, their blocks do not match the voxels the light was filled through.
+void mesh_chunk(PalettedVoxels const& voxels, ChunkBorders const& borders, ChunkLight const* light,
+	MeshingMode mode, int lod, uint32_t slabs, ChunkMeshResult& result);
+
+//Flood fill the air of a whole chunk from its faces and connect the faces
+//each air region touches
+FaceConnectivity find_face_connectivity(VoxelType const* voxels);
+
+//Thickest box of whole solid layers against one face of the chunk, a
+//cheap conservative stand-in for the solid voxels when culling occlusion
+MeshBounds find_occluder(VoxelType const* voxels);
+
+//Replace every block of 2^lod voxels a side by a single type
+void downsample_voxels(VoxelType* voxels, int lod);
+
+//Solid bits of the border plane at face of voxels as downsample_voxels
+//leaves them, bit a of word b for voxel a, b of border_voxel_index
+void downsample_border(PalettedVoxels const& voxels, VoxelFace face, int lod, uint32_t* plane);
+
+inline void mesh_chunk(ChunkMeshJob const& job, ChunkMeshResult& result) {
+	result.x = job.x;
+	result.generation = job.generation;
+	result.y = job.y;
+	result.z = job.z;
+	mesh_chunk(job.voxels, job.borders, job.light.get(), job.mode, job.lod, job.slabs, result);
+}
+
+#endif // !mesher_hh__
@@ -0,0 +1,82 @@
+#ifndef meshpipeline_hh__
+#define meshpipeline_hh__
+
+#include <cstdint>
+#include <memory>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+#include "bx/timer.h"
+#include "voxel.hh"
+#include "mesher.hh"
+#include "profiler.hh"
+
+//Meshes chunks on a pool of worker threads. Jobs are snapshots made with
+//VoxelChunk::make_mesh_job, finished meshes are handed back to the main
+//thread by upload, which owns every bgfx call.
+class MeshPipeline {
+public:
+	explicit MeshPipeline(unsigned int num_workers = default_num_workers());
+	MeshPipeline(MeshPipeline const&) = delete;
+	MeshPipeline& operator=(MeshPipeline const&) = delete;
+	~MeshPipeline();
+
+	//One thread is left for the main loop
+	static unsigned int default_num_workers();
+
+	void submit(int x, int y, int z, std::unique_ptr<ChunkMeshJob> job);
+
+	//Apply finished meshes until budget_ms is used up. One mesh is always
+	//applied so a large chunk can not stall the queue. Tlookup maps chunk
+	//coordinates to a VoxelChunk*, results of chunks that are gone are
+	//dropped, as are those of a chunk unloaded and loaded again since.
+	template<typename Tlookup>
+	unsigned int upload(double budget_ms, Tlookup lookup) {
+		PROFILE_ZONE(UploadMeshes);
+		const int64_t start = bx::getHPCounter();
+		const int64_t budget = int64_t(budget_ms * double(bx::getHPFrequency()) / 1000.0);
+
+		unsigned int uploaded = 0;
+		while (auto result = pop_result()) {
+			VoxelChunk* chunk = lookup(result->x, result->y, result->z);
+			if (chunk && chunk->get_generation() == result->generation)
+				chunk->apply_mesh(*result);
+			++uploaded;
+
+			if (bx::getHPCounter() - start >= budget)
+				break;
+		}
+		return uploaded;
+	}
+
+	//Jobs queued, being meshed or waiting for upload
+	unsigned int num_pending() const {
+		return m_num_pending;
+	}
+
+	unsigned int num_workers() const {
+		return unsigned(m_workers.size());
+	}
+
+private:
+	void worker();
+	std::unique_ptr<ChunkMeshResult> pop_result();
+
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_job_mutex;
+	std::condition_variable m_job_ready;
+	std::deque<std::unique_ptr<ChunkMeshJob>> m_jobs;
+	bool m_stopping = false;
+
+	std::mutex m_result_mutex;
+	std::deque<std::unique_ptr<ChunkMeshResult>> m_results;
+
+	std::atomic<unsigned int> m_num_pending{ 0 };
+};
+
+#endif // !meshpipeline_hh__
@@ -0,0 +1,83 @@
+#ifndef occlusion_hh__
+#define occlusion_hh__
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "bounds.h"
+#include "voxel.hh"
+#include "culling.hh"
+
+//Low resolution depth buffer rasterized on the CPU. Occluders are drawn with
+//the farthest depth of each triangle and boxes are tested against their
+//nearest depth, so the buffer only ever hides what is really hidden. Depth is
+//the clip space w, the distance along the view direction.
+class DepthBuffer {
+public:
+	static const int WIDTH = 256;
+	static const int HEIGHT = 128;
+	//Tiles keep the farthest depth of their pixels for a coarse first test
+	static const int TILE_SIZE = 8;
+	static const int TILES_X = WIDTH / TILE_SIZE;
+	static const int TILES_Y = HEIGHT / TILE_SIZE;
+
+	void clear(float const* view_proj);
+	//Boxes crossing the near plane are skipped, leaving out an occluder never
+	//hides too much
+	void draw_box(Aabb const& aabb);
+	//Fill the tiles, call once after drawing and before testing
+	void finish();
+
+	bool is_visible(Aabb const& aabb) const;
+
+private:
+	struct Corner {
+		float x, y, w;
+	};
+
+	bool project(Aabb const& aabb, std::array<Corner, 8>& corners) const;
+	void draw_triangle(Corner const& a, Corner const& b, Corner const& c);
+
+	float m_view_proj[16];
+	std::array<float, WIDTH * HEIGHT> m_depth;
+	std::array<float, TILES_X * TILES_Y> m_tiles;
+};
+
+//Draws the occluders of a frame into a DepthBuffer on its own thread while
+//the main thread uploads meshes and runs the other culling passes
+class OcclusionCuller {
+public:
+	OcclusionCuller();
+	OcclusionCuller(OcclusionCuller const&) = delete;
+	OcclusionCuller& operator=(OcclusionCuller const&) = delete;
+	~OcclusionCuller();
+
+	//Start drawing occluders, world space boxes, for view_proj
+	void begin(float const* view_proj, std::vector<Aabb> occluders);
+	//Wait for the occluders and drop the visible chunks they hide
+	void cull(std::vector<VoxelChunk const*>& visible, CullStats& stats);
+
+private:
+	void worker();
+
+	DepthBuffer m_depth;
+	std::vector<Aabb> m_occluders;
+	float m_view_proj[16];
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_changed;
+	bool m_drawing = false;
+	//Occluders were drawn since the last cull
+	bool m_started = false;
+	bool m_stopping = false;
+};
+
+//World space occluder of a chunk, false when it has none
+bool chunk_world_occluder(VoxelChunk const& chunk, Aabb& aabb);
+
+#endif // !occlusion_hh__
@@ -0,0 +1,103 @@
+#ifndef perfhud_hh__
+#define perfhud_hh__
+
+#include <cstdint>
+#include <array>
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+#include "bx/timer.h"
+
+//Counters recorded once per frame. Stage times are main thread milliseconds,
+//counts are per frame unless noted.
+enum PerfCounter {
+	PERF_FRAME_MS,
+	PERF_UI_MS,
+	PERF_CAMERA_MS,
+	PERF_STREAMING_MS,
+	PERF_LIGHT_MS,
+	PERF_MESHING_MS,
+	PERF_UPLOAD_MS,
+	PERF_CULLING_MS,
+	PERF_SUBMIT_MS,
+	PERF_BGFX_FRAME_MS,
+	//From bgfx::getStats, of the frame before
+	PERF_GPU_MS,
+	PERF_WAIT_RENDER_MS,
+	//Currently loaded
+	PERF_CHUNKS_LOADED,
+	//Meshes applied
+	PERF_CHUNKS_MESHED,
+	PERF_CHUNKS_DRAWN,
+	PERF_CHUNKS_CULLED,
+	PERF_VERTICES_UPLOADED,
+	PERF_INDICES_UPLOADED,
+	//Chunk draws submitted by Renderer, and every draw bgfx made the frame before
+	PERF_CHUNK_DRAWS,
+	PERF_DRAW_CALLS,
+	//Arena vertex buffers, and what bgfx reports in use, negative when it can not tell
+	PERF_ARENA_MIB,
+	PERF_GPU_MEMORY_MIB,
+	NUM_PERF_COUNTERS
+};
+
+//Name of a counter, also its CSV column
+char const* perf_counter_name(PerfCounter counter);
+
+using PerfFrame = std::array<float, NUM_PERF_COUNTERS>;
+
+//Adds the main thread time until the end of its scope to a stage counter
+class PerfStageTimer {
+public:
+	PerfStageTimer(PerfFrame& frame, PerfCounter counter)
+		: m_value(frame[counter])
+		, m_start(bx::getHPCounter()) {
+	}
+
+	PerfStageTimer(PerfStageTimer const&) = delete;
+	PerfStageTimer& operator=(PerfStageTimer const&) = delete;
+
+	~PerfStageTimer() {
+		m_value += float(double(bx::getHPCounter() - m_start) * 1000.0 / double(bx::getHPFrequency()));
+	}
+
+private:
+	float& m_value;
+	int64_t m_start;
+};
+
+//Counters of the last CAPACITY frames in a ring buffer per counter, drawn as
+//an ImGui overlay with p50, p95 and p99 of each and a histogram of the frame
+//and stage times. Every frame can also be appended to a CSV file, for frame
+//pacing problems on machines without a profiler.
+class PerfHud {
+public:
+	static constexpr int CAPACITY = 512;
+
+	//Frames are written to csv_path unless it is empty, throws
+	//std::runtime_error when it can not be created
+	explicit PerfHud(boost::filesystem::path const& csv_path = boost::filesystem::path());
+	PerfHud(PerfHud const&) = delete;
+	PerfHud& operator=(PerfHud const&) = delete;
+
+	void push(PerfFrame const& frame);
+
+	//p50, p95 and p99 of counter over the recorded frames
+	std::array<float, 3> percentiles(PerfCounter counter) const;
+
+	//Between imguiBeginFrame and imguiEndFrame
+	void draw() const;
+
+	bool visible = false;
+
+private:
+	std::array<std::array<float, CAPACITY>, NUM_PERF_COUNTERS> m_values;
+	//Ring position of the next frame and frames recorded, up to CAPACITY
+	int m_next = 0;
+	int m_count = 0;
+
+	std::ofstream m_csv;
+	uint64_t m_num_frames = 0;
+};
+
+#endif // !perfhud_hh__
@@ -0,0 +1,38 @@
+#ifndef profiler_hh__
+#define profiler_hh__
+
+#include <string>
+#include <thread>
+#include <utility>
+
+//Remotery zones showing which stage of a frame ran long. Compiled out unless
+//the build defines ENTRY_CONFIG_PROFILER=1 (cmake -DVOXELBAND_PROFILER=ON),
+//then the entry layer starts Remotery and its viewer in extlibs/remotery/vis
+//shows every zone of every thread.
+#ifndef ENTRY_CONFIG_PROFILER
+#	define ENTRY_CONFIG_PROFILER 0
+#endif // ENTRY_CONFIG_PROFILER
+
+#if ENTRY_CONFIG_PROFILER
+#	define RMT_ENABLED 1
+#	include <remotery/lib/Remotery.h>
+//Times the rest of the enclosing scope. name is an identifier, unique within
+//the scope.
+#	define PROFILE_ZONE(name) rmt_ScopedCPUSample(name, 0)
+#	define PROFILE_THREAD_NAME(name) rmt_SetCurrentThreadName(name)
+#else
+#	define PROFILE_ZONE(name)
+#	define PROFILE_THREAD_NAME(name) ((void)(name))
+#endif // ENTRY_CONFIG_PROFILER
+
+//Starts a thread running fun under name in the profiler, every thread of
+//voxelband is started this way so none shows up unnamed
+template<typename Tfun>
+std::thread start_thread(std::string name, Tfun fun) {
+	return std::thread([name = std::move(name), fun = std::move(fun)]() mutable {
+		PROFILE_THREAD_NAME(name.c_str());
+		fun();
+	});
+}
+
+#endif // !profiler_hh__
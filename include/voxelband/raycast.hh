@@ -0,0 +1,30 @@
+#ifndef raycast_hh__
+#define raycast_hh__
+
+#include <array>
+
+#include "bounds.h"
+#include "voxel.hh"
+#include "chunkmap.hh"
+
+//First solid voxel along a ray
+struct VoxelHit {
+	//World voxel coordinates
+	std::array<int, 3> voxel;
+	VoxelType type;
+	//Face the ray entered the voxel through, NUM_FACES when it started inside
+	VoxelFace face;
+	//Outward normal of face, voxel + normal is where a placed block goes.
+	//Zero when the ray started inside the voxel.
+	std::array<int, 3> normal;
+	//From the ray position to where it entered the voxel, in voxels
+	float distance;
+};
+
+//Walk the voxels a ray passes through (Amanatides and Woo) until the first
+//solid one, across chunk borders. Chunks that are missing or uniformly empty
+//are crossed in one step. Ray positions are in world voxel units, the
+//direction need not be normalized. max_distance must be finite.
+bool raycast(ChunkMap const& chunks, Ray const& ray, float max_distance, VoxelHit& hit);
+
+#endif // !raycast_hh__
@@ -0,0 +1,98 @@
+#ifndef regionfile_hh__
+#define regionfile_hh__
+
+#include <cstdint>
+#include <array>
+#include <fstream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "voxel.hh"
+
+//Chunks of a cube of REGION_FILE_SIZE chunks a side in one file. A fixed
+//table after the header holds the sector and byte size of every chunk, the
+//payloads are PalettedVoxels::encode output starting on sector boundaries.
+//Reads go through a memory mapping of the file, so loading a chunk touches
+//only its table entry and payload. Integers are in host byte order, little
+//endian on every platform voxelband builds for.
+class RegionFile {
+public:
+	static const int REGION_FILE_SHIFT = 4;
+	static const int REGION_FILE_SIZE = 1 << REGION_FILE_SHIFT;
+	static const int NUM_ENTRIES = REGION_FILE_SIZE * REGION_FILE_SIZE * REGION_FILE_SIZE;
+	static const uint32_t SECTOR_SIZE = 512;
+
+	//Opens path, creating an empty region file when create is set. Throws
+	//when the file is missing or not a region file.
+	RegionFile(boost::filesystem::path const& path, bool create);
+	RegionFile(RegionFile const&) = delete;
+	RegionFile& operator=(RegionFile const&) = delete;
+
+	//x, y, z are chunk coordinates inside the region, [0, REGION_FILE_SIZE).
+	//False when the chunk was never saved or its payload is damaged
+	bool read(int x, int y, int z, PalettedVoxels& voxels);
+	//Rewrites the payload in place when it still fits its sectors, otherwise
+	//moves it to the first free run of sectors
+	void write(int x, int y, int z, std::vector<uint8_t> const& payload);
+
+private:
+	struct Entry {
+		uint32_t sector;
+		uint32_t size;
+	};
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t region_size;
+		uint32_t sector_size;
+		std::array<Entry, NUM_ENTRIES> entries;
+	};
+
+	static const uint32_t HEADER_SECTORS = (sizeof(Header) + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+	static int entry_index(int x, int y, int z);
+	static uint32_t sector_count(uint32_t size) {
+		return (size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+	}
+
+	void map();
+	uint32_t allocate_sectors(uint32_t count);
+	void free_sectors(uint32_t sector, uint32_t count);
+
+	boost::filesystem::path m_path;
+	std::fstream m_file;
+	std::array<Entry, NUM_ENTRIES> m_entries;
+	//Free runs of sectors between payloads, sorted by sector
+	std::vector<Entry> m_free;
+	uint32_t m_num_sectors = HEADER_SECTORS;
+
+	//Dropped on every write and mapped again by the next read
+	std::unique_ptr<boost::interprocess::file_mapping> m_mapping;
+	boost::interprocess::mapped_region m_region;
+};
+
+//The region files of one world directory, opened on first use and kept open
+class RegionStore {
+public:
+	explicit RegionStore(boost::filesystem::path directory);
+
+	//False when the chunk was never saved or its region file is unreadable
+	bool load(int x, int y, int z, PalettedVoxels& voxels);
+	//Logs to stderr when the chunk can not be written
+	void save(int x, int y, int z, PalettedVoxels const& voxels);
+
+private:
+	RegionFile* open(int x, int y, int z, bool create);
+
+	boost::filesystem::path m_directory;
+	//Null for region files that do not exist yet
+	std::unordered_map<uint64_t, std::unique_ptr<RegionFile>> m_files;
+	std::vector<uint8_t> m_payload;
+};
+
+#endif // !regionfile_hh__
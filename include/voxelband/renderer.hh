@@ -36,7 +36,7 @@ public:
 		m_handle = value;
 	}
 
-	bool is_valid() {
+	bool is_valid() const {
 		return isValid(m_handle);
 	}
 };
@@ -106,6 +106,35 @@ struct DynamicIndexBuffer : SafeWrapper<bgfx::DynamicIndexBufferHandle> {
 	}
 };
 
+struct VertexBuffer : SafeWrapper<bgfx::VertexBufferHandle> {
+	using SafeWrapper<bgfx::VertexBufferHandle>::SafeWrapper;
+
+	bool create(const bgfx::Memory* _mem
+		, const bgfx::VertexDecl& _decl
+		, uint16_t _flags = BGFX_BUFFER_NONE)
+	{
+		auto handle = bgfx::createVertexBuffer(_mem, _decl, _flags);
+		if (!isValid(handle))
+			return false;
+		set(handle);
+		return true;
+	}
+};
+
+struct IndexBuffer : SafeWrapper<bgfx::IndexBufferHandle> {
+	using SafeWrapper<bgfx::IndexBufferHandle>::SafeWrapper;
+
+	bool create(const bgfx::Memory* _mem
+		, uint16_t _flags = BGFX_BUFFER_NONE)
+	{
+		auto handle = bgfx::createIndexBuffer(_mem, _flags);
+		if (!isValid(handle))
+			return false;
+		set(handle);
+		return true;
+	}
+};
+
 struct ShaderProgram : SafeWrapper<bgfx::ProgramHandle>
 {
 	using SafeWrapper<bgfx::ProgramHandle>::SafeWrapper;
@@ -120,21 +149,37 @@ struct ShaderProgram : SafeWrapper<bgfx::ProgramHandle>
 };
 
 class VoxelChunk;
+class GeometryArena;
 
 class Renderer {
 public:
 	void init(boost::filesystem::path path);
 	void init_frame(float stime);
-	void render(VoxelChunk const&);
-	void render_rock(DynamicVertexBuffer const& vb, DynamicIndexBuffer const& ib);
+	//Draw the arena geometry of chunks, one submit per run of allocations
+	//lying next to each other in a page. Returns the number of submits.
+	uint32_t render(std::vector<VoxelChunk const*> const& chunks, GeometryArena const& arena);
+	//mtx is the model matrix of the page's region. Face records are drawn
+	//as instances of vb, two records each.
+	void render_rock(DynamicVertexBuffer const& vb, uint32_t first_vertex, uint32_t num_vertices,
+		bool face_records, IndexBuffer const& ib, float const* mtx);
+
+	//MeshingMode::FaceRecords can be drawn, valid after init
+	bool supports_face_records() const {
+		return m_face_record_shader.is_valid();
+	}
 protected:
 	Texture m_texture_color, m_texture_normal;
 	ShaderProgram m_bump_mapping_shader;
+	//Expands face records, see vs_voxel_instanced. Only loaded when the
+	//renderer supports instancing and integer shader ops.
+	ShaderProgram m_face_record_shader;
+	//Corners of the two quads of a face record instance
+	VertexBuffer m_face_corners;
 	Uniform s_texColor;
 	Uniform s_texNormal;
-	Uniform u_lightPosRadius;
-	Uniform u_lightRgbInnerR;
-	uint16_t m_numLights;
+	//Colours of full sky and block light, see fs_bump
+	Uniform u_skyColor;
+	Uniform u_blockColor;
 };
 
 #endif // !renderer_hh__
@@ -0,0 +1,119 @@
+#ifndef streaming_hh__
+#define streaming_hh__
+
+#include <cstdint>
+#include <array>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "voxel.hh"
+#include "chunkmap.hh"
+#include "terrain.hh"
+#include "regionfile.hh"
+
+//Keeps the chunks within a sphere around the camera loaded. Missing chunks
+//are loaded from the RegionStore or generated by a TerrainGenerator on
+//worker threads, nearest and most in front of the camera first, and
+//inserted into the ChunkMap by update within a time budget. Chunks past the
+//unload radius are dropped, modified ones are saved on the workers first, so
+//the main thread never waits for the disk.
+class ChunkStreamer {
+public:
+	struct Settings {
+		//In chunks
+		int radius = 8;
+		//Chunks are unloaded radius + unload_margin chunks away, so moving
+		//back and forth over a chunk border does not reload anything
+		int unload_margin = 2;
+		unsigned int num_workers = 2;
+		//Loads queued on or finished by the workers, bounds the results
+		//waiting for the main thread
+		unsigned int max_in_flight = 64;
+		//Main thread time per frame spent inserting finished chunks
+		double budget_ms = 1.0;
+		MeshingMode meshing_mode = MeshingMode::PerFace;
+	};
+
+	//Chunks missing from store are generated from seed. store may be null,
+	//then every chunk is generated and nothing is saved.
+	ChunkStreamer(Settings const& settings, uint32_t seed, RegionStore* store);
+	ChunkStreamer(ChunkStreamer const&) = delete;
+	ChunkStreamer& operator=(ChunkStreamer const&) = delete;
+	//Waits for the queued saves, queued loads are dropped
+	~ChunkStreamer();
+
+	//Once per frame before meshing. eye is the camera position in voxels,
+	//view_dir where it looks, need not be normalized.
+	void update(ChunkMap& chunks, float const* eye, float const* view_dir);
+
+	//Chunks still to be requested
+	size_t num_queued() const {
+		return m_queue.size();
+	}
+
+	//Loads handed to the workers and not inserted yet
+	size_t num_in_flight() const {
+		return m_in_flight.size();
+	}
+
+private:
+	struct Request {
+		int x, y, z;
+		//Lower loads first
+		float priority;
+	};
+
+	struct Job {
+		int x, y, z;
+		//Saves carry the voxels to write, loads get them filled in
+		bool save = false;
+		PalettedVoxels voxels;
+	};
+
+	void rebuild_queue(ChunkMap& chunks, float const* view_dir);
+	void unload(ChunkMap& chunks);
+	void dispatch(ChunkMap& chunks);
+	void insert_finished(ChunkMap& chunks);
+	bool in_radius(int x, int y, int z, int radius) const;
+
+	void push_job(std::unique_ptr<Job> job);
+	std::unique_ptr<Job> pop_result();
+	void worker();
+
+	Settings m_settings;
+	TerrainGenerator m_generator;
+	RegionStore* m_store;
+
+	//Camera chunk and view direction the queue was built for
+	bool m_has_camera = false;
+	int m_camera[3] = {};
+	float m_view_dir[3] = {};
+	//Sorted by descending priority, requests are popped from the back
+	std::vector<Request> m_queue;
+	//Keys of loads handed to the workers
+	std::unordered_set<uint64_t> m_in_flight;
+	//Keys of unloaded chunks not written yet, they are loaded again only
+	//after their save so the load sees the edits
+	std::unordered_set<uint64_t> m_saving;
+	std::vector<Request> m_deferred;
+
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_job_mutex;
+	std::condition_variable m_job_ready;
+	std::deque<std::unique_ptr<Job>> m_jobs;
+	bool m_stopping = false;
+
+	std::mutex m_result_mutex;
+	std::deque<std::unique_ptr<Job>> m_results;
+
+	//RegionStore is not thread safe
+	std::mutex m_store_mutex;
+};
+
+#endif // !streaming_hh__
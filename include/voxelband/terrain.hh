@@ -0,0 +1,57 @@
+#ifndef terrain_hh__
+#define terrain_hh__
+
+#include <cstdint>
+#include <array>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "voxel.hh"
+
+//Height map terrain from a few octaves of gradient noise, grass over a few
+//voxels of dirt over rock. The noise is evaluated four samples at a time and
+//the height map of a chunk column is cached for the other chunks of the
+//column. Chunks depend only on the seed and their coordinates, whatever the
+//number of threads generating them.
+class TerrainGenerator {
+public:
+	//Surface heights stay within [BASE_HEIGHT - AMPLITUDE, BASE_HEIGHT + AMPLITUDE]
+	static const int BASE_HEIGHT = 32;
+	static const int AMPLITUDE = 24;
+	static const int DIRT_DEPTH = 3;
+	//Columns kept for chunks generated later, 2 KiB each
+	static const size_t MAX_CACHED_COLUMNS = 4096;
+
+	explicit TerrainGenerator(uint32_t seed = 1);
+	TerrainGenerator(TerrainGenerator const&) = delete;
+	TerrainGenerator& operator=(TerrainGenerator const&) = delete;
+
+	//Safe to call from several threads at once
+	void generate(int x, int y, int z, PalettedVoxels& voxels) const;
+
+	uint32_t get_seed() const {
+		return m_seed;
+	}
+
+private:
+	struct Column {
+		//Surface heights in voxels, x fastest
+		std::array<int16_t, VOXEL_CHUNK_WIDTH * VOXEL_CHUNK_DEPTH> heights;
+		int min_height;
+		int max_height;
+	};
+
+	std::shared_ptr<Column const> get_column(int x, int z) const;
+	std::shared_ptr<Column const> make_column(int x, int z) const;
+
+	uint32_t m_seed;
+
+	mutable std::mutex m_column_mutex;
+	mutable std::unordered_map<uint64_t, std::shared_ptr<Column const>> m_columns;
+	//Oldest first
+	mutable std::deque<uint64_t> m_column_order;
+};
+
+#endif // !terrain_hh__
@@ -2,9 +2,11 @@
 #define voxel_hh__
 
 #include <cassert>
+#include <algorithm>
 #include <array>
 #include <vector>
 #include <map>
+#include <memory>
 
 #include "renderer.hh"
 
@@ -16,55 +18,341 @@ const int VOXEL_SLICE_SIZE = VOXEL_CHUNK_WIDTH * VOXEL_CHUNK_HEIGHT;
 
 const int NUM_VOXELS = VOXEL_CHUNK_WIDTH*VOXEL_CHUNK_HEIGHT*VOXEL_CHUNK_DEPTH;
 
-struct PosNormalTangentTexcoordVertex
+const int VOXEL_CHUNK_SIZE[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, VOXEL_CHUNK_DEPTH };
+
+//Chunk coordinate along axis of the chunk holding world voxel coordinate
+//voxel, rounded towards negative infinity
+inline int voxel_chunk_coord(int voxel, int axis) {
+	const int size = VOXEL_CHUNK_SIZE[axis];
+	return voxel >= 0 ? voxel / size : (voxel + 1) / size - 1;
+}
+
+//Index into a chunk's voxels of chunk-local voxel x, y, z
+inline unsigned int voxel_index(int x, int y, int z) {
+	return unsigned((z * VOXEL_CHUNK_HEIGHT + y) * VOXEL_CHUNK_WIDTH + x);
+}
+
+//Chunks are remeshed and uploaded in slabs of VOXEL_SLAB_DEPTH slices along z
+const int VOXEL_SLAB_DEPTH = 4;
+const int NUM_VOXEL_SLABS = VOXEL_CHUNK_DEPTH / VOXEL_SLAB_DEPTH;
+const uint32_t ALL_VOXEL_SLABS = ~0u >> (32 - NUM_VOXEL_SLABS);
+
+static_assert(VOXEL_CHUNK_DEPTH % VOXEL_SLAB_DEPTH == 0, "Chunk depth must be a whole number of slabs");
+static_assert(NUM_VOXEL_SLABS <= 32, "Dirty slabs are tracked in a 32 bit mask");
+
+//Distant chunks are meshed from blocks of 2^lod voxels a side
+const int MAX_VOXEL_LOD = 3;
+
+//Level of detail for a chunk distance chunk widths from the camera, one level
+//coarser each time the distance doubles past lod_distance. A chunk keeps its
+//current level within half a chunk of a boundary so it does not flip back and
+//forth while the camera hovers there.
+inline int select_lod(float distance, float lod_distance, int current) {
+	auto lod_at = [lod_distance](float d) {
+		int lod = 0;
+		for (float limit = lod_distance; lod < MAX_VOXEL_LOD && d > limit; limit *= 2.0f)
+			++lod;
+		return lod;
+	};
+	if (lod_distance <= 0.0f)
+		return 0;
+	if (current >= lod_at(distance - 0.5f) && current <= lod_at(distance + 0.5f))
+		return current;
+	return lod_at(distance);
+}
+
+//Face of a voxel or chunk, axis face / 2 and positive side face % 2
+enum VoxelFace : int {
+	FACE_LEFT = 0,
+	FACE_RIGHT,
+	FACE_BOTTOM,
+	FACE_TOP,
+	FACE_FRONT,
+	FACE_BACK,
+	NUM_FACES
+};
+
+inline VoxelFace opposite_face(VoxelFace face) {
+	return VoxelFace(face ^ 1);
+}
+
+//Chunk or voxel offset across each VoxelFace
+const int VOXEL_FACE_OFFSET[NUM_FACES][3] = {
+	{ -1,  0,  0 },
+	{  1,  0,  0 },
+	{  0, -1,  0 },
+	{  0,  1,  0 },
+	{  0,  0, -1 },
+	{  0,  0,  1 },
+};
+
+//Pairs of chunk faces that see each other through air, one bit per unordered
+//pair. Defaults to every pair connected, which never hides anything.
+struct FaceConnectivity {
+	static const int NUM_PAIRS = NUM_FACES * (NUM_FACES - 1) / 2;
+	static const uint16_t ALL = (1u << NUM_PAIRS) - 1;
+
+	uint16_t bits = ALL;
+
+	static int pair_index(VoxelFace a, VoxelFace b) {
+		if (a > b)
+			std::swap(a, b);
+		return a * (2 * NUM_FACES - a - 1) / 2 + (b - a - 1);
+	}
+
+	bool connects(VoxelFace a, VoxelFace b) const {
+		return a == b || (bits >> pair_index(a, b)) & 1;
+	}
+
+	//Connect every pair of faces in a mask of 1 << VoxelFace bits
+	void connect(uint32_t faces) {
+		for (int a = 0; a < NUM_FACES; ++a)
+			for (int b = a + 1; b < NUM_FACES; ++b)
+				if ((faces >> a) & (faces >> b) & 1)
+					bits |= uint16_t(1u << pair_index(VoxelFace(a), VoxelFace(b)));
+	}
+};
+
+//Chunk-local corner position and face index, see VoxelFace. Normal, tangent
+//and texture coordinates are reconstructed in vs_bump_packed. m_color holds
+//the light baked by the mesher, sky and block light of the voxel in front of
+//the face in red and green and a per face shade in blue. Face records, see
+//MeshingMode::FaceRecords, hold the voxel's lowest corner instead.
+struct PackedVoxelVertex
 {
-	float m_x;
-	float m_y;
-	float m_z;
-	uint32_t m_normal;
-	uint32_t m_tangent;
-	int16_t m_u;
-	int16_t m_v;
+	uint8_t m_x;
+	uint8_t m_y;
+	uint8_t m_z;
+	uint8_t m_face;
+	uint32_t m_color;
 
 	static void init()
 	{
 		ms_decl
 			.begin()
-			.add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
-			.add(bgfx::Attrib::Normal, 4, bgfx::AttribType::Uint8, true, true)
-			.add(bgfx::Attrib::Tangent, 4, bgfx::AttribType::Uint8, true, true)
-			.add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Int16, true, true)
+			.add(bgfx::Attrib::TexCoord1, 4, bgfx::AttribType::Uint8, true)
+			.add(bgfx::Attrib::Color0, 4, bgfx::AttribType::Uint8, true)
+			.end();
+
+		ms_record_decl
+			.begin()
+			.add(bgfx::Attrib::TexCoord7, 4, bgfx::AttribType::Float)
 			.end();
 	}
 
 	static bgfx::VertexDecl ms_decl;
+	//Two face records per element, read bit for bit as the instance data
+	//i_data0 of vs_voxel_instanced
+	static bgfx::VertexDecl ms_record_decl;
 };
 
+static_assert(sizeof(PackedVoxelVertex) == 8, "Packed voxel vertex must stay 8 bytes");
+static_assert(VOXEL_CHUNK_WIDTH <= 255 && VOXEL_CHUNK_HEIGHT <= 255 && VOXEL_CHUNK_DEPTH <= 255,
+	"Packed voxel vertex stores corner positions in 8 bits");
+
 
 enum class VoxelType : unsigned int {
 	V_EMPTY = 0,
 	V_DIRT,
 	V_ROCK,
-	V_GRASS
+	V_GRASS,
+	//Gives off block light, see voxel_emission
+	V_LAMP
 };
 
+//Voxel types are below this, data read from disk is checked against it
+const unsigned int NUM_VOXEL_TYPES = unsigned(VoxelType::V_LAMP) + 1;
+
+//PerFace emits one quad per visible voxel face, Greedy merges coplanar
+//faces of the same type into rectangles with tiling texture coordinates.
+//FaceRecords emits a single PackedVoxelVertex per visible face, a quarter
+//of PerFace's vertices, which vs_voxel_instanced expands into the quad.
+//It needs instancing and integer shader ops, see
+//Renderer::supports_face_records.
+enum class MeshingMode {
+	PerFace,
+	Greedy,
+	FaceRecords
+};
+
+//Voxels of one chunk as indices into a small palette, bit-packed at 0, 1, 2,
+//4, 8 or 16 bits per voxel. Indices widen when the palette outgrows them and
+//a chunk made of a single type stores no indices at all.
+class PalettedVoxels {
+public:
+	PalettedVoxels();
+
+	VoxelType get(unsigned int index) const {
+		assert(index < NUM_VOXELS);
+		return m_palette[m_bits ? read(index) : 0];
+	}
+
+	//Returns false when the voxel already had this type
+	bool set(unsigned int index, VoxelType voxel_type);
+	void fill(VoxelType voxel_type);
+	//Replace every voxel from NUM_VOXELS unpacked voxels, much cheaper than
+	//set for a whole chunk
+	void pack(VoxelType const* voxels);
+
+	//Decode voxels [begin, end) into out
+	void unpack(VoxelType* out, unsigned int begin, unsigned int end) const;
+
+	//Drop palette entries no voxel uses and narrow the indices to match
+	void compact();
+
+	bool is_uniform() const {
+		return m_bits == 0;
+	}
+
+	unsigned int bits_per_voxel() const {
+		return m_bits;
+	}
+
+	size_t palette_size() const {
+		return m_palette.size();
+	}
+
+	//Heap and inline bytes held by this chunk's voxels
+	size_t memory_usage() const;
+
+	//Append the palette and run length encoded indices to out
+	void encode(std::vector<uint8_t>& out) const;
+	//Replace the voxels with an encoding made by encode. Returns false and
+	//leaves the voxels empty when data is not exactly one valid encoding:
+	//unknown or repeated types, runs not covering the chunk or bytes left over.
+	bool decode(uint8_t const* data, size_t size);
+
+private:
+	uint32_t read(unsigned int index) const {
+		auto bit = index * m_bits;
+		return uint32_t(m_words[bit / 64] >> (bit % 64)) & ((1u << m_bits) - 1);
+	}
+
+	void write(unsigned int index, uint32_t value);
+	uint32_t palette_index(VoxelType voxel_type);
+	void repack(unsigned int bits, std::vector<uint32_t> const& remap);
+
+	std::vector<VoxelType> m_palette;
+	//Voxels referring to each palette entry, entries at zero are reused
+	std::vector<uint32_t> m_counts;
+	//Indices never straddle words since every width divides 64
+	std::vector<uint64_t> m_words;
+	unsigned int m_bits = 0;
+};
+
+//Chunk-local box around the corners of a mesh, empty while min > max
+struct MeshBounds {
+	std::array<uint8_t, 3> min = { 255, 255, 255 };
+	std::array<uint8_t, 3> max = { 0, 0, 0 };
+
+	bool is_empty() const {
+		return min[0] > max[0];
+	}
+
+	void add(PackedVoxelVertex const& vertex) {
+		min = { std::min(min[0], vertex.m_x), std::min(min[1], vertex.m_y), std::min(min[2], vertex.m_z) };
+		max = { std::max(max[0], vertex.m_x), std::max(max[1], vertex.m_y), std::max(max[2], vertex.m_z) };
+	}
+
+	void add(MeshBounds const& bounds) {
+		for (int i = 0; i < 3; ++i) {
+			min[i] = std::min(min[i], bounds.min[i]);
+			max[i] = std::max(max[i], bounds.max[i]);
+		}
+	}
+};
+
+//Vertices of one slab per voxel type, see VoxelChunk::apply_mesh
+using SlabMesh = std::map<VoxelType, std::vector<PackedVoxelVertex>>;
+
+struct ChunkBorders;
+struct ChunkLight;
+struct ChunkMeshJob;
+struct ChunkMeshResult;
+
+//Vertices one draw can reach through the shared 16 bit quad indices, larger
+//meshes are split into parts of at most this many vertices
+const uint32_t MAX_DRAW_VERTICES = 65536;
+static_assert(MAX_DRAW_VERTICES % 4 == 0, "Mesh parts must hold whole quads");
+
+//Range of vertices sub-allocated from a GeometryArena page
+struct ArenaAllocation {
+	static const uint32_t INVALID_PAGE = UINT32_MAX;
+
+	uint32_t page = INVALID_PAGE;
+	uint32_t start = 0;
+	uint32_t capacity = 0;
+
+	bool is_valid() const {
+		return page != INVALID_PAGE;
+	}
+};
+
+class ChunkMap;
+class GeometryArena;
+
 class VoxelChunk {
+	friend class ChunkMap;
 protected:
-	std::array<VoxelType, NUM_VOXELS> m_voxel = {};
+	PalettedVoxels m_voxel;
 	struct VoxelBuffer {
 		VoxelBuffer(const VoxelBuffer&) = delete;
 		VoxelBuffer(VoxelBuffer&&) = default;
-		DynamicVertexBuffer vertex_buffer;
-		DynamicIndexBuffer index_buffer;
-		std::vector<PosNormalTangentTexcoordVertex> vertices;
-		std::vector<uint16_t> indices;
+		std::vector<PackedVoxelVertex> vertices;
+		//Vertices are stored slab by slab, slab_start holds the first vertex of each
+		std::array<uint32_t, NUM_VOXEL_SLABS + 1> slab_start = {};
+		//Vertex range changed since the last upload
+		uint32_t dirty_begin = UINT32_MAX;
+		uint32_t dirty_end = 0;
+		//Arena ranges holding the uploaded vertices, part n holds vertices from
+		//n * MAX_DRAW_VERTICES on
+		struct Part {
+			ArenaAllocation allocation;
+			uint32_t num_uploaded = 0;
+		};
+		std::vector<Part> parts;
 	};
 	using BufferContainer = std::map<VoxelType, VoxelBuffer>;
 	BufferContainer m_buffers;
 	bgfx::ProgramHandle m_program = BGFX_INVALID_HANDLE;
+	MeshingMode m_meshing_mode = MeshingMode::PerFace;
+	//The buffers hold face records instead of quads, as of the last applied mesh
+	bool m_face_records = false;
+	int m_lod = 0;
+	uint32_t m_dirty_slabs = ALL_VOXEL_SLABS;
+	bool m_mesh_pending = false;
+	//Unique to the voxels this chunk was created with and moved along with
+	//them, mesh results of a chunk unloaded and loaded again at the same
+	//coordinates do not match the new one
+	uint64_t m_generation = 0;
+	//Voxels were edited since they were loaded or generated
+	bool m_modified = false;
+	//Adjacent chunks by VoxelFace and chunk coordinates, kept up to date by ChunkMap
+	std::array<VoxelChunk*, NUM_FACES> m_neighbours = {};
+	std::array<int, 3> m_position = {};
+	std::array<MeshBounds, NUM_VOXEL_SLABS> m_slab_bounds;
+	MeshBounds m_mesh_bounds;
+	FaceConnectivity m_connectivity;
+	//Solid box inside the chunk, drawn into the occlusion depth buffer
+	MeshBounds m_occluder;
+	//Set by ChunkMap, chunks without an arena keep their meshes on the CPU
+	GeometryArena* m_arena = nullptr;
+	//Set by ChunkMap, queues the chunk whenever it needs a mesh job
+	ChunkMap* m_map = nullptr;
+	bool m_mesh_queued = false;
+	//Null until the LightEngine lit the chunk, meshed as UNLIT_LIGHT
+	std::shared_ptr<ChunkLight const> m_light;
 
-	void update_vertex_buffer(VoxelBuffer&);
-	void update_index_buffer(VoxelBuffer&);
+	static void gather_borders(ChunkBorders&, int lod, VoxelChunk const* left, VoxelChunk const* right,
+		VoxelChunk const* above, VoxelChunk const* below, VoxelChunk const* front, VoxelChunk const* back);
+	//Remesh changed slices and the neighbours' side of changed borders
+	void mark_changed(uint32_t changed_slices, uint32_t border_faces);
+	//Enter the ChunkMap's mesh queue once dirty without a pending job
+	void queue_meshing();
+	void replace_slab(int slab, SlabMesh&);
+	void upload_buffer(VoxelType type, VoxelBuffer&);
+	void release_geometry();
+	static uint64_t new_generation();
 
 public:
 	VoxelChunk();
@@ -77,9 +365,25 @@ public:
 	VoxelChunk& operator=(VoxelChunk const&) = delete;
 	VoxelChunk& operator=(VoxelChunk&& other) {
 		if (this != &other) {
+			//Neighbour links, position, level of detail, light, arena and mesh
+			//queue stay with the chunk's place in the ChunkMap. Both meshes
+			//leave the arena and are uploaded again by the next apply_mesh.
+			release_geometry();
+			other.release_geometry();
 			m_program = other.m_program;
-			std::copy(other.m_voxel.begin(), other.m_voxel.end(), m_voxel.begin());
+			m_meshing_mode = other.m_meshing_mode;
+			m_face_records = other.m_face_records;
+			m_dirty_slabs = other.m_dirty_slabs;
+			m_mesh_pending = other.m_mesh_pending;
+			m_generation = other.m_generation;
+			other.m_generation = new_generation();
+			m_modified = other.m_modified;
+			m_voxel = std::move(other.m_voxel);
 			m_buffers = std::move(other.m_buffers);
+			m_slab_bounds = other.m_slab_bounds;
+			m_mesh_bounds = other.m_mesh_bounds;
+			m_connectivity = other.m_connectivity;
+			m_occluder = other.m_occluder;
 			other.m_program = BGFX_INVALID_HANDLE;
 		}
 		return *this;
@@ -91,7 +395,10 @@ public:
 		assert(y < VOXEL_CHUNK_HEIGHT);
 		assert(z < VOXEL_CHUNK_DEPTH);
 
-		m_voxel[z*VOXEL_CHUNK_WIDTH*VOXEL_CHUNK_HEIGHT + y*VOXEL_CHUNK_WIDTH + x] = voxel_type;
+		if (m_voxel.set(voxel_index(int(x), int(y), int(z)), voxel_type)) {
+			mark_dirty(z);
+			m_modified = true;
+		}
 	}
 
 	VoxelType get(unsigned int x, unsigned int y, unsigned int z) const {
@@ -99,9 +406,95 @@ public:
 		assert(y < VOXEL_CHUNK_HEIGHT);
 		assert(z < VOXEL_CHUNK_DEPTH);
 
-		return m_voxel[z*VOXEL_CHUNK_WIDTH*VOXEL_CHUNK_HEIGHT + y*VOXEL_CHUNK_WIDTH + x];
+		return m_voxel.get(voxel_index(int(x), int(y), int(z)));
+	}
+
+	//Replace every voxel, e.g. with voxels loaded from a RegionFile
+	void set_voxels(PalettedVoxels voxels) {
+		m_voxel = std::move(voxels);
+		m_modified = false;
+		mark_all_dirty();
+	}
+
+	//Replace every voxel with the result of a batch of edits, see WorldEdit.
+	//changed_slices has a bit per z slice holding changed voxels and
+	//border_faces a bit per VoxelFace whose border voxels changed, those
+	//neighbours remesh their side of the border.
+	void apply_edit(VoxelType const* voxels, uint32_t changed_slices, uint32_t border_faces);
+
+	//Light published by the LightEngine, changed_slices and border_faces as
+	//for apply_edit
+	void set_light(std::shared_ptr<ChunkLight const> light, uint32_t changed_slices, uint32_t border_faces);
+
+	std::shared_ptr<ChunkLight const> const& get_light() const {
+		return m_light;
+	}
+
+	//Only modified chunks need saving, the rest can be loaded or generated again
+	bool is_modified() const {
+		return m_modified;
+	}
+
+	PalettedVoxels const& get_voxels() const {
+		return m_voxel;
+	}
+
+	//Shrink the voxel storage after large edits, e.g. terrain generation
+	void compact_voxels() {
+		m_voxel.compact();
+	}
+
+	//Mark the slab holding slice z for remeshing, used by neighbours whose
+	//border voxels changed
+	void mark_dirty(unsigned int z);
+	void mark_all_dirty();
+	//Remesh the slabs bordering the neighbour across face
+	void mark_border_dirty(VoxelFace face);
+
+	VoxelChunk* get_neighbour(VoxelFace face) const {
+		return m_neighbours[face];
+	}
+
+	std::array<int, 3> const& get_position() const {
+		return m_position;
+	}
+
+	//Bounds of the uploaded mesh in chunk-local voxel units
+	MeshBounds const& get_mesh_bounds() const {
+		return m_mesh_bounds;
+	}
+
+	//Faces connected through air as of the last applied mesh
+	FaceConnectivity const& get_connectivity() const {
+		return m_connectivity;
+	}
+
+	//Solid box in chunk-local voxel units as of the last applied mesh
+	MeshBounds const& get_occluder() const {
+		return m_occluder;
+	}
+
+	//Air chunks keep no index words and mesh to nothing
+	bool is_empty() const {
+		return m_voxel.is_uniform() && m_voxel.get(0) == VoxelType::V_EMPTY;
+	}
+
+	bool is_dirty() const {
+		return m_dirty_slabs != 0;
 	}
 
+	//A mesh job was handed out and its result has not been applied yet
+	bool is_mesh_pending() const {
+		return m_mesh_pending;
+	}
+
+	//Carried by mesh jobs and results, see MeshPipeline::upload
+	uint64_t get_generation() const {
+		return m_generation;
+	}
+
+	//Remesh dirty slabs on the calling thread and upload only the changed
+	//vertex ranges. Does nothing while a mesh job is pending.
 	void update_buffers(
 		VoxelChunk* left = nullptr,
 		VoxelChunk* right = nullptr,
@@ -111,6 +504,42 @@ public:
 		VoxelChunk* back = nullptr
 	);
 
+	//Snapshot the dirty slabs and neighbour borders for meshing on a worker,
+	//see MeshPipeline. The slabs count as clean until edited again.
+	std::unique_ptr<ChunkMeshJob> make_mesh_job(
+		VoxelChunk* left = nullptr,
+		VoxelChunk* right = nullptr,
+		VoxelChunk* above = nullptr,
+		VoxelChunk* below = nullptr,
+		VoxelChunk* front = nullptr,
+		VoxelChunk* back = nullptr
+	);
+
+	//Splice meshed slabs into the buffers and upload them, main thread only
+	void apply_mesh(ChunkMeshResult&);
+
+	void set_meshing_mode(MeshingMode mode) {
+		if (m_meshing_mode == mode)
+			return;
+		m_meshing_mode = mode;
+		mark_all_dirty();
+	}
+
+	MeshingMode get_meshing_mode() const {
+		return m_meshing_mode;
+	}
+
+	bool has_face_records() const {
+		return m_face_records;
+	}
+
+	//Remeshes the chunk and the borders of its neighbours when lod changes
+	void set_lod(int lod);
+
+	int get_lod() const {
+		return m_lod;
+	}
+
 	BufferContainer const& get_buffers() const {
 		return m_buffers;
 	}
@@ -0,0 +1,62 @@
+#ifndef worldedit_hh__
+#define worldedit_hh__
+
+#include <cstdint>
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include "voxel.hh"
+#include "chunkmap.hh"
+
+//Batch of voxel edits on a ChunkMap. Writes go to unpacked copies of the
+//chunks they touch and commit packs each changed chunk once, marking it and
+//the neighbours across changed borders dirty, so every affected chunk is
+//remeshed by a single job however many voxels changed. Coordinates are world
+//voxels, boxes include min and exclude max. Voxels of chunks that are not
+//loaded are left alone, and touched chunks must stay loaded until commit.
+//Writes not committed are dropped with the WorldEdit.
+class WorldEdit {
+public:
+	using Voxel = std::array<int, 3>;
+
+	explicit WorldEdit(ChunkMap& chunks);
+	WorldEdit(WorldEdit const&) = delete;
+	WorldEdit& operator=(WorldEdit const&) = delete;
+
+	//Reads see the writes made so far
+	VoxelType get(int x, int y, int z);
+	void set(int x, int y, int z, VoxelType type);
+
+	void fill_box(Voxel const& min, Voxel const& max, VoxelType type);
+	//Voxels whose centers are within radius of center
+	void fill_sphere(std::array<float, 3> const& center, float radius, VoxelType type);
+	void replace(Voxel const& min, Voxel const& max, VoxelType from, VoxelType to);
+	//Copy the box min, max to the box of the same size at destination, as
+	//if through a temporary when the boxes overlap
+	void copy_region(Voxel const& min, Voxel const& max, Voxel const& destination);
+
+	//Apply the writes and hand the changed chunks to the map's LightEngine,
+	//returns the number of chunks that changed
+	unsigned int commit();
+
+private:
+	struct PendingChunk {
+		VoxelChunk* chunk;
+		std::vector<VoxelType> voxels;
+		uint32_t changed_slices = 0;
+		uint32_t border_faces = 0;
+	};
+
+	//Null when chunk x, y, z is not loaded
+	PendingChunk* pending(int x, int y, int z);
+
+	//voxel = fun(x, y, z, voxel) for every loaded voxel of the box, chunk by chunk
+	template<typename Tfun>
+	void edit_box(Voxel const& min, Voxel const& max, Tfun fun);
+
+	ChunkMap& m_chunks;
+	std::unordered_map<uint64_t, PendingChunk> m_pending;
+};
+
+#endif // !worldedit_hh__
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "arena.hh"
+#include "profiler.hh"
+
+namespace {
+	//Page shadows start small and double up to PAGE_VERTICES
+	const uint32_t MIN_PAGE_SHADOW = 4096;
+
+	//Indices of quads [first, last) with the (0, 1, 2), (2, 1, 3) corner order
+	void add_quad_indices(std::vector<uint16_t>& indices, uint32_t first, uint32_t last) {
+		for (uint32_t quad = first; quad < last; ++quad) {
+			auto base = quad * 4;
+			indices.emplace_back(uint16_t(base + 0));
+			indices.emplace_back(uint16_t(base + 1));
+			indices.emplace_back(uint16_t(base + 2));
+			indices.emplace_back(uint16_t(base + 2));
+			indices.emplace_back(uint16_t(base + 1));
+			indices.emplace_back(uint16_t(base + 3));
+		}
+	}
+}
+
+GeometryArena::GeometryArena() {
+}
+
+GeometryArena::~GeometryArena() {
+}
+
+uint32_t GeometryArena::take_page(uint64_t region, VoxelType type, bool face_records) {
+	uint32_t index;
+	if (!m_free_pages.empty()) {
+		index = m_free_pages.back();
+		m_free_pages.pop_back();
+	}
+	else {
+		index = uint32_t(m_pages.size());
+		m_pages.emplace_back(std::make_unique<Page>());
+	}
+
+	auto& page = *m_pages[index];
+	page.region = region;
+	page.type = type;
+	//The buffer is created again with the other layout by the next flush
+	if (page.face_records != face_records) {
+		page.buffer.set(BGFX_INVALID_HANDLE);
+		page.gpu_capacity = 0;
+	}
+	page.face_records = face_records;
+	page.free_ranges.assign(1, Range{ 0, PAGE_VERTICES });
+	page.used = 0;
+	m_buckets[Bucket(region, type, face_records)].emplace_back(index);
+	return index;
+}
+
+ArenaAllocation GeometryArena::allocate(uint64_t region, VoxelType type, uint32_t num_vertices, bool face_records) {
+	static_assert(PAGE_VERTICES % 2 == 0 && MIN_PAGE_SHADOW % 2 == 0, "Pages must hold whole pairs of face records");
+	num_vertices = std::min(std::max(num_vertices, 1u), uint32_t(PAGE_VERTICES));
+	//Pairs never straddle allocations when every record allocation is even
+	if (face_records)
+		num_vertices = (num_vertices + 1) & ~1u;
+
+	auto try_page = [&](uint32_t index, ArenaAllocation& allocation) {
+		auto& page = *m_pages[index];
+		for (auto range = page.free_ranges.begin(); range != page.free_ranges.end(); ++range) {
+			if (range->size < num_vertices)
+				continue;
+
+			allocation = ArenaAllocation{ index, range->start, num_vertices };
+			range->start += num_vertices;
+			range->size -= num_vertices;
+			if (!range->size)
+				page.free_ranges.erase(range);
+			page.used += num_vertices;
+
+			auto end = allocation.start + num_vertices;
+			if (page.shadow.size() < end) {
+				auto size = std::max<uint32_t>(uint32_t(page.shadow.size()), MIN_PAGE_SHADOW);
+				while (size < end)
+					size *= 2;
+				page.shadow.resize(size, PackedVoxelVertex{});
+			}
+			return true;
+		}
+		return false;
+	};
+
+	ArenaAllocation allocation;
+	auto bucket = m_buckets.find(Bucket(region, type, face_records));
+	if (bucket != m_buckets.end()) {
+		for (auto index : bucket->second)
+			if (try_page(index, allocation))
+				return allocation;
+	}
+
+	if (!try_page(take_page(region, type, face_records), allocation))
+		throw std::runtime_error("Unable to allocate arena vertices.");
+	return allocation;
+}
+
+void GeometryArena::free(ArenaAllocation& allocation) {
+	if (!allocation.is_valid())
+		return;
+
+	auto& page = *m_pages[allocation.page];
+	clear(allocation, 0, allocation.capacity);
+
+	auto& ranges = page.free_ranges;
+	auto next = std::lower_bound(ranges.begin(), ranges.end(), allocation.start,
+		[](Range const& range, uint32_t start) { return range.start < start; });
+	next = ranges.insert(next, Range{ allocation.start, allocation.capacity });
+	if (next + 1 != ranges.end() && next->start + next->size == (next + 1)->start) {
+		next->size += (next + 1)->size;
+		ranges.erase(next + 1);
+	}
+	if (next != ranges.begin() && (next - 1)->start + (next - 1)->size == next->start) {
+		(next - 1)->size += next->size;
+		ranges.erase(next);
+	}
+
+	page.used -= allocation.capacity;
+	if (!page.used) {
+		Bucket key(page.region, page.type, page.face_records);
+		auto& pages = m_buckets[key];
+		pages.erase(std::find(pages.begin(), pages.end(), allocation.page));
+		if (pages.empty())
+			m_buckets.erase(key);
+		m_free_pages.emplace_back(allocation.page);
+	}
+
+	allocation = ArenaAllocation{};
+}
+
+void GeometryArena::write(ArenaAllocation const& allocation, uint32_t offset,
+	PackedVoxelVertex const* vertices, uint32_t count, std::array<uint8_t, 3> const& origin) {
+
+	assert(allocation.is_valid());
+	count = std::min(count, allocation.capacity - std::min(offset, allocation.capacity));
+	if (!count)
+		return;
+
+	auto& page = *m_pages[allocation.page];
+	auto* out = page.shadow.data() + allocation.start + offset;
+	for (uint32_t i = 0; i < count; ++i) {
+		out[i] = vertices[i];
+		out[i].m_x += origin[0];
+		out[i].m_y += origin[1];
+		out[i].m_z += origin[2];
+	}
+	mark_dirty(page, allocation.start + offset, allocation.start + offset + count);
+}
+
+void GeometryArena::clear(ArenaAllocation const& allocation, uint32_t offset, uint32_t count) {
+	assert(allocation.is_valid());
+	count = std::min(count, allocation.capacity - std::min(offset, allocation.capacity));
+	if (!count)
+		return;
+
+	auto& page = *m_pages[allocation.page];
+	auto begin = allocation.start + offset;
+	std::fill(page.shadow.begin() + begin, page.shadow.begin() + begin + count, PackedVoxelVertex{});
+	mark_dirty(page, begin, begin + count);
+}
+
+void GeometryArena::mark_dirty(Page& page, uint32_t begin, uint32_t end) {
+	page.dirty_begin = std::min(page.dirty_begin, begin);
+	page.dirty_end = std::max(page.dirty_end, end);
+}
+
+GeometryArena::Uploads GeometryArena::flush() {
+	PROFILE_ZONE(ArenaFlush);
+	Uploads uploads;
+	if (!m_quad_indices.is_valid()) {
+		std::vector<uint16_t> indices;
+		indices.reserve(PAGE_VERTICES / 4 * 6);
+		add_quad_indices(indices, 0, PAGE_VERTICES / 4);
+		if (!m_quad_indices.create(bgfx::copy(indices.data(), uint32_t(indices.size() * sizeof(uint16_t)))))
+			throw std::runtime_error("Unable to create quad index buffer.");
+		uploads.indices = uint32_t(indices.size());
+	}
+
+	for (auto& page_ptr : m_pages) {
+		auto& page = *page_ptr;
+		if (page.dirty_begin >= page.dirty_end)
+			continue;
+
+		//Face record pages update whole pairs, the buffer counts pairs
+		const uint32_t per_element = page.face_records ? 2 : 1;
+		auto shadow_size = uint32_t(page.shadow.size());
+		if (!page.buffer.is_valid() || page.gpu_capacity < shadow_size) {
+			//The page grew, upload all of it
+			auto* mem = bgfx::copy(page.shadow.data(), shadow_size * sizeof(PackedVoxelVertex));
+			auto const& decl = page.face_records ? PackedVoxelVertex::ms_record_decl : PackedVoxelVertex::ms_decl;
+			if (page.buffer.is_valid())
+				page.buffer.update(0, mem);
+			else if (!page.buffer.create(mem, decl, BGFX_BUFFER_ALLOW_RESIZE))
+				throw std::runtime_error("Unable to create arena vertex buffer.");
+			page.gpu_capacity = shadow_size;
+			uploads.vertices += shadow_size;
+		}
+		else {
+			auto begin = page.dirty_begin / per_element * per_element;
+			auto end = (page.dirty_end + per_element - 1) / per_element * per_element;
+			page.buffer.update(begin / per_element, bgfx::copy(page.shadow.data() + begin,
+				(end - begin) * sizeof(PackedVoxelVertex)));
+			uploads.vertices += end - begin;
+		}
+
+		page.dirty_begin = UINT32_MAX;
+		page.dirty_end = 0;
+	}
+	return uploads;
+}
+
+size_t GeometryArena::memory_usage() const {
+	size_t bytes = 0;
+	for (auto const& page : m_pages)
+		bytes += page->gpu_capacity * sizeof(PackedVoxelVertex);
+	return bytes;
+}
@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <boost/filesystem.hpp>
+#include <nlohmann/json.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "camerapath.hh"
+
+namespace fs = boost::filesystem;
+
+CameraPath::CameraPath(std::vector<Key> keys)
+	: m_keys(std::move(keys)) {
+
+	if (m_keys.empty())
+		throw std::runtime_error("Camera path without keys");
+	for (size_t i = 1; i < m_keys.size(); ++i) {
+		if (m_keys[i].frame <= m_keys[i - 1].frame)
+			throw std::runtime_error("Camera path keys out of frame order");
+	}
+}
+
+CameraPath CameraPath::load(fs::path const& path) {
+	std::ifstream in(path.string());
+	if (!in.is_open())
+		throw std::runtime_error("Unable to open camera path " + path.string());
+
+	std::vector<Key> keys;
+	try {
+		nlohmann::json j;
+		in >> j;
+		for (auto const& key : j) {
+			auto const& position = key.at("position");
+			keys.push_back(Key{
+				key.at("frame").get<uint32_t>(),
+				{ { position.at(0).get<float>(), position.at(1).get<float>(), position.at(2).get<float>() } },
+				key.value("yaw", 0.0f),
+				key.value("pitch", 0.0f)
+			});
+		}
+	}
+	catch (nlohmann::json::exception const& e) {
+		throw std::runtime_error("Invalid camera path " + path.string() + ": " + e.what());
+	}
+	return CameraPath(std::move(keys));
+}
+
+CameraPath::Key CameraPath::sample(uint32_t frame) const {
+	auto next = std::upper_bound(m_keys.begin(), m_keys.end(), frame, [](uint32_t frame, Key const& key) {
+		return frame < key.frame;
+	});
+	if (next == m_keys.begin())
+		return m_keys.front();
+	if (next == m_keys.end())
+		return m_keys.back();
+
+	Key const& a = *(next - 1);
+	Key const& b = *next;
+	float t = float(frame - a.frame) / float(b.frame - a.frame);
+	auto lerp = [t](float x, float y) {
+		return x + (y - x) * t;
+	};
+
+	Key key;
+	key.frame = frame;
+	for (int i = 0; i < 3; ++i)
+		key.position[i] = lerp(a.position[i], b.position[i]);
+	key.yaw = lerp(a.yaw, b.yaw);
+	key.pitch = lerp(a.pitch, b.pitch);
+	return key;
+}
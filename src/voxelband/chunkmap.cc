@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "chunkmap.hh"
+#include "light.hh"
+
+namespace {
+	const size_t INITIAL_SLOTS = 64;
+	const size_t NO_SLOT = size_t(-1);
+}
+
+uint64_t ChunkMap::pack_key(int x, int y, int z) {
+	assert(x >= MIN_COORD && x <= MAX_COORD);
+	assert(y >= MIN_COORD && y <= MAX_COORD);
+	assert(z >= MIN_COORD && z <= MAX_COORD);
+
+	const uint64_t mask = (uint64_t(1) << COORD_BITS) - 1;
+	return (uint64_t(uint32_t(x)) & mask)
+		| ((uint64_t(uint32_t(y)) & mask) << COORD_BITS)
+		| ((uint64_t(uint32_t(z)) & mask) << (2 * COORD_BITS));
+}
+
+void ChunkMap::unpack_key(uint64_t key, int& x, int& y, int& z) {
+	//Shift each field to the top and back to sign extend it
+	const int unused = 64 - COORD_BITS;
+	x = int(int64_t(key << unused) >> unused);
+	y = int(int64_t(key << (unused - COORD_BITS)) >> unused);
+	z = int(int64_t(key << (unused - 2 * COORD_BITS)) >> unused);
+}
+
+uint64_t ChunkMap::region_key(int x, int y, int z) {
+	//Arithmetic shifts round towards negative infinity
+	return pack_key(x >> REGION_SHIFT, y >> REGION_SHIFT, z >> REGION_SHIFT);
+}
+
+ChunkMap::ChunkMap()
+	: m_slots(INITIAL_SLOTS) {
+}
+
+ChunkMap::~ChunkMap() {
+}
+
+size_t ChunkMap::home_slot(uint64_t key) const {
+	//splitmix64 finalizer, neighbouring coordinates land far apart
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ull;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebull;
+	key ^= key >> 31;
+	return size_t(key) & (m_slots.size() - 1);
+}
+
+size_t ChunkMap::find_slot(uint64_t key) const {
+	const size_t mask = m_slots.size() - 1;
+	for (size_t slot = home_slot(key);; slot = (slot + 1) & mask) {
+		auto const& entry = m_slots[slot];
+		if (!entry.chunk)
+			return NO_SLOT;
+		if (entry.key == key)
+			return slot;
+	}
+}
+
+VoxelChunk* ChunkMap::find(int x, int y, int z) const {
+	auto slot = find_slot(pack_key(x, y, z));
+	return slot == NO_SLOT ? nullptr : m_slots[slot].chunk.get();
+}
+
+VoxelChunk& ChunkMap::insert(int x, int y, int z, VoxelChunk chunk) {
+	auto key = pack_key(x, y, z);
+	auto existing = find_slot(key);
+	if (existing != NO_SLOT) {
+		//A mesh job still in flight is applied and then superseded by a full
+		//remesh, its result has to match the generation it was made from
+		auto& replaced = *m_slots[existing].chunk;
+		bool mesh_pending = replaced.m_mesh_pending;
+		uint64_t generation = replaced.m_generation;
+		replaced = std::move(chunk);
+		replaced.m_mesh_pending = mesh_pending;
+		replaced.m_generation = generation;
+		replaced.mark_all_dirty();
+		for (int face = 0; face < NUM_FACES; ++face) {
+			if (auto* neighbour = replaced.m_neighbours[face])
+				neighbour->mark_border_dirty(opposite_face(VoxelFace(face)));
+		}
+		voxels_changed(x, y, z);
+		return replaced;
+	}
+
+	//Keep the load factor at or below one half
+	if ((m_size + 1) * 2 > m_slots.size())
+		grow();
+
+	const size_t mask = m_slots.size() - 1;
+	size_t slot = home_slot(key);
+	while (m_slots[slot].chunk)
+		slot = (slot + 1) & mask;
+
+	m_slots[slot].key = key;
+	m_slots[slot].chunk = std::make_unique<VoxelChunk>(std::move(chunk));
+	++m_size;
+
+	auto* inserted = m_slots[slot].chunk.get();
+	inserted->m_position = { x, y, z };
+	inserted->m_arena = m_arena;
+	inserted->m_map = this;
+	m_regions[region_key(x, y, z)].emplace_back(inserted);
+	link(x, y, z, inserted);
+	voxels_changed(x, y, z);
+	inserted->queue_meshing();
+	return *inserted;
+}
+
+void ChunkMap::voxels_changed(int x, int y, int z) {
+	if (!m_light)
+		return;
+	if (auto* chunk = find(x, y, z))
+		m_light->update_chunk(x, y, z, chunk->get_voxels());
+}
+
+bool ChunkMap::erase(int x, int y, int z) {
+	auto slot = find_slot(pack_key(x, y, z));
+	if (slot == NO_SLOT)
+		return false;
+
+	link(x, y, z, nullptr);
+	if (m_light)
+		m_light->remove_chunk(x, y, z);
+
+	auto region = m_regions.find(region_key(x, y, z));
+	auto& chunks = region->second;
+	*std::find(chunks.begin(), chunks.end(), m_slots[slot].chunk.get()) = chunks.back();
+	chunks.pop_back();
+	if (chunks.empty())
+		m_regions.erase(region);
+
+	m_slots[slot].chunk.reset();
+	--m_size;
+
+	//Backward shift deletion, move later entries of the probe run into the hole
+	const size_t mask = m_slots.size() - 1;
+	size_t hole = slot;
+	for (size_t next = (hole + 1) & mask; m_slots[next].chunk; next = (next + 1) & mask) {
+		size_t home = home_slot(m_slots[next].key);
+		//Entries whose home lies cyclically in (hole, next] must stay
+		bool stays = hole <= next
+			? (home > hole && home <= next)
+			: (home > hole || home <= next);
+		if (stays)
+			continue;
+
+		m_slots[hole] = std::move(m_slots[next]);
+		hole = next;
+	}
+	return true;
+}
+
+void ChunkMap::clear() {
+	m_slots.clear();
+	m_slots.resize(INITIAL_SLOTS);
+	m_size = 0;
+	m_regions.clear();
+	m_mesh_queue.clear();
+	if (m_light)
+		m_light->clear();
+}
+
+void ChunkMap::grow() {
+	std::vector<Slot> slots(m_slots.size() * 2);
+	std::swap(slots, m_slots);
+
+	const size_t mask = m_slots.size() - 1;
+	for (auto& entry : slots) {
+		if (!entry.chunk)
+			continue;
+		size_t slot = home_slot(entry.key);
+		while (m_slots[slot].chunk)
+			slot = (slot + 1) & mask;
+		m_slots[slot] = std::move(entry);
+	}
+}
+
+//Point the six adjacent chunks at chunk, nullptr when it is removed. Their
+//borders toward it changed either way.
+void ChunkMap::link(int x, int y, int z, VoxelChunk* chunk) {
+	for (int face = 0; face < NUM_FACES; ++face) {
+		auto* neighbour = find(x + VOXEL_FACE_OFFSET[face][0], y + VOXEL_FACE_OFFSET[face][1], z + VOXEL_FACE_OFFSET[face][2]);
+		if (chunk)
+			chunk->m_neighbours[face] = neighbour;
+		if (!neighbour)
+			continue;
+
+		auto facing = opposite_face(VoxelFace(face));
+		neighbour->m_neighbours[facing] = chunk;
+		neighbour->mark_border_dirty(facing);
+	}
+}
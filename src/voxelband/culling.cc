@@ -0,0 +1,157 @@
+#include <cmath>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "culling.hh"
+
+Frustum::Frustum(float const* view_proj) {
+	buildFrustumPlanes(m_planes, view_proj);
+}
+
+Frustum::Containment Frustum::test(Aabb const& aabb) const {
+	auto result = INSIDE;
+	for (auto const& plane : m_planes) {
+		//Corners furthest along and against the plane normal
+		float far_dist = plane.m_dist;
+		float near_dist = plane.m_dist;
+		for (int i = 0; i < 3; ++i) {
+			float n = plane.m_normal[i];
+			far_dist += n * (n >= 0.0f ? aabb.m_max[i] : aabb.m_min[i]);
+			near_dist += n * (n >= 0.0f ? aabb.m_min[i] : aabb.m_max[i]);
+		}
+
+		if (far_dist < 0.0f)
+			return OUTSIDE;
+		if (near_dist < 0.0f)
+			result = INTERSECTS;
+	}
+	return result;
+}
+
+bool chunk_world_bounds(VoxelChunk const& chunk, Aabb& aabb) {
+	auto const& bounds = chunk.get_mesh_bounds();
+	if (bounds.is_empty())
+		return false;
+
+	const int size[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, VOXEL_CHUNK_DEPTH };
+	auto const& position = chunk.get_position();
+	for (int i = 0; i < 3; ++i) {
+		float origin = float(position[i] * size[i]);
+		aabb.m_min[i] = origin + bounds.min[i];
+		aabb.m_max[i] = origin + bounds.max[i];
+	}
+	return true;
+}
+
+void cull_chunks(ChunkMap const& chunks, Frustum const& frustum,
+	std::vector<VoxelChunk const*>& visible, CullStats& stats) {
+
+	const int size[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, VOXEL_CHUNK_DEPTH };
+	visible.clear();
+	stats = CullStats{};
+
+	chunks.for_each_region([&](int rx, int ry, int rz, ChunkMap::Region const& region) {
+		++stats.regions;
+
+		const int region_position[3] = { rx, ry, rz };
+		Aabb region_aabb;
+		for (int i = 0; i < 3; ++i) {
+			region_aabb.m_min[i] = float(region_position[i] * ChunkMap::REGION_SIZE * size[i]);
+			region_aabb.m_max[i] = region_aabb.m_min[i] + float(ChunkMap::REGION_SIZE * size[i]);
+		}
+
+		auto containment = frustum.test(region_aabb);
+		if (containment == Frustum::OUTSIDE) {
+			++stats.regions_culled;
+			stats.chunks += uint32_t(region.size());
+			stats.chunks_culled += uint32_t(region.size());
+			return;
+		}
+
+		for (auto const* chunk : region) {
+			++stats.chunks;
+
+			Aabb aabb;
+			if (!chunk_world_bounds(*chunk, aabb))
+				continue;
+
+			if (containment == Frustum::INTERSECTS && frustum.test(aabb) == Frustum::OUTSIDE) {
+				++stats.chunks_culled;
+				continue;
+			}
+			visible.emplace_back(chunk);
+		}
+	});
+}
+
+void ConnectivityCuller::cull(ChunkMap const& chunks, Frustum const& frustum, float const* eye,
+	std::vector<VoxelChunk const*>& visible, CullStats& stats) {
+
+	const int size[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, VOXEL_CHUNK_DEPTH };
+	int camera[3];
+	for (int i = 0; i < 3; ++i)
+		camera[i] = int(std::floor(eye[i] / size[i]));
+
+	auto const* start = chunks.find(camera[0], camera[1], camera[2]);
+	if (!start) {
+		cull_chunks(chunks, frustum, visible, stats);
+		return;
+	}
+
+	visible.clear();
+	stats = CullStats{};
+	stats.chunks = uint32_t(chunks.size());
+	m_queue.clear();
+	m_visited.clear();
+
+	//Whole chunk boxes decide traversal, empty chunks carry no mesh but still
+	//let the search through
+	auto in_frustum = [&frustum, &size](VoxelChunk const& chunk) {
+		Aabb aabb;
+		auto const& position = chunk.get_position();
+		for (int i = 0; i < 3; ++i) {
+			aabb.m_min[i] = float(position[i] * size[i]);
+			aabb.m_max[i] = aabb.m_min[i] + float(size[i]);
+		}
+		return frustum.test(aabb) != Frustum::OUTSIDE;
+	};
+
+	m_visited.insert(start);
+	for (int face = 0; face < NUM_FACES; ++face) {
+		auto const* neighbour = start->get_neighbour(VoxelFace(face));
+		if (!neighbour || !in_frustum(*neighbour) || !m_visited.insert(neighbour).second)
+			continue;
+		m_queue.emplace_back(Step{ neighbour, opposite_face(VoxelFace(face)), 1u << face });
+	}
+
+	auto add_visible = [&](VoxelChunk const* chunk) {
+		Aabb aabb;
+		if (chunk_world_bounds(*chunk, aabb) && frustum.test(aabb) != Frustum::OUTSIDE)
+			visible.emplace_back(chunk);
+	};
+	add_visible(start);
+
+	for (size_t i = 0; i < m_queue.size(); ++i) {
+		auto step = m_queue[i];
+		add_visible(step.chunk);
+
+		auto const& connectivity = step.chunk->get_connectivity();
+		for (int face = 0; face < NUM_FACES; ++face) {
+			auto exit = VoxelFace(face);
+			if (step.directions & (1u << opposite_face(exit)))
+				continue;
+			if (!connectivity.connects(step.entry, exit))
+				continue;
+
+			auto const* neighbour = step.chunk->get_neighbour(exit);
+			if (!neighbour || m_visited.count(neighbour) || !in_frustum(*neighbour))
+				continue;
+			m_visited.insert(neighbour);
+			m_queue.emplace_back(Step{ neighbour, opposite_face(exit), step.directions | (1u << face) });
+		}
+	}
+
+	stats.chunks_visited = uint32_t(m_visited.size());
+	stats.chunks_culled = stats.chunks - uint32_t(visible.size());
+}
@@ -0,0 +1,98 @@
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "facemask.hh"
+
+#if defined(__AVX2__)
+#	include <immintrin.h>
+#	define VOXELBAND_FACEMASK_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define VOXELBAND_FACEMASK_SSE2 1
+#endif
+
+static_assert(sizeof(VoxelType) == sizeof(uint32_t), "Row packing compares voxels as 32 bit lanes");
+static_assert(VOXEL_CHUNK_HEIGHT % 8 == 0, "Face masks are built 8 rows at a time");
+
+uint32_t pack_solid_row(VoxelType const* row) {
+	uint32_t bits = 0;
+#if defined(VOXELBAND_FACEMASK_AVX2)
+	auto const* lanes = reinterpret_cast<__m256i const*>(row);
+	for (int i = 0; i < VOXEL_CHUNK_WIDTH / 8; ++i) {
+		auto empty = _mm256_cmpeq_epi32(_mm256_loadu_si256(lanes + i), _mm256_setzero_si256());
+		bits |= uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(empty))) << (i * 8);
+	}
+	return ~bits;
+#elif defined(VOXELBAND_FACEMASK_SSE2)
+	auto const* lanes = reinterpret_cast<__m128i const*>(row);
+	for (int i = 0; i < VOXEL_CHUNK_WIDTH / 4; ++i) {
+		auto empty = _mm_cmpeq_epi32(_mm_loadu_si128(lanes + i), _mm_setzero_si128());
+		bits |= uint32_t(_mm_movemask_ps(_mm_castsi128_ps(empty))) << (i * 4);
+	}
+	return ~bits;
+#else
+	for (int x = 0; x < VOXEL_CHUNK_WIDTH; ++x)
+		bits |= uint32_t(row[x] != VoxelType::V_EMPTY) << x;
+	return bits;
+#endif
+}
+
+#if !defined(VOXELBAND_FACEMASK_AVX2) && !defined(VOXELBAND_FACEMASK_SSE2)
+namespace {
+	void face_row(ChunkOccupancy const& occupancy, FaceMasks& masks, int row, int padded) {
+		auto const& rows = occupancy.rows;
+		uint32_t solid = rows[padded];
+		masks.face[FACE_LEFT][row] = solid & ~((solid << 1) | occupancy.left_edge[row]);
+		masks.face[FACE_RIGHT][row] = solid & ~((solid >> 1) | occupancy.right_edge[row]);
+		masks.face[FACE_BOTTOM][row] = solid & ~rows[padded - 1];
+		masks.face[FACE_TOP][row] = solid & ~rows[padded + 1];
+		masks.face[FACE_FRONT][row] = solid & ~rows[padded - OCCUPANCY_PADDED_HEIGHT];
+		masks.face[FACE_BACK][row] = solid & ~rows[padded + OCCUPANCY_PADDED_HEIGHT];
+	}
+}
+#endif
+
+void build_face_masks(ChunkOccupancy const& occupancy, FaceMasks& masks, int z_begin, int z_end) {
+	auto const* rows = occupancy.rows.data();
+
+	for (int z = z_begin; z < z_end; ++z) {
+		int y = 0;
+#if defined(VOXELBAND_FACEMASK_AVX2)
+		auto load = [](uint32_t const* p) { return _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p)); };
+		auto store = [](uint32_t* p, __m256i v) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); };
+		for (; y + 8 <= VOXEL_CHUNK_HEIGHT; y += 8) {
+			int row = voxel_row(y, z);
+			int padded = occupancy_row(y, z);
+			auto solid = load(rows + padded);
+			store(&masks.face[FACE_LEFT][row], _mm256_andnot_si256(
+				_mm256_or_si256(_mm256_slli_epi32(solid, 1), load(&occupancy.left_edge[row])), solid));
+			store(&masks.face[FACE_RIGHT][row], _mm256_andnot_si256(
+				_mm256_or_si256(_mm256_srli_epi32(solid, 1), load(&occupancy.right_edge[row])), solid));
+			store(&masks.face[FACE_BOTTOM][row], _mm256_andnot_si256(load(rows + padded - 1), solid));
+			store(&masks.face[FACE_TOP][row], _mm256_andnot_si256(load(rows + padded + 1), solid));
+			store(&masks.face[FACE_FRONT][row], _mm256_andnot_si256(load(rows + padded - OCCUPANCY_PADDED_HEIGHT), solid));
+			store(&masks.face[FACE_BACK][row], _mm256_andnot_si256(load(rows + padded + OCCUPANCY_PADDED_HEIGHT), solid));
+		}
+#elif defined(VOXELBAND_FACEMASK_SSE2)
+		auto load = [](uint32_t const* p) { return _mm_loadu_si128(reinterpret_cast<__m128i const*>(p)); };
+		auto store = [](uint32_t* p, __m128i v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); };
+		for (; y + 4 <= VOXEL_CHUNK_HEIGHT; y += 4) {
+			int row = voxel_row(y, z);
+			int padded = occupancy_row(y, z);
+			auto solid = load(rows + padded);
+			store(&masks.face[FACE_LEFT][row], _mm_andnot_si128(
+				_mm_or_si128(_mm_slli_epi32(solid, 1), load(&occupancy.left_edge[row])), solid));
+			store(&masks.face[FACE_RIGHT][row], _mm_andnot_si128(
+				_mm_or_si128(_mm_srli_epi32(solid, 1), load(&occupancy.right_edge[row])), solid));
+			store(&masks.face[FACE_BOTTOM][row], _mm_andnot_si128(load(rows + padded - 1), solid));
+			store(&masks.face[FACE_TOP][row], _mm_andnot_si128(load(rows + padded + 1), solid));
+			store(&masks.face[FACE_FRONT][row], _mm_andnot_si128(load(rows + padded - OCCUPANCY_PADDED_HEIGHT), solid));
+			store(&masks.face[FACE_BACK][row], _mm_andnot_si128(load(rows + padded + OCCUPANCY_PADDED_HEIGHT), solid));
+		}
+#else
+		for (; y < VOXEL_CHUNK_HEIGHT; ++y)
+			face_row(occupancy, masks, voxel_row(y, z), occupancy_row(y, z));
+#endif
+	}
+}
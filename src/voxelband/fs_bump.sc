@@ -1,4 +1,4 @@
-$input v_wpos, v_view, v_normal, v_tangent, v_bitangent, v_texcoord0 // in...
+$input v_wpos, v_view, v_normal, v_tangent, v_bitangent, v_texcoord0, v_color0 // in...
 
 /*
  * Copyright 2011-2017 Branimir Karadzic. All rights reserved.
@@ -9,71 +9,26 @@ $input v_wpos, v_view, v_normal, v_tangent, v_bitangent, v_texcoord0 // in...
 
 SAMPLER2D(s_texColor,  0);
 SAMPLER2D(s_texNormal, 1);
-uniform vec4 u_lightPosRadius[4];
-uniform vec4 u_lightRgbInnerR[4];
-
-vec2 blinn(vec3 _lightDir, vec3 _normal, vec3 _viewDir)
-{
-	float ndotl = dot(_normal, _lightDir);
-	vec3 reflected = _lightDir - 2.0*ndotl*_normal; // reflect(_lightDir, _normal);
-	float rdotv = dot(reflected, _viewDir);
-	return vec2(ndotl, rdotv);
-}
-
-float fresnel(float _ndotl, float _bias, float _pow)
-{
-	float facing = (1.0 - _ndotl);
-	return max(_bias + (1.0 - _bias) * pow(facing, _pow), 0.0);
-}
-
-vec4 lit(float _ndotl, float _rdotv, float _m)
-{
-	float diff = max(0.0, _ndotl);
-	float spec = step(0.0, _ndotl) * max(0.0, _rdotv * _m);
-	return vec4(1.0, diff, spec, 1.0);
-}
-
-vec4 powRgba(vec4 _rgba, float _pow)
-{
-	vec4 result;
-	result.xyz = pow(_rgba.xyz, vec3_splat(_pow) );
-	result.w = _rgba.w;
-	return result;
-}
-
-vec3 calcLight(int _idx, mat3 _tbn, vec3 _wpos, vec3 _normal, vec3 _view)
-{
-	vec3 lp = u_lightPosRadius[_idx].xyz - _wpos;
-	float attn = 1.0 - smoothstep(u_lightRgbInnerR[_idx].w, 1.0, length(lp) / u_lightPosRadius[_idx].w);
-	vec3 lightDir = mul(_tbn, normalize(lp) );
-	vec2 bln = blinn(lightDir, _normal, _view);
-	vec4 lc = lit(bln.x, bln.y, 1.0);
-	vec3 rgb = u_lightRgbInnerR[_idx].xyz * saturate(lc.y) * attn;
-	return rgb;
-}
+uniform vec4 u_skyColor;
+uniform vec4 u_blockColor;
 
 void main()
 {
-	mat3 tbn = mat3(
-				normalize(v_tangent),
-				normalize(v_bitangent),
-				normalize(v_normal)
-				);
-
+	// Only the tilt of the normal map away from the face darkens the texel,
+	// the light itself comes baked from the vertices.
 	vec3 normal;
 	normal.xy = texture2D(s_texNormal, v_texcoord0).xy * 2.0 - 1.0;
 	normal.z = sqrt(1.0 - dot(normal.xy, normal.xy) );
-	vec3 view = -normalize(v_view);
 
-	vec3 lightColor;
-	lightColor =  calcLight(0, tbn, v_wpos, normal, view);
-	lightColor += calcLight(1, tbn, v_wpos, normal, view);
-	lightColor += calcLight(2, tbn, v_wpos, normal, view);
-	lightColor += calcLight(3, tbn, v_wpos, normal, view);
+	// v_color0 holds the sky and block light levels in front of the face and
+	// the face shade, see PackedVoxelVertex. Squared levels fall off faster
+	// away from the light, like real light does.
+	vec2 levels = v_color0.xy * v_color0.xy;
+	vec3 lightColor = max(u_skyColor.xyz * levels.x, u_blockColor.xyz * levels.y) * v_color0.z * normal.z;
 
 	vec4 color = toLinear(texture2D(s_texColor, v_texcoord0) );
 
-	gl_FragColor.xyz = max(vec3_splat(0.05), lightColor.xyz)*color.xyz;
+	gl_FragColor.xyz = max(vec3_splat(0.05), lightColor)*color.xyz;
 	gl_FragColor.w = 1.0;
 	gl_FragColor = toGamma(gl_FragColor);
 }
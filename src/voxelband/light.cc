@@ -0,0 +1,630 @@
+#include <algorithm>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bx/uint32_t.h"
+#include "bgfx_utils.h"
+#include "light.hh"
+#include "chunkmap.hh"
+#include "facemask.hh"
+#include "profiler.hh"
+
+namespace {
+	static_assert(NUM_VOXELS <= 65536, "Voxel indices are kept in 16 bits");
+
+	const int SIZE = VOXEL_CHUNK_WIDTH;
+	const uint32_t ALL_SLICES = ~0u >> (32 - VOXEL_CHUNK_DEPTH);
+	const uint32_t ALL_FACES = (1u << NUM_FACES) - 1;
+
+	//Move index to the voxel across face, into the neighbouring chunk at the
+	//border. False when that chunk is not loaded.
+	template<typename Tchunk>
+	bool step(Tchunk*& chunk, unsigned int& index, int face) {
+		const unsigned int x = index % VOXEL_CHUNK_WIDTH;
+		const unsigned int y = index / VOXEL_CHUNK_WIDTH % VOXEL_CHUNK_HEIGHT;
+		const unsigned int z = index / VOXEL_SLICE_SIZE;
+		switch (face) {
+		case FACE_LEFT:
+			if (x > 0) { index -= 1; return true; }
+			index += VOXEL_CHUNK_WIDTH - 1;
+			break;
+		case FACE_RIGHT:
+			if (x < VOXEL_CHUNK_WIDTH - 1) { index += 1; return true; }
+			index -= VOXEL_CHUNK_WIDTH - 1;
+			break;
+		case FACE_BOTTOM:
+			if (y > 0) { index -= VOXEL_CHUNK_WIDTH; return true; }
+			index += (VOXEL_CHUNK_HEIGHT - 1) * VOXEL_CHUNK_WIDTH;
+			break;
+		case FACE_TOP:
+			if (y < VOXEL_CHUNK_HEIGHT - 1) { index += VOXEL_CHUNK_WIDTH; return true; }
+			index -= (VOXEL_CHUNK_HEIGHT - 1) * VOXEL_CHUNK_WIDTH;
+			break;
+		case FACE_FRONT:
+			if (z > 0) { index -= VOXEL_SLICE_SIZE; return true; }
+			index += (VOXEL_CHUNK_DEPTH - 1) * VOXEL_SLICE_SIZE;
+			break;
+		case FACE_BACK:
+			if (z < VOXEL_CHUNK_DEPTH - 1) { index += VOXEL_SLICE_SIZE; return true; }
+			index -= (VOXEL_CHUNK_DEPTH - 1) * VOXEL_SLICE_SIZE;
+			break;
+		}
+		chunk = chunk->neighbours[face];
+		return chunk != nullptr;
+	}
+
+	template<typename Tchunk>
+	uint32_t opaque_row(Tchunk const& chunk, unsigned int row) {
+		if (chunk.opaque)
+			return (*chunk.opaque)[row];
+		return chunk.uniform_opaque ? ~0u : 0u;
+	}
+
+	template<typename Tchunk>
+	bool is_opaque(Tchunk const& chunk, unsigned int index) {
+		return (opaque_row(chunk, index / VOXEL_CHUNK_WIDTH) >> (index % VOXEL_CHUNK_WIDTH)) & 1;
+	}
+
+	template<typename Tchunk>
+	uint8_t light_at(Tchunk const& chunk, unsigned int index) {
+		return chunk.light ? chunk.light->levels[index] : chunk.uniform_light;
+	}
+
+	//Record that the light of a voxel changed, for its slice and the
+	//neighbours facing it
+	template<typename Tchunk>
+	void mark_changed(Tchunk& chunk, unsigned int index) {
+		const unsigned int x = index % VOXEL_CHUNK_WIDTH;
+		const unsigned int y = index / VOXEL_CHUNK_WIDTH % VOXEL_CHUNK_HEIGHT;
+		const unsigned int z = index / VOXEL_SLICE_SIZE;
+		chunk.changed_slices |= 1u << z;
+		if (x == 0) chunk.border_faces |= 1u << FACE_LEFT;
+		if (x == VOXEL_CHUNK_WIDTH - 1) chunk.border_faces |= 1u << FACE_RIGHT;
+		if (y == 0) chunk.border_faces |= 1u << FACE_BOTTOM;
+		if (y == VOXEL_CHUNK_HEIGHT - 1) chunk.border_faces |= 1u << FACE_TOP;
+		if (z == 0) chunk.border_faces |= 1u << FACE_FRONT;
+		if (z == VOXEL_CHUNK_DEPTH - 1) chunk.border_faces |= 1u << FACE_BACK;
+	}
+
+	template<typename Tchunk>
+	int emission_at(Tchunk const& chunk, unsigned int index) {
+		return chunk.emission.empty() ? 0 : chunk.emission[index];
+	}
+
+	//Opacity and emission of a chunk's voxels
+	template<typename Tchunk>
+	void read_voxels(PalettedVoxels const& voxels, Tchunk& chunk) {
+		chunk.opaque.reset();
+		chunk.emission.clear();
+		if (voxels.is_uniform()) {
+			auto type = voxels.get(0);
+			chunk.uniform_opaque = type != VoxelType::V_EMPTY;
+			if (int level = voxel_emission(type))
+				chunk.emission.assign(NUM_VOXELS, uint8_t(level));
+			return;
+		}
+
+		thread_local std::vector<VoxelType> scratch(NUM_VOXELS);
+		voxels.unpack(scratch.data(), 0, NUM_VOXELS);
+		typename Tchunk::OpacityRows rows;
+		for (size_t row = 0; row < rows.size(); ++row)
+			rows[row] = pack_solid_row(scratch.data() + row * VOXEL_CHUNK_WIDTH);
+		//Several types of rock are still opaque throughout
+		bool uniform = (rows[0] == 0 || rows[0] == ~0u)
+			&& std::all_of(rows.begin(), rows.end(), [&rows](uint32_t row) { return row == rows[0]; });
+		if (uniform)
+			chunk.uniform_opaque = rows[0] != 0;
+		else
+			chunk.opaque = std::make_unique<typename Tchunk::OpacityRows>(rows);
+
+		for (unsigned int index = 0; index < NUM_VOXELS; ++index) {
+			int level = voxel_emission(scratch[index]);
+			if (!level)
+				continue;
+			if (chunk.emission.empty())
+				chunk.emission.resize(NUM_VOXELS);
+			chunk.emission[index] = uint8_t(level);
+		}
+	}
+
+	struct SkyChannel {
+		static int get(uint8_t light) {
+			return sky_light(light);
+		}
+		static uint8_t with(uint8_t light, int level) {
+			return make_light(level, block_light(light));
+		}
+		//Level a voxel at level passes to its neighbour across face
+		static int spread(int level, int face) {
+			return face == FACE_BOTTOM && level == MAX_LIGHT_LEVEL ? level : level - 1;
+		}
+		template<typename Tchunk>
+		static int emitted(Tchunk const&, unsigned int) {
+			return 0;
+		}
+	};
+
+	struct BlockChannel {
+		static int get(uint8_t light) {
+			return block_light(light);
+		}
+		static uint8_t with(uint8_t light, int level) {
+			return make_light(sky_light(light), level);
+		}
+		static int spread(int level, int) {
+			return level - 1;
+		}
+		template<typename Tchunk>
+		static int emitted(Tchunk const& chunk, unsigned int index) {
+			return emission_at(chunk, index);
+		}
+	};
+}
+
+int voxel_emission(VoxelType type) {
+	switch (type) {
+	case VoxelType::V_LAMP:
+		return MAX_LIGHT_LEVEL - 1;
+	default:
+		return 0;
+	}
+}
+
+LightEngine::LightEngine() {
+	//Started once every member it uses is constructed
+	m_thread = start_thread("Light", [this]() { worker(); });
+}
+
+LightEngine::~LightEngine() {
+	{
+		std::lock_guard<std::mutex> lock(m_command_mutex);
+		m_stopping = true;
+	}
+	m_command_ready.notify_all();
+	m_thread.join();
+}
+
+void LightEngine::update_chunk(int x, int y, int z, PalettedVoxels const& voxels) {
+	{
+		std::lock_guard<std::mutex> lock(m_command_mutex);
+		m_commands.emplace_back(Command{ CommandKind::Update, x, y, z, voxels });
+	}
+	m_command_ready.notify_one();
+}
+
+void LightEngine::remove_chunk(int x, int y, int z) {
+	{
+		std::lock_guard<std::mutex> lock(m_command_mutex);
+		m_commands.emplace_back(Command{ CommandKind::Remove, x, y, z, PalettedVoxels{} });
+	}
+	m_command_ready.notify_one();
+}
+
+void LightEngine::clear() {
+	{
+		std::lock_guard<std::mutex> lock(m_command_mutex);
+		m_commands.emplace_back(Command{ CommandKind::Clear, 0, 0, 0, PalettedVoxels{} });
+	}
+	m_command_ready.notify_one();
+}
+
+void LightEngine::apply(ChunkMap& chunks) {
+	PROFILE_ZONE(ApplyLight);
+	std::unordered_map<uint64_t, Result> results;
+	{
+		std::lock_guard<std::mutex> lock(m_result_mutex);
+		results.swap(m_results);
+	}
+
+	//Chunks erased since are dropped, reinserted ones get newer light soon
+	for (auto& entry : results) {
+		int x, y, z;
+		ChunkMap::unpack_key(entry.first, x, y, z);
+		auto* chunk = chunks.find(x, y, z);
+		if (!chunk)
+			continue;
+		auto& result = entry.second;
+		//A reinserted chunk may have been given the light of the one before,
+		//rather than being meshed unlit
+		if (result.initial && chunk->get_light()) {
+			result.changed_slices = ALL_SLICES;
+			result.border_faces = ALL_FACES;
+		}
+		chunk->set_light(std::move(result.light), result.changed_slices, result.border_faces);
+	}
+}
+
+void LightEngine::worker() {
+	for (;;) {
+		std::vector<Command> commands;
+		{
+			std::unique_lock<std::mutex> lock(m_command_mutex);
+			m_command_ready.wait(lock, [this]() { return m_stopping || !m_commands.empty(); });
+			if (m_stopping)
+				return;
+
+			commands.swap(m_commands);
+			m_num_processing = unsigned(commands.size());
+		}
+
+		process(commands);
+
+		std::lock_guard<std::mutex> lock(m_command_mutex);
+		m_num_processing = 0;
+	}
+}
+
+void LightEngine::process(std::vector<Command>& commands) {
+	PROFILE_ZONE(LightChunks);
+	for (auto& command : commands) {
+		switch (command.kind) {
+		case CommandKind::Update: {
+			auto found = m_chunks.find(ChunkMap::pack_key(command.x, command.y, command.z));
+			if (found == m_chunks.end())
+				add_chunk(command);
+			else
+				edit_chunk(*found->second, command);
+			break;
+		}
+		//Queued nodes may point into the chunks going away
+		case CommandKind::Remove:
+			propagate();
+			erase_chunk(command.x, command.y, command.z);
+			break;
+		case CommandKind::Clear:
+			propagate();
+			m_touched.clear();
+			m_sky_checks.clear();
+			m_chunks.clear();
+			break;
+		}
+	}
+	propagate();
+
+	//Sky light the chunks below new chunks had from the open sky is removed
+	//where the new chunk turned out to cover it
+	for (auto key : m_sky_checks) {
+		auto found = m_chunks.find(key);
+		if (found != m_chunks.end())
+			check_sky(*found->second);
+	}
+	m_sky_checks.clear();
+	propagate();
+
+	publish();
+}
+
+void LightEngine::add_chunk(Command& command) {
+	auto key = ChunkMap::pack_key(command.x, command.y, command.z);
+	auto& chunk = *(m_chunks[key] = std::make_unique<LightChunk>());
+	chunk.key = key;
+	read_voxels(command.voxels, chunk);
+
+	for (int face = 0; face < NUM_FACES; ++face) {
+		auto found = m_chunks.find(ChunkMap::pack_key(command.x + VOXEL_FACE_OFFSET[face][0],
+			command.y + VOXEL_FACE_OFFSET[face][1], command.z + VOXEL_FACE_OFFSET[face][2]));
+		if (found == m_chunks.end())
+			continue;
+		chunk.neighbours[face] = found->second.get();
+		found->second->neighbours[opposite_face(VoxelFace(face))] = &chunk;
+	}
+
+	if (!chunk.emission.empty()) {
+		for (unsigned int index = 0; index < NUM_VOXELS; ++index) {
+			if (int level = chunk.emission[index]) {
+				set_level(chunk, index, make_light(0, level));
+				m_block_additions.emplace_back(Node{ &chunk, uint16_t(index), 0 });
+			}
+		}
+	}
+
+	for (int a = 0; a < SIZE; ++a) {
+		for (int b = 0; b < SIZE; ++b) {
+			if (!chunk.neighbours[FACE_TOP]) {
+				auto index = border_voxel_index(FACE_TOP, a, b);
+				if (!is_opaque(chunk, index)) {
+					set_level(chunk, index, SkyChannel::with(light_at(chunk, index), MAX_LIGHT_LEVEL));
+					m_sky_additions.emplace_back(Node{ &chunk, uint16_t(index), 0 });
+				}
+			}
+
+			//The neighbours' border light flows in
+			for (int face = 0; face < NUM_FACES; ++face) {
+				LightChunk* neighbour = &chunk;
+				auto index = border_voxel_index(face, a, b);
+				if (!step(neighbour, index, face))
+					continue;
+				auto light = light_at(*neighbour, index);
+				if (sky_light(light))
+					m_sky_additions.emplace_back(Node{ neighbour, uint16_t(index), 0 });
+				if (block_light(light))
+					m_block_additions.emplace_back(Node{ neighbour, uint16_t(index), 0 });
+			}
+		}
+	}
+
+	if (auto* below = chunk.neighbours[FACE_BOTTOM])
+		m_sky_checks.emplace_back(below->key);
+
+	//Published even when nothing lit it, see publish for what changed
+	if (!chunk.touched) {
+		chunk.touched = true;
+		m_touched.emplace_back(&chunk);
+	}
+}
+
+void LightEngine::edit_chunk(LightChunk& chunk, Command& command) {
+	LightChunk edited;
+	read_voxels(command.voxels, edited);
+	bool emission_changed = edited.emission != chunk.emission;
+
+	//Voxels that turned transparent let their neighbours' light in once the
+	//removals are done
+	std::vector<uint16_t> opened;
+	for (unsigned int row = 0; row < unsigned(VOXEL_CHUNK_HEIGHT * VOXEL_CHUNK_DEPTH); ++row) {
+		const uint32_t before_row = opaque_row(chunk, row);
+		const uint32_t after_row = opaque_row(edited, row);
+		uint32_t changed = before_row ^ after_row;
+		if (emission_changed) {
+			for (unsigned int x = 0; x < unsigned(VOXEL_CHUNK_WIDTH); ++x) {
+				auto index = row * VOXEL_CHUNK_WIDTH + x;
+				int before = emission_at(chunk, index);
+				int after = emission_at(edited, index);
+				if (before != after)
+					changed |= 1u << x;
+			}
+		}
+
+		while (changed) {
+			unsigned int x = bx::uint32_cnttz(changed);
+			changed &= changed - 1;
+			auto index = row * VOXEL_CHUNK_WIDTH + x;
+			bool now_opaque = (after_row >> x) & 1;
+			auto light = light_at(chunk, index);
+
+			if (now_opaque && sky_light(light)) {
+				m_sky_removals.emplace_back(Node{ &chunk, uint16_t(index), uint8_t(sky_light(light)) });
+				light = SkyChannel::with(light, 0);
+			}
+			if (block_light(light) && (now_opaque || emission_at(chunk, index))) {
+				m_block_removals.emplace_back(Node{ &chunk, uint16_t(index), uint8_t(block_light(light)) });
+				light = BlockChannel::with(light, 0);
+			}
+			set_level(chunk, index, light);
+
+			if (!now_opaque && (before_row >> x) & 1)
+				opened.emplace_back(uint16_t(index));
+		}
+	}
+
+	chunk.opaque = std::move(edited.opaque);
+	chunk.uniform_opaque = edited.uniform_opaque;
+	chunk.emission = std::move(edited.emission);
+	remove_light<SkyChannel>(m_sky_removals, m_sky_additions);
+	remove_light<BlockChannel>(m_block_removals, m_block_additions);
+
+	for (auto index : opened) {
+		for (int face = 0; face < NUM_FACES; ++face) {
+			LightChunk* neighbour = &chunk;
+			unsigned int neighbour_index = index;
+			if (!step(neighbour, neighbour_index, face)) {
+				//Open to the sky
+				if (face == FACE_TOP) {
+					set_level(chunk, index, SkyChannel::with(light_at(chunk, index), MAX_LIGHT_LEVEL));
+					m_sky_additions.emplace_back(Node{ &chunk, index, 0 });
+				}
+				continue;
+			}
+			auto light = light_at(*neighbour, neighbour_index);
+			if (sky_light(light))
+				m_sky_additions.emplace_back(Node{ neighbour, uint16_t(neighbour_index), 0 });
+			if (block_light(light))
+				m_block_additions.emplace_back(Node{ neighbour, uint16_t(neighbour_index), 0 });
+		}
+	}
+
+	if (!chunk.emission.empty()) {
+		for (unsigned int index = 0; index < NUM_VOXELS; ++index) {
+			int level = chunk.emission[index];
+			auto light = light_at(chunk, index);
+			if (level > block_light(light)) {
+				set_level(chunk, index, BlockChannel::with(light, level));
+				m_block_additions.emplace_back(Node{ &chunk, uint16_t(index), 0 });
+			}
+		}
+	}
+}
+
+void LightEngine::erase_chunk(int x, int y, int z) {
+	auto found = m_chunks.find(ChunkMap::pack_key(x, y, z));
+	if (found == m_chunks.end())
+		return;
+
+	auto* chunk = found->second.get();
+	for (int face = 0; face < NUM_FACES; ++face) {
+		if (auto* neighbour = chunk->neighbours[face])
+			neighbour->neighbours[opposite_face(VoxelFace(face))] = nullptr;
+	}
+
+	//The chunk below is open to the sky again
+	if (auto* below = chunk->neighbours[FACE_BOTTOM]) {
+		for (int a = 0; a < SIZE; ++a) {
+			for (int b = 0; b < SIZE; ++b) {
+				auto index = border_voxel_index(FACE_TOP, a, b);
+				auto light = light_at(*below, index);
+				if (is_opaque(*below, index) || sky_light(light) == MAX_LIGHT_LEVEL)
+					continue;
+				set_level(*below, index, SkyChannel::with(light, MAX_LIGHT_LEVEL));
+				m_sky_additions.emplace_back(Node{ below, uint16_t(index), 0 });
+			}
+		}
+	}
+
+	if (chunk->touched)
+		m_touched.erase(std::find(m_touched.begin(), m_touched.end(), chunk));
+	m_chunks.erase(found);
+}
+
+void LightEngine::check_sky(LightChunk& chunk) {
+	auto* above = chunk.neighbours[FACE_TOP];
+	if (!above)
+		return;
+
+	for (int a = 0; a < SIZE; ++a) {
+		for (int b = 0; b < SIZE; ++b) {
+			auto index = border_voxel_index(FACE_TOP, a, b);
+			auto light = light_at(chunk, index);
+			if (sky_light(light) != MAX_LIGHT_LEVEL
+				|| sky_light(light_at(*above, border_voxel_index(FACE_BOTTOM, a, b))) == MAX_LIGHT_LEVEL)
+				continue;
+			m_sky_removals.emplace_back(Node{ &chunk, uint16_t(index), uint8_t(MAX_LIGHT_LEVEL) });
+			set_level(chunk, index, SkyChannel::with(light, 0));
+		}
+	}
+}
+
+void LightEngine::set_level(LightChunk& chunk, unsigned int index, uint8_t light) {
+	if (light_at(chunk, index) == light)
+		return;
+
+	if (!chunk.light) {
+		chunk.light = std::make_shared<ChunkLight>();
+		chunk.light->levels.fill(chunk.uniform_light);
+	}
+	else if (chunk.light_published) {
+		//Mesh jobs may still read the published levels
+		chunk.light = std::make_shared<ChunkLight>(*chunk.light);
+	}
+	chunk.light_published = false;
+	chunk.light->levels[index] = light;
+
+	mark_changed(chunk, index);
+	if (!chunk.touched) {
+		chunk.touched = true;
+		m_touched.emplace_back(&chunk);
+	}
+}
+
+//Darken everything the removed nodes lit. Neighbours brighter than the
+//removed node could have lit are lit from elsewhere and refill the hole.
+template<typename Tchannel>
+void LightEngine::remove_light(std::vector<Node>& removals, std::vector<Node>& additions) {
+	for (size_t i = 0; i < removals.size(); ++i) {
+		const Node node = removals[i];
+		for (int face = 0; face < NUM_FACES; ++face) {
+			auto* chunk = node.chunk;
+			unsigned int index = node.index;
+			if (!step(chunk, index, face))
+				continue;
+
+			auto light = light_at(*chunk, index);
+			int level = Tchannel::get(light);
+			if (!level)
+				continue;
+			if (level > Tchannel::spread(node.level, face)) {
+				additions.emplace_back(Node{ chunk, uint16_t(index), 0 });
+				continue;
+			}
+
+			//Emitters keep their own light and spread it again
+			int emitted = Tchannel::emitted(*chunk, index);
+			set_level(*chunk, index, Tchannel::with(light, emitted));
+			removals.emplace_back(Node{ chunk, uint16_t(index), uint8_t(level) });
+			if (emitted)
+				additions.emplace_back(Node{ chunk, uint16_t(index), 0 });
+		}
+	}
+	removals.clear();
+}
+
+template<typename Tchannel>
+void LightEngine::add_light(std::vector<Node>& additions) {
+	for (size_t i = 0; i < additions.size(); ++i) {
+		const Node node = additions[i];
+		int level = Tchannel::get(light_at(*node.chunk, node.index));
+		for (int face = 0; face < NUM_FACES; ++face) {
+			int spread = Tchannel::spread(level, face);
+			if (spread <= 0)
+				continue;
+
+			auto* chunk = node.chunk;
+			unsigned int index = node.index;
+			if (!step(chunk, index, face) || is_opaque(*chunk, index))
+				continue;
+
+			auto light = light_at(*chunk, index);
+			if (Tchannel::get(light) >= spread)
+				continue;
+			set_level(*chunk, index, Tchannel::with(light, spread));
+			additions.emplace_back(Node{ chunk, uint16_t(index), 0 });
+		}
+	}
+	additions.clear();
+}
+
+void LightEngine::propagate() {
+	remove_light<SkyChannel>(m_sky_removals, m_sky_additions);
+	remove_light<BlockChannel>(m_block_removals, m_block_additions);
+	add_light<SkyChannel>(m_sky_additions);
+	add_light<BlockChannel>(m_block_additions);
+}
+
+void LightEngine::publish() {
+	std::vector<std::pair<uint64_t, Result>> results;
+	results.reserve(m_touched.size());
+	for (auto* chunk : m_touched) {
+		if (chunk->light) {
+			auto const& levels = chunk->light->levels;
+			if (std::all_of(levels.begin(), levels.end(), [&levels](uint8_t level) { return level == levels[0]; })) {
+				chunk->uniform_light = levels[0];
+				chunk->light.reset();
+			}
+		}
+
+		Result result;
+		if (chunk->light) {
+			result.light = chunk->light;
+			chunk->light_published = true;
+		}
+		else {
+			auto& uniform = m_uniform_lights[chunk->uniform_light];
+			if (!uniform) {
+				auto light = std::make_shared<ChunkLight>();
+				light->levels.fill(chunk->uniform_light);
+				uniform = std::move(light);
+			}
+			result.light = uniform;
+		}
+
+		//A new chunk was meshed unlit so far. Faces take their light from the
+		//transparent voxel in front, only where those are lit otherwise do
+		//its meshes and its neighbours' need building again.
+		if (chunk->unlit) {
+			chunk->changed_slices = 0;
+			chunk->border_faces = 0;
+			for (unsigned int index = 0; index < NUM_VOXELS; ++index) {
+				if (!is_opaque(*chunk, index) && light_at(*chunk, index) != UNLIT_LIGHT)
+					mark_changed(*chunk, index);
+			}
+			chunk->unlit = false;
+			result.initial = true;
+		}
+		result.changed_slices = chunk->changed_slices;
+		result.border_faces = chunk->border_faces;
+		results.emplace_back(chunk->key, std::move(result));
+
+		chunk->changed_slices = 0;
+		chunk->border_faces = 0;
+		chunk->touched = false;
+	}
+	m_touched.clear();
+
+	std::lock_guard<std::mutex> lock(m_result_mutex);
+	for (auto& entry : results) {
+		auto& result = m_results[entry.first];
+		result.light = std::move(entry.second.light);
+		result.changed_slices |= entry.second.changed_slices;
+		result.border_faces |= entry.second.border_faces;
+		result.initial |= entry.second.initial;
+	}
+}
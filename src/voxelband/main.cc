@@ -5,28 +5,55 @@
 #include <sstream>
 #include <boost/hana/functional/overload.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/functional/hash.hpp>
 #include <variant>
 #include <vector>
 #include <string>
 #include <algorithm>
+#include <cmath>
 #include <optional>
 #include <iostream>
+#include <cstdio>
 #include <direct.h>
 #include "namegen.h"
 #include <nlohmann/json.hpp>
 
 #include <bx/uint32_t.h>
+#include <bx/commandline.h>
 #include <bgfx/bgfx.h>
 #include "debugdraw/debugdraw.h"
 #include "common.h"
+#include "entry/cmd.h"
+#include "entry/input.h"
 #include "bgfx_utils.h"
 #include "logo.h"
 #include "imgui/imgui.h"
 #include "birth.hh"
 #include "camera.h"
 #include "voxel.hh"
-
-bgfx::VertexDecl PosNormalTangentTexcoordVertex::ms_decl;
+#include "meshpipeline.hh"
+#include "chunkmap.hh"
+#include "arena.hh"
+#include "occlusion.hh"
+#include "regionfile.hh"
+#include "terrain.hh"
+#include "streaming.hh"
+#include "raycast.hh"
+#include "worldedit.hh"
+#include "light.hh"
+#include "culling.hh"
+#include "camerapath.hh"
+#include "profiler.hh"
+#include "perfhud.hh"
+
+//Built against entry_noop.cpp by the voxelband_headless target, renders
+//nothing and runs without a window or GPU
+#ifndef VOXELBAND_HEADLESS
+#	define VOXELBAND_HEADLESS 0
+#endif // VOXELBAND_HEADLESS
+
+bgfx::VertexDecl PackedVoxelVertex::ms_decl;
+bgfx::VertexDecl PackedVoxelVertex::ms_record_decl;
 namespace
 {
 	namespace fs = boost::filesystem;
@@ -115,6 +142,19 @@ namespace
 		return loadTexture(path.string().c_str());
 	}
 
+	const InputBinding s_bindings[] =
+	{
+		{ entry::Key::F2, entry::Modifier::None, 1, NULL, "perfhud" },
+
+		INPUT_BINDING_END
+	};
+
+	int cmd_perf_hud(CmdContext* /*_context*/, void* _userData, int /*_argc*/, char const* const* /*_argv*/) {
+		auto* hud = static_cast<PerfHud*>(_userData);
+		hud->visible = !hud->visible;
+		return 0;
+	}
+
 	class Voxelband : public entry::AppI
 	{
 	public:
@@ -126,6 +166,61 @@ namespace
 		void init(int32_t _argc, const char* const* _argv, uint32_t _width, uint32_t _height) override
 		{
 			Args args(_argc, _argv);
+			bx::CommandLine cmdLine(_argc, _argv);
+			if (VOXELBAND_HEADLESS)
+				args.m_type = bgfx::RendererType::Noop;
+
+			//Unattended runs end after --frames frames or the last key of
+			//--camera-path, headless ones always do
+			int max_frames = VOXELBAND_HEADLESS ? HEADLESS_FRAMES : 0;
+			cmdLine.hasArg(max_frames, '\0', "frames");
+			if (auto const* path = cmdLine.findOption("camera-path")) {
+				m_camera_path = std::make_unique<CameraPath>(CameraPath::load(path));
+				if (!cmdLine.hasArg("frames"))
+					max_frames = int(m_camera_path->last_frame()) + 1;
+			}
+			m_max_frames = uint32_t(std::max(max_frames, 0));
+			m_meshing_mode = cmdLine.hasArg("greedy") ? MeshingMode::Greedy
+				: cmdLine.hasArg("face-records") ? MeshingMode::FaceRecords
+				: MeshingMode::PerFace;
+
+			int mesh_workers = int(MeshPipeline::default_num_workers());
+			cmdLine.hasArg(mesh_workers, '\0', "mesh-workers");
+			m_upload_budget_ms = 2.0f;
+			cmdLine.hasArg(m_upload_budget_ms, '\0', "upload-budget");
+			m_lod_distance = 8.0f;
+			cmdLine.hasArg(m_lod_distance, '\0', "lod-distance");
+			m_connectivity_culling = !cmdLine.hasArg("no-connectivity-culling");
+			if (!cmdLine.hasArg("no-occlusion-culling"))
+				m_occlusion_culler = std::make_unique<OcclusionCuller>();
+			//Worlds made by Birth are named after the character's hash, which
+			//seeds their terrain unless --seed is given
+			int seed = 1;
+			if (auto const* world = cmdLine.findOption("world")) {
+				m_region_store = std::make_unique<RegionStore>(world);
+				seed = int(boost::hash<std::string>()(fs::path(world).filename().string()));
+			}
+			cmdLine.hasArg(seed, '\0', "seed");
+			ChunkStreamer::Settings streaming;
+			cmdLine.hasArg(streaming.radius, '\0', "view-radius");
+			int stream_workers = int(streaming.num_workers);
+			cmdLine.hasArg(stream_workers, '\0', "stream-workers");
+			streaming.num_workers = unsigned(std::max(stream_workers, 1));
+			float stream_budget_ms = float(streaming.budget_ms);
+			cmdLine.hasArg(stream_budget_ms, '\0', "stream-budget");
+			streaming.budget_ms = stream_budget_ms;
+			streaming.meshing_mode = m_meshing_mode;
+			m_view_radius = std::max(streaming.radius, 1);
+
+			//F2 toggles the overlay, --perf-csv <file> writes every frame's counters
+			fs::path perf_csv;
+			if (auto const* path = cmdLine.findOption("perf-csv"))
+				perf_csv = path;
+			m_perf_hud = std::make_unique<PerfHud>(perf_csv);
+			m_perf_hud->visible = cmdLine.hasArg("perf-hud");
+			cmdAdd("perfhud", cmd_perf_hud, m_perf_hud.get());
+			inputAddBindings("voxelband", s_bindings);
+			m_mesh_pipeline = std::make_unique<MeshPipeline>(unsigned(std::max(mesh_workers, 1)));
 
 			m_width = _width;
 			m_height = _height;
@@ -150,14 +245,15 @@ namespace
 
 			cameraCreate();
 
-			const float initialPos[3] = { 0.0f, 2.0f, -12.0f };
+			//Above the highest terrain
+			const float initialPos[3] = { 0.0f, float(TerrainGenerator::BASE_HEIGHT + TerrainGenerator::AMPLITUDE + 8), -12.0f };
 			cameraSetPosition(initialPos);
 			cameraSetVerticalAngle(0.0f);
 
 			imguiCreate();
 
 			// Create vertex stream declaration.
-			PosNormalTangentTexcoordVertex::init();
+			PackedVoxelVertex::init();
 
 			ddInit();
 
@@ -187,54 +283,52 @@ namespace
 			}
 
 			m_renderer.init(data_path);
-
-			
-
-			auto chunk = VoxelChunk{};
-			chunk.set(0, 0, 0, VoxelType::V_DIRT);
-			chunk.set(1, 1, 0, VoxelType::V_DIRT);
-			chunk.set(1, 1, 1, VoxelType::V_DIRT);
-			chunk.set(1, 1, 2, VoxelType::V_DIRT);
-			chunk.set(1, 2, 2, VoxelType::V_DIRT);
-			chunk.set(5, 6, 7, VoxelType::V_DIRT);
-			chunk.set(31, 0, 0, VoxelType::V_DIRT);
-			chunk.set(0, 31, 0, VoxelType::V_DIRT);
-			chunk.set(31, 31, 31, VoxelType::V_DIRT);
-
-			for (auto x : { 8,9,10 }) 
-				for (auto y : { 8,9,10 }) 
-					for (auto z : { 8, 9, 10 }) 
-						chunk.set(x, y, z, VoxelType::V_DIRT);
-			
-			create_voxel_chunk(-1, 0, 0);
-			create_voxel_chunk(1, 0, 0);
-			create_voxel_chunk(0, -1, 0);
-			create_voxel_chunk(0, 0, -1);
-			create_voxel_chunk(0, 0, 1);
-			create_voxel_chunk(0, 1, 0);
-
-			chunk.update_buffers(
-				get_voxel_chunk(-1, 0, 0),
-				get_voxel_chunk(1, 0, 0),
-				get_voxel_chunk(0, 1, 0),
-				get_voxel_chunk(0, -1, 0),
-				get_voxel_chunk(0, 0, -1),
-				get_voxel_chunk(0, 0, 1)
-			);
-			set_voxel_chunk(0, 0, 0, std::move(chunk));
+			//Face records are drawn instanced with integer shader ops, without
+			//either they are meshed as quads
+			if (m_meshing_mode == MeshingMode::FaceRecords && !m_renderer.supports_face_records())
+				m_meshing_mode = streaming.meshing_mode = MeshingMode::PerFace;
+
+			m_arena = std::make_unique<GeometryArena>();
+			m_voxel_world.set_arena(m_arena.get());
+			m_light_engine = std::make_unique<LightEngine>();
+			m_voxel_world.set_light_engine(m_light_engine.get());
+
+			//Chunks around the camera are loaded or generated once update starts streaming
+			m_streamer = std::make_unique<ChunkStreamer>(streaming, uint32_t(seed), m_region_store.get());
 		}
 
 		virtual int shutdown() override
 		{
+			//Joins the workers, meshes and loads still in flight are dropped and
+			//the saves of unloaded chunks are written
+			m_mesh_pipeline.reset();
+			m_streamer.reset();
+			m_occlusion_culler.reset();
+			m_voxel_world.set_light_engine(nullptr);
+			m_light_engine.reset();
+
 			m_renderer = Renderer{};
 
+			inputRemoveBindings("voxelband");
+			m_perf_hud.reset();
+
 			ddShutdown();
 
 			imguiDestroy();
 
 			cameraDestroy();
 
+			if (m_region_store) {
+				m_voxel_world.for_each([this](int x, int y, int z, VoxelChunk& chunk) {
+					if (chunk.is_modified())
+						m_region_store->save(x, y, z, chunk.get_voxels());
+				});
+			}
 			m_voxel_world.clear();
+			m_arena.reset();
+
+			if (m_max_frames != 0)
+				print_frame_times();
 			
 			// Shutdown bgfx.
 			bgfx::shutdown();
@@ -245,23 +339,35 @@ namespace
 		bool update() override
 		{
 			char inputChar = '\000';
+			if (m_max_frames != 0 && m_frame >= m_max_frames)
+				return false;
+
 			if (!entry::processEvents(m_width, m_height, m_debug, m_reset, &m_mouseState, &inputChar))
 			{
-				imguiBeginFrame(m_mouseState.m_mx
-					, m_mouseState.m_my
-					, (m_mouseState.m_buttons[entry::MouseButton::Left] ? IMGUI_MBUT_LEFT : 0)
-					| (m_mouseState.m_buttons[entry::MouseButton::Right] ? IMGUI_MBUT_RIGHT : 0)
-					| (m_mouseState.m_buttons[entry::MouseButton::Middle] ? IMGUI_MBUT_MIDDLE : 0)
-					, m_mouseState.m_mz
-					, uint16_t(m_width)
-					, uint16_t(m_height)
-					, inputChar
-				);
-
-				//showExampleDialog(this);
-				bool running = ui_frame();
-
-				imguiEndFrame();
+				PROFILE_ZONE(Frame);
+				const int64_t frame_start = bx::getHPCounter();
+				PerfFrame perf = {};
+				bool running;
+				{
+					PROFILE_ZONE(UiFrame);
+					PerfStageTimer timer(perf, PERF_UI_MS);
+					imguiBeginFrame(m_mouseState.m_mx
+						, m_mouseState.m_my
+						, (m_mouseState.m_buttons[entry::MouseButton::Left] ? IMGUI_MBUT_LEFT : 0)
+						| (m_mouseState.m_buttons[entry::MouseButton::Right] ? IMGUI_MBUT_RIGHT : 0)
+						| (m_mouseState.m_buttons[entry::MouseButton::Middle] ? IMGUI_MBUT_MIDDLE : 0)
+						, m_mouseState.m_mz
+						, uint16_t(m_width)
+						, uint16_t(m_height)
+						, inputChar
+					);
+
+					//showExampleDialog(this);
+					running = ui_frame();
+					m_perf_hud->draw();
+
+					imguiEndFrame();
+				}
 
 				int64_t now = bx::getHPCounter() - m_timeOffset;
 				static int64_t last = now;
@@ -272,7 +378,22 @@ namespace
 				const float stime = (float)(now / freq);
 
 				// Update camera.
-				cameraUpdate(deltaTime, m_mouseState);
+				{
+					PROFILE_ZONE(CameraUpdate);
+					PerfStageTimer timer(perf, PERF_CAMERA_MS);
+					if (m_camera_path) {
+						//Moved by the path alone, an update without time or mouse
+						//movement only points the camera at the new angles
+						auto key = m_camera_path->sample(m_frame);
+						cameraSetPosition(key.position.data());
+						cameraSetHorizontalAngle(key.yaw);
+						cameraSetVerticalAngle(key.pitch);
+						cameraUpdate(0.0f, entry::MouseState());
+					}
+					else {
+						cameraUpdate(deltaTime, m_mouseState);
+					}
+				}
 
 				float view[16];
 				cameraGetViewMtx(view);
@@ -287,11 +408,15 @@ namespace
 					cameraGetPosition(eye);
 					bx::mtxQuatTranslationHMD(view, hmd->eye[0].rotation, eye);
 					bgfx::setViewTransform(0, view, hmd->eye[0].projection, BGFX_VIEW_STEREO, hmd->eye[1].projection);
+					//Chunks are culled against the left eye only
+					std::copy(hmd->eye[0].projection, hmd->eye[0].projection + 16, proj);
 					bgfx::setViewRect(0, 0, 0, hmd->width, hmd->height);
 				}
 				else
 				{
-					bx::mtxProj(proj, 60.0f, float(m_width) / float(m_height), 0.1f, 100.0f, bgfx::getCaps()->homogeneousDepth);
+					//Far enough to see every streamed chunk
+					const float far_plane = float((m_view_radius + 1) * VOXEL_CHUNK_WIDTH);
+					bx::mtxProj(proj, 60.0f, float(m_width) / float(m_height), 0.1f, far_plane, bgfx::getCaps()->homogeneousDepth);
 
 					bgfx::setViewTransform(0, view, proj);
 					bgfx::setViewRect(0, 0, 0, uint16_t(m_width), uint16_t(m_height));
@@ -304,19 +429,61 @@ namespace
 				// if no other draw calls are submitted to view 0.
 				bgfx::touch(0);
 
-				m_renderer.init_frame(stime);
+				float viewProj[16];
+				bx::mtxMul(viewProj, view, proj);
+				Frustum frustum(viewProj);
+				float eye[3];
+				cameraGetPosition(eye);
+
+				//Occluders are drawn on their own thread while meshes are uploaded
+				if (m_occlusion_culler) {
+					PerfStageTimer timer(perf, PERF_CULLING_MS);
+					m_occlusion_culler->begin(viewProj, gather_occluders(frustum, eye));
+				}
 
+				{
+					PerfStageTimer timer(perf, PERF_STREAMING_MS);
+					float at[3];
+					cameraGetAt(at);
+					const float view_dir[3] = { at[0] - eye[0], at[1] - eye[1], at[2] - eye[2] };
+					m_streamer->update(m_voxel_world, eye, view_dir);
+				}
+				{
+					PerfStageTimer timer(perf, PERF_LIGHT_MS);
+					m_light_engine->apply(m_voxel_world);
+				}
+				{
+					PerfStageTimer timer(perf, PERF_MESHING_MS);
+					update_lods();
+					schedule_meshing();
+				}
+				{
+					PerfStageTimer timer(perf, PERF_UPLOAD_MS);
+					perf[PERF_CHUNKS_MESHED] = float(m_mesh_pipeline->upload(m_upload_budget_ms, [this](int x, int y, int z) {
+						return get_voxel_chunk(x, y, z);
+					}));
+					auto uploads = m_arena->flush();
+					perf[PERF_VERTICES_UPLOADED] = float(uploads.vertices);
+					perf[PERF_INDICES_UPLOADED] = float(uploads.indices);
+				}
 
-				float mtx[16];
-				bx::mtxIdentity(mtx);
+				m_renderer.init_frame(stime);
 
-				// Set model matrix for rendering.
-				bgfx::setTransform(mtx);
+				{
+					PROFILE_ZONE(CullChunks);
+					PerfStageTimer timer(perf, PERF_CULLING_MS);
+					if (m_connectivity_culling)
+						m_connectivity_culler.cull(m_voxel_world, frustum, eye, m_visible_chunks, m_cull_stats);
+					else
+						cull_chunks(m_voxel_world, frustum, m_visible_chunks, m_cull_stats);
+					if (m_occlusion_culler)
+						m_occlusion_culler->cull(m_visible_chunks, m_cull_stats);
+				}
 
-				// Set vertex and index buffer.
-				auto* chunk = get_voxel_chunk(0, 0, 0);
-				if (chunk)
-					m_renderer.render(*chunk);
+				{
+					PerfStageTimer timer(perf, PERF_SUBMIT_MS);
+					m_draw_calls = m_renderer.render(m_visible_chunks, *m_arena);
+				}
 
 				// Use debug font to print information about this example.
 				bgfx::dbgTextClear();
@@ -337,16 +504,79 @@ namespace
 					, stats->textWidth
 					, stats->textHeight
 				);
+				bgfx::dbgTextPrintf(0, 3, 0x0f, "Chunks %u/%u drawn in %u draw calls, %u visited, %u occluded, %u/%u regions culled."
+					, uint32_t(m_visible_chunks.size())
+					, m_cull_stats.chunks
+					, m_draw_calls
+					, m_cull_stats.chunks_visited
+					, m_cull_stats.chunks_occluded
+					, m_cull_stats.regions_culled
+					, m_cull_stats.regions
+				);
+				bgfx::dbgTextPrintf(0, 4, 0x0f, "Arena %u pages, %u KiB. Streaming %u chunks loaded, %u loading, %u queued. %u light updates pending."
+					, uint32_t(m_arena->num_pages())
+					, uint32_t(m_arena->memory_usage() / 1024)
+					, uint32_t(m_voxel_world.size())
+					, uint32_t(m_streamer->num_in_flight())
+					, uint32_t(m_streamer->num_queued())
+					, m_light_engine->num_pending()
+				);
 
 				ddBegin(0);
 				ddDrawAxis(0.0f, 0.0f, 0.0f);
+
+				//Outline the voxel under the mouse cursor, the left button blasts a
+				//crater around it, the middle button places dirt and the right
+				//button a lamp on its face
+				VoxelHit hit;
+				if (pick_voxel(viewProj, hit)) {
+					bool blast = m_mouseState.m_buttons[entry::MouseButton::Left] && !m_blast_held;
+					bool place = m_mouseState.m_buttons[entry::MouseButton::Middle] && !m_place_held;
+					bool lamp = m_mouseState.m_buttons[entry::MouseButton::Right] && !m_lamp_held;
+					if (!ImGui::GetIO().WantCaptureMouse && (blast || place || lamp)) {
+						WorldEdit edit(m_voxel_world);
+						if (blast) {
+							const std::array<float, 3> center = {
+								{ hit.voxel[0] + 0.5f, hit.voxel[1] + 0.5f, hit.voxel[2] + 0.5f }
+							};
+							edit.fill_sphere(center, 4.0f, VoxelType::V_EMPTY);
+						}
+						else {
+							edit.set(hit.voxel[0] + hit.normal[0], hit.voxel[1] + hit.normal[1],
+								hit.voxel[2] + hit.normal[2], place ? VoxelType::V_DIRT : VoxelType::V_LAMP);
+						}
+						edit.commit();
+					}
+
+					Aabb box = {
+						{ float(hit.voxel[0]), float(hit.voxel[1]), float(hit.voxel[2]) },
+						{ float(hit.voxel[0] + 1), float(hit.voxel[1] + 1), float(hit.voxel[2] + 1) },
+					};
+					ddPush();
+					ddSetWireframe(true);
+					ddSetColor(0xff00ffff);
+					ddDraw(box);
+					ddPop();
+				}
+				m_blast_held = !!m_mouseState.m_buttons[entry::MouseButton::Left];
+				m_place_held = !!m_mouseState.m_buttons[entry::MouseButton::Middle];
+				m_lamp_held = !!m_mouseState.m_buttons[entry::MouseButton::Right];
 				float center[3] = { 0.0f, 0.0f, 0.0f };
 
 				ddDrawGrid(Axis::Y, center, 20, 1.0f);
 				ddEnd();
 				// Advance to next frame. Rendering thread will be kicked to
 				// process submitted rendering primitives.
-				bgfx::frame();
+				{
+					PROFILE_ZONE(BgfxFrame);
+					PerfStageTimer timer(perf, PERF_BGFX_FRAME_MS);
+					bgfx::frame();
+				}
+				record_perf(perf, frame_start);
+
+				if (m_max_frames != 0)
+					m_frame_times.push_back(float(double(bx::getHPCounter() - frame_start) * 1000.0 / freq));
+				++m_frame;
 
 				return running;
 			}
@@ -360,90 +590,195 @@ namespace
 		uint32_t m_height;
 		uint32_t m_debug;
 		uint32_t m_reset;
+		MeshingMode m_meshing_mode;
 		Renderer m_renderer;
+		std::unique_ptr<MeshPipeline> m_mesh_pipeline;
+		//Main thread time per frame spent uploading finished meshes
+		float m_upload_budget_ms;
+		//Chunks further than this many chunk widths get coarser meshes, 0 disables
+		float m_lod_distance;
+		//Chunk the camera was in when the levels of detail were last chosen
+		std::optional<std::array<int, 3>> m_lod_camera;
+		//Skip chunks the camera cannot see through air, see ConnectivityCuller
+		bool m_connectivity_culling;
+
+		//Chunk meshes of the world, outlives m_voxel_world
+		std::unique_ptr<GeometryArena> m_arena;
+		//Set with --world <directory>, chunks are loaded when streamed in and
+		//saved when unloaded or on shutdown if modified
+		std::unique_ptr<RegionStore> m_region_store;
+		ChunkMap m_voxel_world;
+		//Joined before m_voxel_world and m_region_store are saved and cleared
+		std::unique_ptr<ChunkStreamer> m_streamer;
+		//Lights the chunks of m_voxel_world on its own thread
+		std::unique_ptr<LightEngine> m_light_engine;
+		//Chunks within this many chunk widths of the camera are streamed in
+		int m_view_radius;
+		std::vector<VoxelChunk const*> m_visible_chunks;
+		CullStats m_cull_stats;
+		ConnectivityCuller m_connectivity_culler;
+		//Null when occlusion culling is disabled
+		std::unique_ptr<OcclusionCuller> m_occlusion_culler;
+		uint32_t m_draw_calls = 0;
+		//Mouse buttons held last frame, edits happen once per click
+		bool m_blast_held = false;
+		bool m_place_held = false;
+		bool m_lamp_held = false;
+
+		//Frames run so far
+		uint32_t m_frame = 0;
+		//Frames before update ends the run, 0 runs until the window is closed
+		uint32_t m_max_frames = 0;
+		//Null unless --camera-path is given
+		std::unique_ptr<CameraPath> m_camera_path;
+		//Main thread milliseconds per frame, kept for unattended runs only
+		std::vector<float> m_frame_times;
+
+		//Headless runs without --frames or --camera-path stop after this many frames
+		static const int HEADLESS_FRAMES = 1000;
+
+		//Overlay of per frame counters, drawn with the UI
+		std::unique_ptr<PerfHud> m_perf_hud;
+
+		//Fill in the counters the stages did not and hand the frame to m_perf_hud
+		void record_perf(PerfFrame& perf, int64_t frame_start) {
+			const double freq = double(bx::getHPFrequency());
+			perf[PERF_FRAME_MS] = float(double(bx::getHPCounter() - frame_start) * 1000.0 / freq);
+
+			const bgfx::Stats* stats = bgfx::getStats();
+			auto to_ms = [](int64_t ticks, int64_t frequency) {
+				return frequency > 0 ? float(double(ticks) * 1000.0 / double(frequency)) : 0.0f;
+			};
+			perf[PERF_GPU_MS] = to_ms(stats->gpuTimeEnd - stats->gpuTimeBegin, stats->gpuTimerFreq);
+			perf[PERF_WAIT_RENDER_MS] = to_ms(stats->waitRender, stats->cpuTimerFreq);
+
+			perf[PERF_CHUNKS_LOADED] = float(m_voxel_world.size());
+			perf[PERF_CHUNKS_DRAWN] = float(m_visible_chunks.size());
+			perf[PERF_CHUNKS_CULLED] = float(m_cull_stats.chunks_culled);
+			perf[PERF_CHUNK_DRAWS] = float(m_draw_calls);
+			perf[PERF_DRAW_CALLS] = float(stats->numDraw);
+
+			const double MIB = 1024.0 * 1024.0;
+			perf[PERF_ARENA_MIB] = float(double(m_arena->memory_usage()) / MIB);
+			//Negative when the renderer does not know
+			perf[PERF_GPU_MEMORY_MIB] = stats->gpuMemoryUsed > 0 ? float(double(stats->gpuMemoryUsed) / MIB) : -1.0f;
+
+			m_perf_hud->push(perf);
+		}
 
-		using VoxelLine = std::map<int, VoxelChunk>;
-		VoxelLine hello;
-		using VoxelSlice = std::map<int, VoxelLine>;
-		VoxelSlice p;
-		using VoxelWorld = std::map<int, VoxelSlice>;
-
-		VoxelWorld m_voxel_world;
-
-		VoxelSlice* get_voxel_slice(int z) {
-			auto slice = m_voxel_world.find(z);
-			if (slice == m_voxel_world.end()) {
-				return nullptr;
-			}
-			return &slice->second;
+		//Summary of m_frame_times on stdout, for scripts comparing runs
+		void print_frame_times() {
+			if (m_frame_times.empty())
+				return;
+
+			std::vector<float> sorted = m_frame_times;
+			std::sort(sorted.begin(), sorted.end());
+			auto percentile = [&](double p) {
+				return sorted[std::min(sorted.size() - 1, size_t(p * double(sorted.size())))];
+			};
+			double total = 0.0;
+			for (float ms : sorted)
+				total += ms;
+			std::printf("frames %u, frame ms mean %.3f p50 %.3f p95 %.3f p99 %.3f max %.3f\n"
+				, uint32_t(sorted.size())
+				, total / double(sorted.size())
+				, percentile(0.5)
+				, percentile(0.95)
+				, percentile(0.99)
+				, sorted.back()
+			);
 		}
 
-		template<typename T>
-		VoxelSlice& get_voxel_slice_or(int z, T fn) {
-			auto slice = m_voxel_world.find(z);
-			if (slice == m_voxel_world.end()) {
-				auto[slice, b] = m_voxel_world.emplace(std::make_pair(z, fn()));
-				if (!b) {
-					throw std::runtime_error("Unable to create voxel slice.");
-				}
-				return slice->second;
-			}
-			return slice->second;
+		VoxelChunk* get_voxel_chunk(int x, int y, int z) {
+			return m_voxel_world.find(x, y, z);
 		}
 
-		VoxelLine* get_voxel_line(VoxelSlice& slice, int y) {
-			auto line = slice.find(y);
-			if (line == slice.end()) {
-				return nullptr;
-			}
-			return &line->second;
+		//Solid voxel under the mouse cursor, at most PICK_DISTANCE voxels away
+		bool pick_voxel(float const* view_proj, VoxelHit& hit) {
+			PROFILE_ZONE(PickVoxel);
+			const float PICK_DISTANCE = 64.0f;
+			float inv_view_proj[16];
+			bx::mtxInverse(inv_view_proj, view_proj);
+			float x = float(m_mouseState.m_mx) / float(m_width) * 2.0f - 1.0f;
+			float y = 1.0f - float(m_mouseState.m_my) / float(m_height) * 2.0f;
+			return raycast(m_voxel_world, makeRay(x, y, inv_view_proj), PICK_DISTANCE, hit);
 		}
 
-		template<typename T>
-		VoxelLine& get_voxel_line_or(VoxelSlice& slice, int y, T fn) {
-			auto line = slice.find(y);
-			if (line == slice.end()) {
-				auto[line, b] = slice.emplace(std::make_pair(y, fn()));
-				if (!b) {
-					throw std::runtime_error("Unable to create voxel line.");
+		//Solid boxes of the chunks near the camera, far chunks cover too few
+		//pixels of the depth buffer to be worth drawing
+		std::vector<Aabb> gather_occluders(Frustum const& frustum, float const* eye) {
+			PROFILE_ZONE(GatherOccluders);
+			const int radius = 4;
+			const int size[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, VOXEL_CHUNK_DEPTH };
+			int camera[3];
+			for (int i = 0; i < 3; ++i)
+				camera[i] = int(std::floor(eye[i] / size[i]));
+
+			std::vector<Aabb> occluders;
+			for (int z = camera[2] - radius; z <= camera[2] + radius; ++z) {
+				for (int y = camera[1] - radius; y <= camera[1] + radius; ++y) {
+					for (int x = camera[0] - radius; x <= camera[0] + radius; ++x) {
+						auto const* chunk = m_voxel_world.find(x, y, z);
+						Aabb aabb;
+						if (chunk && chunk_world_occluder(*chunk, aabb) && frustum.test(aabb) != Frustum::OUTSIDE)
+							occluders.emplace_back(aabb);
+					}
 				}
-				return line->second;
 			}
-			return line->second;
+			return occluders;
 		}
 
-
-		VoxelChunk* get_voxel_chunk(VoxelLine& line, int x) {
-			auto chunk = line.find(x);
-			if (chunk == line.end()) {
-				return nullptr;
+		//Level of detail chunk x, y, z gets seen from eye
+		int chunk_lod(int x, int y, int z, VoxelChunk const& chunk, float const* eye) const {
+			const int size[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, VOXEL_CHUNK_DEPTH };
+			const int position[3] = { x, y, z };
+			float distance_sq = 0.0f;
+			for (int i = 0; i < 3; ++i) {
+				float d = (float(position[i]) + 0.5f) * size[i] - eye[i];
+				distance_sq += d * d;
 			}
-			return &chunk->second;
-		}
-
-		void set_voxel_chunk(VoxelLine& line, int x, VoxelChunk chunk) {
-			line.emplace(std::make_pair(x, std::move(chunk)));
+			float distance = bx::fsqrt(distance_sq) / VOXEL_CHUNK_WIDTH;
+			return select_lod(distance, m_lod_distance, chunk.get_lod());
 		}
 
-		void set_voxel_chunk(int x, int y, int z, VoxelChunk chunk) {
-			auto& slice = get_voxel_slice_or(z, []() {return VoxelSlice{}; });
-			auto& line = get_voxel_line_or(slice, y, []() {return VoxelLine{}; });
-
-			set_voxel_chunk(line, x, std::move(chunk));
-		}
-
-		VoxelChunk* get_voxel_chunk(int x, int y, int z) {
-			auto* slice = get_voxel_slice(z);
-			if (!slice) return nullptr;
-
-			auto* line = get_voxel_line(*slice, y);
-			if (!line) return nullptr;
-
-			return get_voxel_chunk(*line, x);
+		//Levels of detail are chosen again once the camera enters another
+		//chunk, chunks streamed in meanwhile get theirs in schedule_meshing
+		void update_lods() {
+			PROFILE_ZONE(UpdateLods);
+			float eye[3];
+			cameraGetPosition(eye);
+			const int size[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, VOXEL_CHUNK_DEPTH };
+			std::array<int, 3> camera;
+			for (int i = 0; i < 3; ++i)
+				camera[i] = int(std::floor(eye[i] / size[i]));
+			if (m_lod_camera && *m_lod_camera == camera)
+				return;
+
+			m_lod_camera = camera;
+			m_voxel_world.for_each([&](int x, int y, int z, VoxelChunk& chunk) {
+				chunk.set_lod(chunk_lod(x, y, z, chunk, eye));
+			});
 		}
 
-		void create_voxel_chunk(int x, int y, int z) {
-			set_voxel_chunk(x, y, z, std::move(VoxelChunk{}));
+		//Hand dirty chunks to the mesh workers, at most one job per chunk is in flight
+		void schedule_meshing() {
+			PROFILE_ZONE(ScheduleMeshing);
+			float eye[3];
+			cameraGetPosition(eye);
+			m_voxel_world.for_each_dirty([&](int x, int y, int z, VoxelChunk& chunk) {
+				chunk.set_lod(chunk_lod(x, y, z, chunk, eye));
+				if (!chunk.is_dirty() || chunk.is_mesh_pending())
+					return;
+
+				m_mesh_pipeline->submit(x, y, z, chunk.make_mesh_job(
+					chunk.get_neighbour(FACE_LEFT),
+					chunk.get_neighbour(FACE_RIGHT),
+					chunk.get_neighbour(FACE_TOP),
+					chunk.get_neighbour(FACE_BOTTOM),
+					chunk.get_neighbour(FACE_FRONT),
+					chunk.get_neighbour(FACE_BACK)
+				));
+			});
 		}
 	};
 
@@ -0,0 +1,648 @@
+#include <algorithm>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bx/uint32_t.h"
+#include "bgfx_utils.h"
+#include "mesher.hh"
+#include "facemask.hh"
+#include "profiler.hh"
+
+namespace {
+	//Blue channel of the baked colour, faces darken from the top down to the
+	//bottom so edges read without any lights in the shader
+	const uint8_t FACE_SHADE[NUM_FACES] = { 204, 204, 128, 255, 178, 178 };
+
+	//Blocks at least half solid stay solid when downsampled so one voxel
+	//thick floors survive
+	bool downsampled_solid(int solid, int block_voxels) {
+		return solid * 2 >= block_voxels;
+	}
+
+	//Sky and block light scaled to 0-255 in red and green, see fs_bump
+	uint32_t face_color(int face, uint8_t light) {
+		return uint32_t(sky_light(light) * 17)
+			| uint32_t(block_light(light) * 17) << 8
+			| uint32_t(FACE_SHADE[face]) << 16
+			| 0xff000000u;
+	}
+
+	//Normal, tangent and texture coordinates are derived from the face in vs_bump_packed
+	PackedVoxelVertex make_vertex(
+		unsigned int x, unsigned int y, unsigned int z,
+		VoxelFace face, uint32_t color) {
+		return PackedVoxelVertex{ uint8_t(x), uint8_t(y), uint8_t(z), uint8_t(face), color };
+	}
+
+	auto add_vertex = [](auto &t, unsigned int x, unsigned int y, unsigned int z, VoxelFace face, uint32_t color) {
+		t.emplace_back(make_vertex(x, y, z, face, color));
+	};
+
+	//Every face is emitted with the same corner order so one index pattern
+	//(0, 1, 2), (2, 1, 3) serves all quads, see add_quad_indices
+	auto add_left_face = [](auto& vertices, uint32_t color, auto x, auto y, auto z, unsigned int h = 1, unsigned int d = 1) {
+		add_vertex(vertices, x,		y + h,	z + d,	FACE_LEFT, color);
+		add_vertex(vertices, x,		y,		z + d,	FACE_LEFT, color);
+		add_vertex(vertices, x,		y + h,	z,		FACE_LEFT, color);
+		add_vertex(vertices, x,		y,		z,		FACE_LEFT, color);
+	};
+
+	auto add_right_face = [](auto& vertices, uint32_t color, auto x, auto y, auto z, unsigned int h = 1, unsigned int d = 1) {
+		add_vertex(vertices, x + 1, y + h,	z + d,	FACE_RIGHT, color);
+		add_vertex(vertices, x + 1, y + h,	z,		FACE_RIGHT, color);
+		add_vertex(vertices, x + 1, y,		z + d,	FACE_RIGHT, color);
+		add_vertex(vertices, x + 1, y,		z,		FACE_RIGHT, color);
+	};
+
+	auto add_bottom_face = [](auto& vertices, uint32_t color, auto x, auto y, auto z, unsigned int w = 1, unsigned int d = 1) {
+		add_vertex(vertices, x,		y,		z + d,	FACE_BOTTOM, color);
+		add_vertex(vertices, x + w, y,		z + d,	FACE_BOTTOM, color);
+		add_vertex(vertices, x,		y,		z,		FACE_BOTTOM, color);
+		add_vertex(vertices, x + w, y,		z,		FACE_BOTTOM, color);
+	};
+
+	auto add_front_face = [](auto& vertices, uint32_t color, auto x, auto y, auto z, unsigned int w = 1, unsigned int h = 1) {
+		add_vertex(vertices,     x,	h + y,	z,	FACE_FRONT, color);
+		add_vertex(vertices,     x,	    y,	z,	FACE_FRONT, color);
+		add_vertex(vertices, w + x, h + y,	z,	FACE_FRONT, color);
+		add_vertex(vertices, w + x,     y,	z,	FACE_FRONT, color);
+	};
+
+	auto add_back_face = [](auto& vertices, uint32_t color, auto x, auto y, auto z, unsigned int w = 1, unsigned int h = 1) {
+		add_vertex(vertices,     x,	y + h,	z + 1,	FACE_BACK, color);
+		add_vertex(vertices, x + w, y + h,	z + 1,	FACE_BACK, color);
+		add_vertex(vertices,     x,	    y,	z + 1,	FACE_BACK, color);
+		add_vertex(vertices, x + w,     y,	z + 1,	FACE_BACK, color);
+	};
+
+	auto add_top_face = [](auto& vertices, uint32_t color, auto x, auto y, auto z, unsigned int w = 1, unsigned int d = 1) {
+		add_vertex(vertices, x + w, y + 1,	z,		FACE_TOP, color);
+		add_vertex(vertices, x + w, y + 1,	z + d,	FACE_TOP, color);
+		add_vertex(vertices, x,		y + 1,	z,		FACE_TOP, color);
+		add_vertex(vertices, x,		y + 1,	z + d,	FACE_TOP, color);
+	};
+
+	void build_occupancy(
+		ChunkOccupancy& occupancy,
+		VoxelType const* voxels,
+		ChunkBorders const& borders,
+		int z_begin,
+		int z_end) {
+
+		auto& rows = occupancy.rows;
+
+		//Rows one slice beyond the range are needed for front and back faces
+		for (int z = std::max(z_begin - 1, 0); z < std::min(z_end + 1, VOXEL_CHUNK_DEPTH); ++z) {
+			for (int y = 0; y < VOXEL_CHUNK_HEIGHT; ++y)
+				rows[occupancy_row(y, z)] = pack_solid_row(voxels + voxel_row(y, z) * VOXEL_CHUNK_WIDTH);
+		}
+
+		for (int z = z_begin; z < z_end; ++z) {
+			for (int y = 0; y < VOXEL_CHUNK_HEIGHT; ++y) {
+				int row = voxel_row(y, z);
+				occupancy.left_edge[row] = (borders.left[row / 32] >> (row % 32)) & 1;
+				occupancy.right_edge[row] = ((borders.right[row / 32] >> (row % 32)) & 1) << (VOXEL_CHUNK_WIDTH - 1);
+			}
+
+			rows[occupancy_row(-1, z)] = borders.below[z];
+			rows[occupancy_row(VOXEL_CHUNK_HEIGHT, z)] = borders.above[z];
+		}
+
+		for (int y = 0; y < VOXEL_CHUNK_HEIGHT; ++y) {
+			if (z_begin == 0)
+				rows[occupancy_row(y, -1)] = borders.front[y];
+			if (z_end == VOXEL_CHUNK_DEPTH)
+				rows[occupancy_row(y, VOXEL_CHUNK_DEPTH)] = borders.back[y];
+		}
+	}
+
+	//Neighbouring faces mostly share a type, skip the map lookup for runs of them
+	struct SlabMeshCursor {
+		SlabMesh& mesh;
+		VoxelType type = VoxelType::V_EMPTY;
+		std::vector<PackedVoxelVertex>* vertices = nullptr;
+
+		std::vector<PackedVoxelVertex>& operator[](VoxelType voxel_type) {
+			if (!vertices || voxel_type != type) {
+				type = voxel_type;
+				vertices = &mesh[voxel_type];
+			}
+			return *vertices;
+		}
+	};
+
+	//Light in front of a face of voxel x of row z * VOXEL_CHUNK_HEIGHT + y,
+	//from the chunk's own light or the neighbour's border plane
+	struct FaceLight {
+		ChunkBorders const& borders;
+		ChunkLight const* light;
+
+		uint8_t operator()(int face, int row, int x) const {
+			if (!light)
+				return UNLIT_LIGHT;
+
+			int pos[3] = { x, row % VOXEL_CHUNK_HEIGHT, row / VOXEL_CHUNK_HEIGHT };
+			const int size[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, VOXEL_CHUNK_DEPTH };
+			const int axis = face / 2;
+			pos[axis] += face % 2 ? 1 : -1;
+			if (pos[axis] >= 0 && pos[axis] < size[axis])
+				return light->levels[voxel_row(pos[1], pos[2]) * VOXEL_CHUNK_WIDTH + pos[0]];
+
+			const int a = axis == 0 ? pos[1] : pos[0];
+			const int b = axis == 2 ? pos[1] : pos[2];
+			return borders.light[face][b * VOXEL_CHUNK_WIDTH + a];
+		}
+	};
+
+	//voxel_at(row, x) returns the type of voxel x of row z * VOXEL_CHUNK_HEIGHT + y.
+	//Face records are a single vertex at the voxel, see MeshingMode::FaceRecords.
+	template<bool Tface_records, typename Tvoxels>
+	void build_faces(Tvoxels voxel_at, FaceLight const& light_at, FaceMasks const& masks, int slab, SlabMesh& slab_mesh) {
+		SlabMeshCursor mesh{ slab_mesh };
+		const int row_begin = slab * VOXEL_SLAB_DEPTH * VOXEL_CHUNK_HEIGHT;
+		const int row_end = row_begin + VOXEL_SLAB_DEPTH * VOXEL_CHUNK_HEIGHT;
+
+		for (int face = 0; face < NUM_FACES; ++face) {
+			for (int row = row_begin; row < row_end; ++row) {
+				uint32_t bits = masks.face[face][row];
+				if (!bits)
+					continue;
+
+				unsigned int y = row % VOXEL_CHUNK_HEIGHT;
+				unsigned int z = row / VOXEL_CHUNK_HEIGHT;
+
+				while (bits) {
+					unsigned int x = bx::uint32_cnttz(bits);
+					bits &= bits - 1;
+
+					auto& vertices = mesh[voxel_at(row, x)];
+					auto color = face_color(face, light_at(face, row, int(x)));
+
+					if (Tface_records) {
+						add_vertex(vertices, x, y, z, VoxelFace(face), color);
+						continue;
+					}
+
+					switch (face) {
+					case FACE_LEFT: add_left_face(vertices, color, x, y, z); break;
+					case FACE_RIGHT: add_right_face(vertices, color, x, y, z); break;
+					case FACE_BOTTOM: add_bottom_face(vertices, color, x, y, z); break;
+					case FACE_TOP: add_top_face(vertices, color, x, y, z); break;
+					case FACE_FRONT: add_front_face(vertices, color, x, y, z); break;
+					case FACE_BACK: add_back_face(vertices, color, x, y, z); break;
+					}
+				}
+			}
+		}
+	}
+
+	template<typename Tvoxels>
+	void build_greedy_faces(Tvoxels voxel_at, FaceLight const& light_at, FaceMasks const& masks, int slab, SlabMesh& slab_mesh) {
+		SlabMeshCursor mesh{ slab_mesh };
+		//Faces are only merged inside the slab so slabs can be remeshed on their own
+		const int lo[3] = { 0, 0, slab * VOXEL_SLAB_DEPTH };
+		const int hi[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, (slab + 1) * VOXEL_SLAB_DEPTH };
+
+		//Type in the low 24 and light in the high 8 bits, faces only merge
+		//when both match. 0 is no face since empty voxels have none.
+		std::array<uint32_t, std::max({
+			VOXEL_CHUNK_WIDTH * VOXEL_CHUNK_HEIGHT,
+			VOXEL_CHUNK_HEIGHT * VOXEL_SLAB_DEPTH,
+			VOXEL_SLAB_DEPTH * VOXEL_CHUNK_WIDTH })> mask;
+
+		for (int face = 0; face < NUM_FACES; ++face) {
+			const int d = face / 2;
+			const int u = (d + 1) % 3;
+			const int v = (d + 2) % 3;
+			const int size_u = hi[u] - lo[u];
+			const int size_v = hi[v] - lo[v];
+			auto const& face_bits = masks.face[face];
+
+			//Bit n of slices[axis] is set when plane n along that axis has a visible face
+			uint32_t slices[3] = {};
+			for (int z = lo[2]; z < hi[2]; ++z) {
+				for (int y = lo[1]; y < hi[1]; ++y) {
+					uint32_t bits = face_bits[voxel_row(y, z)];
+					if (!bits)
+						continue;
+					slices[0] |= bits;
+					slices[1] |= 1u << y;
+					slices[2] |= 1u << z;
+				}
+			}
+
+			for (int slice = lo[d]; slice < hi[d]; ++slice) {
+				if (!((slices[d] >> slice) & 1))
+					continue;
+
+				//Collect the visible faces of this slice
+				int pos[3];
+				pos[d] = slice;
+				for (pos[v] = lo[v]; pos[v] < hi[v]; ++pos[v]) {
+					for (pos[u] = lo[u]; pos[u] < hi[u]; ++pos[u]) {
+						const int row = voxel_row(pos[1], pos[2]);
+						bool visible = (face_bits[row] >> pos[0]) & 1;
+						mask[(pos[u] - lo[u]) + (pos[v] - lo[v]) * size_u] = visible
+							? uint32_t(voxel_at(row, pos[0])) | uint32_t(light_at(face, row, pos[0])) << 24
+							: 0;
+					}
+				}
+
+				//Merge equal faces into maximal rectangles, widest along u first
+				for (int j = 0; j < size_v; ++j) {
+					for (int i = 0; i < size_u;) {
+						auto key = mask[i + j * size_u];
+						if (!key) {
+							++i;
+							continue;
+						}
+
+						int w = 1;
+						while (i + w < size_u && mask[i + w + j * size_u] == key)
+							++w;
+
+						int h = 1;
+						for (; j + h < size_v; ++h) {
+							bool row_matches = true;
+							for (int k = 0; k < w; ++k) {
+								if (mask[i + k + (j + h) * size_u] != key) {
+									row_matches = false;
+									break;
+								}
+							}
+							if (!row_matches)
+								break;
+						}
+
+						for (int l = 0; l < h; ++l)
+							for (int k = 0; k < w; ++k)
+								mask[i + k + (j + l) * size_u] = 0;
+
+						int origin[3];
+						origin[d] = slice;
+						origin[u] = lo[u] + i;
+						origin[v] = lo[v] + j;
+						auto x = unsigned(origin[0]), y = unsigned(origin[1]), z = unsigned(origin[2]);
+
+						auto& vertices = mesh[VoxelType(key & 0xffffff)];
+						auto color = face_color(face, uint8_t(key >> 24));
+
+						//u/v map to (y,z) for x faces, (z,x) for y faces and (x,y) for z faces
+						switch (face) {
+						case FACE_LEFT: add_left_face(vertices, color, x, y, z, w, h); break;
+						case FACE_RIGHT: add_right_face(vertices, color, x, y, z, w, h); break;
+						case FACE_BOTTOM: add_bottom_face(vertices, color, x, y, z, h, w); break;
+						case FACE_TOP: add_top_face(vertices, color, x, y, z, h, w); break;
+						case FACE_FRONT: add_front_face(vertices, color, x, y, z, w, h); break;
+						case FACE_BACK: add_back_face(vertices, color, x, y, z, w, h); break;
+						}
+
+						i += w;
+					}
+				}
+			}
+		}
+	}
+
+	template<typename Tvoxels>
+	void build_slabs(Tvoxels voxel_at, FaceLight const& light_at, FaceMasks const& masks, MeshingMode mode,
+		uint32_t slabs, ChunkMeshResult& result) {
+
+		result.slabs = slabs;
+		for (int slab = 0; slab < NUM_VOXEL_SLABS; ++slab) {
+			if (!(slabs & (1u << slab)))
+				continue;
+
+			auto& mesh = result.meshes[slab];
+			for (auto& vertices : mesh)
+				vertices.second.clear();
+
+			switch (mode) {
+			case MeshingMode::PerFace:
+				build_faces<false>(voxel_at, light_at, masks, slab, mesh);
+				break;
+			case MeshingMode::Greedy:
+				build_greedy_faces(voxel_at, light_at, masks, slab, mesh);
+				break;
+			case MeshingMode::FaceRecords:
+				build_faces<true>(voxel_at, light_at, masks, slab, mesh);
+				break;
+			}
+
+			auto& bounds = result.bounds[slab];
+			bounds = MeshBounds{};
+			for (auto const& vertices : mesh)
+				for (auto const& vertex : vertices.second)
+					bounds.add(vertex);
+			//Face records hold the lowest corner of their voxel
+			if (mode == MeshingMode::FaceRecords && !bounds.is_empty()) {
+				for (auto& max : bounds.max)
+					++max;
+			}
+		}
+	}
+
+	//A chunk of one solid type only has faces on its borders where the
+	//neighbour is open
+	void build_solid_face_masks(ChunkBorders const& borders, FaceMasks& masks, int z_begin, int z_end) {
+		for (auto& face : masks.face)
+			std::fill(face.begin() + voxel_row(0, z_begin), face.begin() + voxel_row(0, z_end), 0);
+
+		for (int z = z_begin; z < z_end; ++z) {
+			for (int y = 0; y < VOXEL_CHUNK_HEIGHT; ++y) {
+				int row = voxel_row(y, z);
+				masks.face[FACE_LEFT][row] = ~(borders.left[row / 32] >> (row % 32)) & 1;
+				masks.face[FACE_RIGHT][row] = (~(borders.right[row / 32] >> (row % 32)) & 1) << (VOXEL_CHUNK_WIDTH - 1);
+			}
+			masks.face[FACE_BOTTOM][voxel_row(0, z)] = ~borders.below[z];
+			masks.face[FACE_TOP][voxel_row(VOXEL_CHUNK_HEIGHT - 1, z)] = ~borders.above[z];
+		}
+
+		for (int y = 0; y < VOXEL_CHUNK_HEIGHT; ++y) {
+			if (z_begin == 0)
+				masks.face[FACE_FRONT][voxel_row(y, 0)] = ~borders.front[y];
+			if (z_end == VOXEL_CHUNK_DEPTH)
+				masks.face[FACE_BACK][voxel_row(y, VOXEL_CHUNK_DEPTH - 1)] = ~borders.back[y];
+		}
+	}
+}
+
+void mesh_chunk(VoxelType const* voxels, ChunkBorders const& borders, ChunkLight const* light,
+	MeshingMode mode, uint32_t slabs, ChunkMeshResult& result) {
+
+	result.mode = mode;
+	result.slabs = slabs;
+	if (!slabs)
+		return;
+
+	int first_slab = bx::uint32_cnttz(slabs);
+	int last_slab = 31 - bx::uint32_cntlz(slabs);
+	int z_begin = first_slab * VOXEL_SLAB_DEPTH;
+	int z_end = (last_slab + 1) * VOXEL_SLAB_DEPTH;
+
+	FaceMasks masks;
+	{
+		PROFILE_ZONE(BuildFaceMasks);
+		ChunkOccupancy occupancy;
+		build_occupancy(occupancy, voxels, borders, z_begin, z_end);
+		build_face_masks(occupancy, masks, z_begin, z_end);
+	}
+
+	PROFILE_ZONE(BuildSlabs);
+	auto voxel_at = [voxels](int row, int x) {
+		return voxels[row * VOXEL_CHUNK_WIDTH + x];
+	};
+	build_slabs(voxel_at, FaceLight{ borders, light }, masks, mode, slabs, result);
+}
+
+void mesh_chunk(PalettedVoxels const& voxels, ChunkBorders const& borders, ChunkLight const* light,
+	MeshingMode mode, int lod, uint32_t slabs, ChunkMeshResult& result) {
+
+	PROFILE_ZONE(MeshChunk);
+	//Blocks span slabs and only merged faces save vertices at a coarse level
+	if (lod > 0) {
+		if (slabs)
+			slabs = ALL_VOXEL_SLABS;
+		mode = MeshingMode::Greedy;
+		light = nullptr;
+	}
+	result.mode = mode;
+
+	if (voxels.is_uniform()) {
+		auto type = voxels.get(0);
+		result.slabs = slabs;
+		result.connectivity.bits = type == VoxelType::V_EMPTY ? FaceConnectivity::ALL : 0;
+		result.occluder = MeshBounds{};
+		if (type != VoxelType::V_EMPTY) {
+			result.occluder.min = { 0, 0, 0 };
+			result.occluder.max = { uint8_t(VOXEL_CHUNK_WIDTH), uint8_t(VOXEL_CHUNK_HEIGHT), uint8_t(VOXEL_CHUNK_DEPTH) };
+		}
+		if (type == VoxelType::V_EMPTY) {
+			for (auto& mesh : result.meshes)
+				for (auto& vertices : mesh)
+					vertices.second.clear();
+			result.bounds.fill(MeshBounds{});
+			return;
+		}
+		if (!slabs)
+			return;
+
+		int z_begin = bx::uint32_cnttz(slabs) * VOXEL_SLAB_DEPTH;
+		int z_end = (32 - bx::uint32_cntlz(slabs)) * VOXEL_SLAB_DEPTH;
+		FaceMasks masks;
+		build_solid_face_masks(borders, masks, z_begin, z_end);
+		build_slabs([type](int, int) { return type; }, FaceLight{ borders, light }, masks, mode, slabs, result);
+		return;
+	}
+
+	thread_local std::vector<VoxelType> scratch(NUM_VOXELS);
+
+	//Connectivity needs every voxel, it is taken at full detail so coarse
+	//meshes never hide what the real air would show. Both are found even
+	//without dirty slabs, apply_mesh replaces the chunk's copies either way.
+	{
+		PROFILE_ZONE(UnpackVoxels);
+		voxels.unpack(scratch.data(), 0, NUM_VOXELS);
+		result.connectivity = find_face_connectivity(scratch.data());
+		if (lod > 0)
+			downsample_voxels(scratch.data(), lod);
+		//Taken from what is drawn so a coarse surface never hides more than it covers
+		result.occluder = find_occluder(scratch.data());
+	}
+
+	mesh_chunk(scratch.data(), borders, light, mode, slabs, result);
+}
+
+void downsample_voxels(VoxelType* voxels, int lod) {
+	const int scale = 1 << lod;
+	const int block_voxels = scale * scale * scale;
+	auto at = [voxels](int x, int y, int z) -> VoxelType& {
+		return voxels[z * VOXEL_SLICE_SIZE + y * VOXEL_CHUNK_WIDTH + x];
+	};
+
+	for (int bz = 0; bz < VOXEL_CHUNK_DEPTH; bz += scale) {
+		for (int by = 0; by < VOXEL_CHUNK_HEIGHT; by += scale) {
+			for (int bx = 0; bx < VOXEL_CHUNK_WIDTH; bx += scale) {
+				//Solid blocks take the type of their highest solid voxel so the
+				//surface keeps its material
+				int solid = 0;
+				int top = -1;
+				auto type = VoxelType::V_EMPTY;
+				for (int z = bz; z < bz + scale; ++z) {
+					for (int y = by; y < by + scale; ++y) {
+						for (int x = bx; x < bx + scale; ++x) {
+							auto voxel = at(x, y, z);
+							if (voxel == VoxelType::V_EMPTY)
+								continue;
+							++solid;
+							if (y > top) {
+								top = y;
+								type = voxel;
+							}
+						}
+					}
+				}
+				if (!downsampled_solid(solid, block_voxels))
+					type = VoxelType::V_EMPTY;
+
+				for (int z = bz; z < bz + scale; ++z)
+					for (int y = by; y < by + scale; ++y)
+						for (int x = bx; x < bx + scale; ++x)
+							at(x, y, z) = type;
+			}
+		}
+	}
+}
+
+void downsample_border(PalettedVoxels const& voxels, VoxelFace face, int lod, uint32_t* plane) {
+	const int scale = 1 << lod;
+	const int block_voxels = scale * scale * scale;
+	const uint32_t block_bits = ~0u >> (32 - scale);
+
+	//Step from a border voxel into the chunk
+	int inward;
+	switch (face) {
+	case FACE_LEFT: inward = 1; break;
+	case FACE_RIGHT: inward = -1; break;
+	case FACE_BOTTOM: inward = VOXEL_CHUNK_WIDTH; break;
+	case FACE_TOP: inward = -VOXEL_CHUNK_WIDTH; break;
+	case FACE_FRONT: inward = VOXEL_SLICE_SIZE; break;
+	default: inward = -VOXEL_SLICE_SIZE; break;
+	}
+
+	//Only the layer of blocks against the face is read
+	std::fill(plane, plane + VOXEL_CHUNK_WIDTH, 0u);
+	for (int block_b = 0; block_b < VOXEL_CHUNK_WIDTH; block_b += scale) {
+		for (int block_a = 0; block_a < VOXEL_CHUNK_WIDTH; block_a += scale) {
+			int solid = 0;
+			for (int b = block_b; b < block_b + scale; ++b) {
+				for (int a = block_a; a < block_a + scale; ++a) {
+					int index = int(border_voxel_index(face, a, b));
+					for (int depth = 0; depth < scale; ++depth, index += inward)
+						solid += voxels.get(unsigned(index)) != VoxelType::V_EMPTY;
+				}
+			}
+			if (!downsampled_solid(solid, block_voxels))
+				continue;
+			for (int b = block_b; b < block_b + scale; ++b)
+				plane[b] |= block_bits << block_a;
+		}
+	}
+}
+
+FaceConnectivity find_face_connectivity(VoxelType const* voxels) {
+	//Solid voxels start out visited so the fill only walks air
+	std::array<uint32_t, VOXEL_ROWS> visited;
+	for (int row = 0; row < VOXEL_ROWS; ++row)
+		visited[row] = pack_solid_row(voxels + row * VOXEL_CHUNK_WIDTH);
+
+	FaceConnectivity connectivity;
+	connectivity.bits = 0;
+
+	thread_local std::vector<uint16_t> stack;
+	static_assert(NUM_VOXELS <= 65536, "Voxel indices are kept in 16 bits");
+
+	auto visit = [&visited](int x, int y, int z) {
+		auto& row = visited[voxel_row(y, z)];
+		if (row & (1u << x))
+			return false;
+		row |= 1u << x;
+		stack.emplace_back(uint16_t(z * VOXEL_SLICE_SIZE + y * VOXEL_CHUNK_WIDTH + x));
+		return true;
+	};
+
+	auto fill = [&](int x, int y, int z) {
+		if (!visit(x, y, z))
+			return;
+
+		uint32_t faces = 0;
+		while (!stack.empty()) {
+			int index = stack.back();
+			stack.pop_back();
+			x = index % VOXEL_CHUNK_WIDTH;
+			y = index / VOXEL_CHUNK_WIDTH % VOXEL_CHUNK_HEIGHT;
+			z = index / VOXEL_SLICE_SIZE;
+
+			if (x == 0) faces |= 1u << FACE_LEFT; else visit(x - 1, y, z);
+			if (x == VOXEL_CHUNK_WIDTH - 1) faces |= 1u << FACE_RIGHT; else visit(x + 1, y, z);
+			if (y == 0) faces |= 1u << FACE_BOTTOM; else visit(x, y - 1, z);
+			if (y == VOXEL_CHUNK_HEIGHT - 1) faces |= 1u << FACE_TOP; else visit(x, y + 1, z);
+			if (z == 0) faces |= 1u << FACE_FRONT; else visit(x, y, z - 1);
+			if (z == VOXEL_CHUNK_DEPTH - 1) faces |= 1u << FACE_BACK; else visit(x, y, z + 1);
+		}
+		connectivity.connect(faces);
+	};
+
+	//Air pockets not touching a face cannot connect anything, so the fill
+	//only starts from the border voxels
+	for (int a = 0; a < VOXEL_CHUNK_HEIGHT && connectivity.bits != FaceConnectivity::ALL; ++a) {
+		for (int b = 0; b < VOXEL_CHUNK_WIDTH; ++b) {
+			fill(0, a, b);
+			fill(VOXEL_CHUNK_WIDTH - 1, a, b);
+			fill(b, 0, a);
+			fill(b, VOXEL_CHUNK_HEIGHT - 1, a);
+			fill(b, a, 0);
+			fill(b, a, VOXEL_CHUNK_DEPTH - 1);
+		}
+	}
+	return connectivity;
+}
+
+MeshBounds find_occluder(VoxelType const* voxels) {
+	const uint32_t full_row = ~0u;
+	std::array<uint32_t, VOXEL_ROWS> rows;
+	uint32_t solid_columns = full_row;
+	for (int row = 0; row < VOXEL_ROWS; ++row) {
+		rows[row] = pack_solid_row(voxels + row * VOXEL_CHUNK_WIDTH);
+		solid_columns &= rows[row];
+	}
+
+	auto full_y = [&rows, full_row](int y) {
+		for (int z = 0; z < VOXEL_CHUNK_DEPTH; ++z)
+			if (rows[voxel_row(y, z)] != full_row)
+				return false;
+		return true;
+	};
+	auto full_z = [&rows, full_row](int z) {
+		for (int y = 0; y < VOXEL_CHUNK_HEIGHT; ++y)
+			if (rows[voxel_row(y, z)] != full_row)
+				return false;
+		return true;
+	};
+
+	//Whole solid layers counted from each face, in VoxelFace order
+	int layers[NUM_FACES] = {};
+	if (solid_columns == full_row) {
+		layers[FACE_LEFT] = layers[FACE_RIGHT] = VOXEL_CHUNK_WIDTH;
+	}
+	else {
+		layers[FACE_LEFT] = int(bx::uint32_cnttz(~solid_columns));
+		layers[FACE_RIGHT] = int(bx::uint32_cntlz(~solid_columns));
+	}
+	while (layers[FACE_BOTTOM] < VOXEL_CHUNK_HEIGHT && full_y(layers[FACE_BOTTOM]))
+		++layers[FACE_BOTTOM];
+	while (layers[FACE_TOP] < VOXEL_CHUNK_HEIGHT && full_y(VOXEL_CHUNK_HEIGHT - 1 - layers[FACE_TOP]))
+		++layers[FACE_TOP];
+	while (layers[FACE_FRONT] < VOXEL_CHUNK_DEPTH && full_z(layers[FACE_FRONT]))
+		++layers[FACE_FRONT];
+	while (layers[FACE_BACK] < VOXEL_CHUNK_DEPTH && full_z(VOXEL_CHUNK_DEPTH - 1 - layers[FACE_BACK]))
+		++layers[FACE_BACK];
+
+	//Every layer of a cubic chunk has the same area, the thickest slab wins
+	auto face = VoxelFace(std::max_element(layers, layers + NUM_FACES) - layers);
+	MeshBounds occluder;
+	if (!layers[face])
+		return occluder;
+
+	const int size[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, VOXEL_CHUNK_DEPTH };
+	for (int i = 0; i < 3; ++i) {
+		occluder.min[i] = 0;
+		occluder.max[i] = uint8_t(size[i]);
+	}
+	int axis = face / 2;
+	if (face % 2)
+		occluder.min[axis] = uint8_t(size[axis] - layers[face]);
+	else
+		occluder.max[axis] = uint8_t(layers[face]);
+	return occluder;
+}
@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <string>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "meshpipeline.hh"
+#include "profiler.hh"
+
+MeshPipeline::MeshPipeline(unsigned int num_workers) {
+	num_workers = std::max(num_workers, 1u);
+	for (unsigned int i = 0; i < num_workers; ++i)
+		m_workers.emplace_back(start_thread("Mesh worker " + std::to_string(i), [this]() { worker(); }));
+}
+
+MeshPipeline::~MeshPipeline() {
+	{
+		std::lock_guard<std::mutex> lock(m_job_mutex);
+		m_stopping = true;
+	}
+	m_job_ready.notify_all();
+
+	for (auto& thread : m_workers)
+		thread.join();
+}
+
+unsigned int MeshPipeline::default_num_workers() {
+	auto hardware = std::thread::hardware_concurrency();
+	return hardware > 1 ? hardware - 1 : 1;
+}
+
+void MeshPipeline::submit(int x, int y, int z, std::unique_ptr<ChunkMeshJob> job) {
+	job->x = x;
+	job->y = y;
+	job->z = z;
+
+	++m_num_pending;
+	{
+		std::lock_guard<std::mutex> lock(m_job_mutex);
+		m_jobs.emplace_back(std::move(job));
+	}
+	m_job_ready.notify_one();
+}
+
+void MeshPipeline::worker() {
+	for (;;) {
+		std::unique_ptr<ChunkMeshJob> job;
+		{
+			std::unique_lock<std::mutex> lock(m_job_mutex);
+			m_job_ready.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+			if (m_stopping)
+				return;
+
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+
+		auto result = std::make_unique<ChunkMeshResult>();
+		{
+			PROFILE_ZONE(MeshJob);
+			mesh_chunk(*job, *result);
+		}
+
+		std::lock_guard<std::mutex> lock(m_result_mutex);
+		m_results.emplace_back(std::move(result));
+	}
+}
+
+std::unique_ptr<ChunkMeshResult> MeshPipeline::pop_result() {
+	std::lock_guard<std::mutex> lock(m_result_mutex);
+	if (m_results.empty())
+		return nullptr;
+
+	auto result = std::move(m_results.front());
+	m_results.pop_front();
+	--m_num_pending;
+	return result;
+}
@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "occlusion.hh"
+#include "profiler.hh"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define VOXELBAND_OCCLUSION_SSE2 1
+#endif
+
+static_assert(DepthBuffer::WIDTH % 4 == 0, "Rows are rasterized 4 pixels at a time");
+static_assert(DepthBuffer::WIDTH % DepthBuffer::TILE_SIZE == 0 && DepthBuffer::HEIGHT % DepthBuffer::TILE_SIZE == 0,
+	"The depth buffer must be a whole number of tiles");
+
+namespace {
+	//Corners closer than this are treated as crossing the near plane
+	const float MIN_DEPTH = 0.05f;
+
+	//Corner i of a box has the maximum of axis a when bit a of i is set.
+	//Two triangles per face, the winding is fixed up when rasterizing.
+	const uint8_t BOX_TRIANGLES[12][3] = {
+		{ 0, 2, 6 }, { 0, 6, 4 },
+		{ 1, 5, 7 }, { 1, 7, 3 },
+		{ 0, 4, 5 }, { 0, 5, 1 },
+		{ 2, 3, 7 }, { 2, 7, 6 },
+		{ 0, 1, 3 }, { 0, 3, 2 },
+		{ 4, 6, 7 }, { 4, 7, 5 },
+	};
+}
+
+void DepthBuffer::clear(float const* view_proj) {
+	std::copy(view_proj, view_proj + 16, m_view_proj);
+	m_depth.fill(FLT_MAX);
+	m_tiles.fill(FLT_MAX);
+}
+
+bool DepthBuffer::project(Aabb const& aabb, std::array<Corner, 8>& corners) const {
+	auto const* m = m_view_proj;
+	for (int i = 0; i < 8; ++i) {
+		float x = (i & 1) ? aabb.m_max[0] : aabb.m_min[0];
+		float y = (i & 2) ? aabb.m_max[1] : aabb.m_min[1];
+		float z = (i & 4) ? aabb.m_max[2] : aabb.m_min[2];
+		float cx = x * m[0] + y * m[4] + z * m[8] + m[12];
+		float cy = x * m[1] + y * m[5] + z * m[9] + m[13];
+		float cw = x * m[3] + y * m[7] + z * m[11] + m[15];
+		if (cw < MIN_DEPTH)
+			return false;
+
+		corners[i].x = (cx / cw * 0.5f + 0.5f) * WIDTH;
+		corners[i].y = (0.5f - cy / cw * 0.5f) * HEIGHT;
+		corners[i].w = cw;
+	}
+	return true;
+}
+
+void DepthBuffer::draw_box(Aabb const& aabb) {
+	//Back faces are drawn as well. Their farthest depth still lies behind
+	//the front of the box at every pixel, so they never hide too much.
+	std::array<Corner, 8> corners;
+	if (!project(aabb, corners))
+		return;
+
+	for (auto const& triangle : BOX_TRIANGLES)
+		draw_triangle(corners[triangle[0]], corners[triangle[1]], corners[triangle[2]]);
+}
+
+void DepthBuffer::draw_triangle(Corner const& a, Corner const& b_in, Corner const& c_in) {
+	float area = (b_in.x - a.x) * (c_in.y - a.y) - (b_in.y - a.y) * (c_in.x - a.x);
+	if (std::fabs(area) < 1e-6f)
+		return;
+	auto const& b = area > 0.0f ? b_in : c_in;
+	auto const& c = area > 0.0f ? c_in : b_in;
+
+	int min_x = std::max(int(std::floor(std::min({ a.x, b.x, c.x }))), 0);
+	int max_x = std::min(int(std::ceil(std::max({ a.x, b.x, c.x }))), WIDTH - 1);
+	int min_y = std::max(int(std::floor(std::min({ a.y, b.y, c.y }))), 0);
+	int max_y = std::min(int(std::ceil(std::max({ a.y, b.y, c.y }))), HEIGHT - 1);
+	if (min_x > max_x || min_y > max_y)
+		return;
+
+	//Edge functions e = dx * (py - y0) - dy * (px - x0), positive inside,
+	//evaluated at pixel centres
+	struct Edge {
+		float step_x, step_y, origin;
+	};
+	auto make_edge = [](Corner const& from, Corner const& to) {
+		float dx = to.x - from.x;
+		float dy = to.y - from.y;
+		return Edge{ -dy, dx, dy * from.x - dx * from.y };
+	};
+	const Edge edges[3] = { make_edge(a, b), make_edge(b, c), make_edge(c, a) };
+	const float depth = std::max({ a.w, b.w, c.w });
+
+	min_x &= ~3;
+	for (int y = min_y; y <= max_y; ++y) {
+		float py = float(y) + 0.5f;
+		float px = float(min_x) + 0.5f;
+		float row[3];
+		for (int i = 0; i < 3; ++i)
+			row[i] = edges[i].step_x * px + edges[i].step_y * py + edges[i].origin;
+
+		float* out = m_depth.data() + y * WIDTH;
+#if defined(VOXELBAND_OCCLUSION_SSE2)
+		const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 depth4 = _mm_set1_ps(depth);
+		__m128 e[3], step[3];
+		for (int i = 0; i < 3; ++i) {
+			e[i] = _mm_add_ps(_mm_set1_ps(row[i]), _mm_mul_ps(lanes, _mm_set1_ps(edges[i].step_x)));
+			step[i] = _mm_set1_ps(edges[i].step_x * 4.0f);
+		}
+		for (int x = min_x; x <= max_x; x += 4) {
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e[0], zero), _mm_cmpge_ps(e[1], zero)),
+				_mm_cmpge_ps(e[2], zero));
+			__m128 old_depth = _mm_loadu_ps(out + x);
+			__m128 new_depth = _mm_min_ps(old_depth, depth4);
+			_mm_storeu_ps(out + x, _mm_or_ps(_mm_and_ps(inside, new_depth), _mm_andnot_ps(inside, old_depth)));
+			for (int i = 0; i < 3; ++i)
+				e[i] = _mm_add_ps(e[i], step[i]);
+		}
+#else
+		for (int x = min_x; x <= max_x; ++x) {
+			if (row[0] >= 0.0f && row[1] >= 0.0f && row[2] >= 0.0f)
+				out[x] = std::min(out[x], depth);
+			for (int i = 0; i < 3; ++i)
+				row[i] += edges[i].step_x;
+		}
+#endif
+	}
+}
+
+void DepthBuffer::finish() {
+	for (int ty = 0; ty < TILES_Y; ++ty) {
+		for (int tx = 0; tx < TILES_X; ++tx) {
+			float farthest = 0.0f;
+			for (int y = ty * TILE_SIZE; y < (ty + 1) * TILE_SIZE; ++y) {
+				auto const* row = m_depth.data() + y * WIDTH + tx * TILE_SIZE;
+				farthest = std::max(farthest, *std::max_element(row, row + TILE_SIZE));
+			}
+			m_tiles[ty * TILES_X + tx] = farthest;
+		}
+	}
+}
+
+bool DepthBuffer::is_visible(Aabb const& aabb) const {
+	std::array<Corner, 8> corners;
+	if (!project(aabb, corners))
+		return true;
+
+	float nearest = FLT_MAX;
+	float min_x = FLT_MAX, max_x = -FLT_MAX, min_y = FLT_MAX, max_y = -FLT_MAX;
+	for (auto const& corner : corners) {
+		nearest = std::min(nearest, corner.w);
+		min_x = std::min(min_x, corner.x);
+		max_x = std::max(max_x, corner.x);
+		min_y = std::min(min_y, corner.y);
+		max_y = std::max(max_y, corner.y);
+	}
+
+	int x0 = std::max(int(std::floor(min_x)), 0);
+	int x1 = std::min(int(std::floor(max_x)), WIDTH - 1);
+	int y0 = std::max(int(std::floor(min_y)), 0);
+	int y1 = std::min(int(std::floor(max_y)), HEIGHT - 1);
+	//Rounding can put a box the frustum accepted just off screen
+	if (x0 > x1 || y0 > y1)
+		return true;
+
+	for (int ty = y0 / TILE_SIZE; ty <= y1 / TILE_SIZE; ++ty) {
+		for (int tx = x0 / TILE_SIZE; tx <= x1 / TILE_SIZE; ++tx) {
+			if (m_tiles[ty * TILES_X + tx] < nearest)
+				continue;
+
+			//Some pixel of the tile is not covered by a nearer occluder
+			int py1 = std::min(y1, (ty + 1) * TILE_SIZE - 1);
+			int px1 = std::min(x1, (tx + 1) * TILE_SIZE - 1);
+			for (int y = std::max(y0, ty * TILE_SIZE); y <= py1; ++y)
+				for (int x = std::max(x0, tx * TILE_SIZE); x <= px1; ++x)
+					if (m_depth[y * WIDTH + x] >= nearest)
+						return true;
+		}
+	}
+	return false;
+}
+
+OcclusionCuller::OcclusionCuller() {
+	m_thread = start_thread("Occlusion", [this] { worker(); });
+}
+
+OcclusionCuller::~OcclusionCuller() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopping = true;
+	}
+	m_changed.notify_all();
+	m_thread.join();
+}
+
+void OcclusionCuller::begin(float const* view_proj, std::vector<Aabb> occluders) {
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_changed.wait(lock, [this] { return !m_drawing; });
+		std::copy(view_proj, view_proj + 16, m_view_proj);
+		m_occluders = std::move(occluders);
+		m_drawing = true;
+		m_started = true;
+	}
+	m_changed.notify_all();
+}
+
+void OcclusionCuller::cull(std::vector<VoxelChunk const*>& visible, CullStats& stats) {
+	PROFILE_ZONE(OcclusionCull);
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_changed.wait(lock, [this] { return !m_drawing; });
+		if (!m_started)
+			return;
+		m_started = false;
+	}
+
+	auto hidden = std::remove_if(visible.begin(), visible.end(), [this](VoxelChunk const* chunk) {
+		Aabb aabb;
+		return chunk_world_bounds(*chunk, aabb) && !m_depth.is_visible(aabb);
+	});
+	auto num_hidden = uint32_t(visible.end() - hidden);
+	visible.erase(hidden, visible.end());
+	stats.chunks_occluded = num_hidden;
+	stats.chunks_culled += num_hidden;
+}
+
+void OcclusionCuller::worker() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;) {
+		m_changed.wait(lock, [this] { return m_drawing || m_stopping; });
+		if (m_stopping)
+			return;
+
+		//begin and cull wait for m_drawing, nothing else touches the buffer
+		lock.unlock();
+		{
+			PROFILE_ZONE(DrawOccluders);
+			m_depth.clear(m_view_proj);
+			for (auto const& occluder : m_occluders)
+				m_depth.draw_box(occluder);
+			m_depth.finish();
+		}
+		lock.lock();
+
+		m_drawing = false;
+		m_changed.notify_all();
+	}
+}
+
+bool chunk_world_occluder(VoxelChunk const& chunk, Aabb& aabb) {
+	auto const& occluder = chunk.get_occluder();
+	if (occluder.is_empty())
+		return false;
+
+	const int size[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, VOXEL_CHUNK_DEPTH };
+	auto const& position = chunk.get_position();
+	for (int i = 0; i < 3; ++i) {
+		float origin = float(position[i] * size[i]);
+		aabb.m_min[i] = origin + occluder.min[i];
+		aabb.m_max[i] = origin + occluder.max[i];
+	}
+	return true;
+}
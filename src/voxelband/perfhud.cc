@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "imgui/imgui.h"
+#include "perfhud.hh"
+
+namespace fs = boost::filesystem;
+
+namespace {
+	const char* const COUNTER_NAMES[NUM_PERF_COUNTERS] = {
+		"frame_ms",
+		"ui_ms",
+		"camera_ms",
+		"streaming_ms",
+		"light_ms",
+		"meshing_ms",
+		"upload_ms",
+		"culling_ms",
+		"submit_ms",
+		"bgfx_frame_ms",
+		"gpu_ms",
+		"wait_render_ms",
+		"chunks_loaded",
+		"chunks_meshed",
+		"chunks_drawn",
+		"chunks_culled",
+		"vertices_uploaded",
+		"indices_uploaded",
+		"chunk_draws",
+		"draw_calls",
+		"arena_mib",
+		"gpu_memory_mib",
+	};
+
+	//Digits after the point shown for a counter
+	int counter_precision(int counter) {
+		if (counter <= PERF_WAIT_RENDER_MS)
+			return 2;
+		return counter >= PERF_ARENA_MIB ? 1 : 0;
+	}
+
+	//Written to the CSV file this often, so little is lost when the game dies
+	const uint64_t CSV_FLUSH_FRAMES = 60;
+}
+
+char const* perf_counter_name(PerfCounter counter) {
+	return COUNTER_NAMES[counter];
+}
+
+PerfHud::PerfHud(fs::path const& csv_path) {
+	for (auto& values : m_values)
+		values.fill(0.0f);
+
+	if (csv_path.empty())
+		return;
+
+	m_csv.open(csv_path.string());
+	if (!m_csv.is_open())
+		throw std::runtime_error("Unable to create " + csv_path.string());
+	m_csv << "frame";
+	for (auto const* name : COUNTER_NAMES)
+		m_csv << ',' << name;
+	m_csv << '\n';
+}
+
+void PerfHud::push(PerfFrame const& frame) {
+	for (int counter = 0; counter < NUM_PERF_COUNTERS; ++counter)
+		m_values[counter][m_next] = frame[counter];
+	m_next = (m_next + 1) % CAPACITY;
+	m_count = std::min(m_count + 1, CAPACITY);
+
+	if (m_csv.is_open()) {
+		m_csv << m_num_frames;
+		for (float value : frame)
+			m_csv << ',' << value;
+		m_csv << '\n';
+		if ((m_num_frames + 1) % CSV_FLUSH_FRAMES == 0)
+			m_csv.flush();
+	}
+	++m_num_frames;
+}
+
+std::array<float, 3> PerfHud::percentiles(PerfCounter counter) const {
+	if (m_count == 0)
+		return { { 0.0f, 0.0f, 0.0f } };
+
+	std::array<float, CAPACITY> sorted;
+	std::copy(m_values[counter].begin(), m_values[counter].begin() + m_count, sorted.begin());
+	std::sort(sorted.begin(), sorted.begin() + m_count);
+	auto at = [&](float p) {
+		return sorted[std::min(m_count - 1, int(p * float(m_count)))];
+	};
+	return { { at(0.5f), at(0.95f), at(0.99f) } };
+}
+
+void PerfHud::draw() const {
+	if (!visible)
+		return;
+
+	ImGui::SetNextWindowPos(ImVec2(10.0f, 80.0f), ImGuiSetCond_FirstUseEver);
+	ImGui::Begin("Performance", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoFocusOnAppearing);
+
+	//Oldest frame first once the ring is full
+	int offset = m_count < CAPACITY ? 0 : m_next;
+	auto histogram = [&](int counter, float height) {
+		auto p = percentiles(PerfCounter(counter));
+		char overlay[64];
+		std::snprintf(overlay, sizeof(overlay), "p50 %.2f p95 %.2f p99 %.2f", p[0], p[1], p[2]);
+		//Scaled to the p99 so one hitch does not flatten the rest
+		ImGui::PlotHistogram(COUNTER_NAMES[counter], m_values[counter].data(), m_count, offset,
+			overlay, 0.0f, std::max(p[2] * 1.25f, 1.0f), ImVec2(float(CAPACITY) * 0.75f, height));
+	};
+
+	histogram(PERF_FRAME_MS, 80.0f);
+	if (ImGui::CollapsingHeader("Stages")) {
+		for (int counter = PERF_UI_MS; counter <= PERF_WAIT_RENDER_MS; ++counter)
+			histogram(counter, 32.0f);
+	}
+
+	ImGui::Columns(5, "perf_counters");
+	for (auto const* heading : { "", "last", "p50", "p95", "p99" }) {
+		ImGui::Text("%s", heading);
+		ImGui::NextColumn();
+	}
+	ImGui::Separator();
+	int last = (m_next + CAPACITY - 1) % CAPACITY;
+	for (int counter = 0; counter < NUM_PERF_COUNTERS; ++counter) {
+		ImGui::Text("%s", COUNTER_NAMES[counter]);
+		ImGui::NextColumn();
+		auto p = percentiles(PerfCounter(counter));
+		for (float value : { m_values[counter][last], p[0], p[1], p[2] }) {
+			if (value < 0.0f)
+				ImGui::Text("n/a");
+			else
+				ImGui::Text("%.*f", counter_precision(counter), value);
+			ImGui::NextColumn();
+		}
+	}
+	ImGui::Columns(1);
+
+	ImGui::End();
+}
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "raycast.hh"
+
+namespace {
+	int min_axis(float const* t) {
+		return t[0] < t[1] ? (t[0] < t[2] ? 0 : 2) : (t[1] < t[2] ? 1 : 2);
+	}
+}
+
+bool raycast(ChunkMap const& chunks, Ray const& ray, float max_distance, VoxelHit& hit) {
+	float length = std::sqrt(ray.m_dir[0] * ray.m_dir[0] + ray.m_dir[1] * ray.m_dir[1] + ray.m_dir[2] * ray.m_dir[2]);
+	if (!(length > 0.0f))
+		return false;
+
+	//t_max is the distance to the next voxel border along each axis,
+	//t_delta the distance between borders
+	int voxel[3], step[3];
+	float t_max[3], t_delta[3];
+	for (int i = 0; i < 3; ++i) {
+		float dir = ray.m_dir[i] / length;
+		float origin = std::floor(ray.m_pos[i]);
+		voxel[i] = int(origin);
+		if (dir > 0.0f) {
+			step[i] = 1;
+			t_delta[i] = 1.0f / dir;
+			t_max[i] = (origin + 1.0f - ray.m_pos[i]) * t_delta[i];
+		}
+		else if (dir < 0.0f) {
+			step[i] = -1;
+			t_delta[i] = -1.0f / dir;
+			t_max[i] = (ray.m_pos[i] - origin) * t_delta[i];
+		}
+		else {
+			step[i] = 0;
+			t_delta[i] = INFINITY;
+			t_max[i] = INFINITY;
+		}
+	}
+
+	float t = 0.0f;
+	//Axis of the last step, -1 before the first
+	int axis = -1;
+	int chunk_position[3] = { INT_MIN, INT_MIN, INT_MIN };
+	VoxelChunk const* chunk = nullptr;
+
+	for (;;) {
+		int position[3];
+		for (int i = 0; i < 3; ++i)
+			position[i] = voxel_chunk_coord(voxel[i], i);
+		if (!std::equal(position, position + 3, chunk_position)) {
+			std::copy(position, position + 3, chunk_position);
+			chunk = chunks.find(position[0], position[1], position[2]);
+		}
+
+		if (chunk && !(chunk->get_voxels().is_uniform() && chunk->get_voxels().get(0) == VoxelType::V_EMPTY)) {
+			//Walk voxel by voxel until the ray hits or leaves the chunk
+			auto const& voxels = chunk->get_voxels();
+			int local[3];
+			for (int i = 0; i < 3; ++i)
+				local[i] = voxel[i] - position[i] * VOXEL_CHUNK_SIZE[i];
+			for (;;) {
+				auto type = voxels.get(voxel_index(local[0], local[1], local[2]));
+				if (type != VoxelType::V_EMPTY) {
+					hit.voxel = { { voxel[0], voxel[1], voxel[2] } };
+					hit.type = type;
+					hit.normal = { { 0, 0, 0 } };
+					hit.face = NUM_FACES;
+					if (axis >= 0) {
+						//Stepping towards +x enters through the -x face, FACE_LEFT
+						hit.normal[axis] = -step[axis];
+						hit.face = VoxelFace(axis * 2 + (step[axis] > 0 ? 0 : 1));
+					}
+					hit.distance = t;
+					return true;
+				}
+
+				axis = min_axis(t_max);
+				t = t_max[axis];
+				if (t > max_distance)
+					return false;
+				voxel[axis] += step[axis];
+				local[axis] += step[axis];
+				t_max[axis] += t_delta[axis];
+				if (unsigned(local[axis]) >= unsigned(VOXEL_CHUNK_SIZE[axis]))
+					break;
+			}
+			continue;
+		}
+
+		//Nothing to hit in this chunk, jump to the first voxel past it. Along
+		//each axis the ray crosses crossings[i] borders to leave the chunk, the
+		//last of them at exit[i].
+		int crossings[3];
+		float exit[3];
+		for (int i = 0; i < 3; ++i) {
+			int first = position[i] * VOXEL_CHUNK_SIZE[i];
+			crossings[i] = step[i] > 0 ? first + VOXEL_CHUNK_SIZE[i] - voxel[i]
+				: step[i] < 0 ? voxel[i] - first + 1 : 0;
+			exit[i] = step[i] ? t_max[i] + t_delta[i] * float(crossings[i] - 1) : INFINITY;
+		}
+
+		axis = min_axis(exit);
+		t = exit[axis];
+		if (t > max_distance)
+			return false;
+		for (int i = 0; i < 3; ++i) {
+			//Borders of the other axes crossed before leaving, kept inside the chunk
+			int count = crossings[i];
+			if (i != axis)
+				count = t_max[i] < t ? std::min(int((t - t_max[i]) / t_delta[i]) + 1, crossings[i] - 1) : 0;
+			if (count) {
+				voxel[i] += step[i] * count;
+				t_max[i] += t_delta[i] * float(count);
+			}
+		}
+	}
+}
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "regionfile.hh"
+#include "chunkmap.hh"
+
+namespace fs = boost::filesystem;
+namespace bip = boost::interprocess;
+
+namespace {
+	const char REGION_MAGIC[4] = { 'V', 'B', 'R', 'G' };
+	const uint32_t REGION_VERSION = 1;
+}
+
+RegionFile::RegionFile(fs::path const& path, bool create)
+	: m_path(path) {
+
+	if (!fs::exists(path)) {
+		if (!create)
+			throw std::runtime_error("Missing region file " + path.string());
+
+		auto header = std::make_unique<Header>();
+		std::memcpy(header->magic, REGION_MAGIC, sizeof(REGION_MAGIC));
+		header->version = REGION_VERSION;
+		header->region_size = REGION_FILE_SIZE;
+		header->sector_size = SECTOR_SIZE;
+		header->entries.fill(Entry{ 0, 0 });
+
+		std::vector<char> sectors(HEADER_SECTORS * SECTOR_SIZE, 0);
+		std::memcpy(sectors.data(), header.get(), sizeof(Header));
+		std::ofstream out(path.string(), std::ios::binary);
+		if (!out.write(sectors.data(), sectors.size()))
+			throw std::runtime_error("Unable to create region file " + path.string());
+	}
+
+	m_file.open(path.string(), std::ios::in | std::ios::out | std::ios::binary);
+	if (!m_file)
+		throw std::runtime_error("Unable to open region file " + path.string());
+
+	map();
+	auto const* header = static_cast<Header const*>(m_region.get_address());
+	if (m_region.get_size() < sizeof(Header)
+		|| std::memcmp(header->magic, REGION_MAGIC, sizeof(REGION_MAGIC)) != 0
+		|| header->version != REGION_VERSION
+		|| header->region_size != uint32_t(REGION_FILE_SIZE)
+		|| header->sector_size != SECTOR_SIZE)
+		throw std::runtime_error("Not a region file " + path.string());
+
+	m_entries = header->entries;
+	m_num_sectors = std::max(uint32_t(HEADER_SECTORS), sector_count(uint32_t(m_region.get_size())));
+
+	//Whatever lies between the payloads is free
+	std::vector<Entry> used;
+	for (auto const& entry : m_entries)
+		if (entry.sector)
+			used.emplace_back(Entry{ entry.sector, sector_count(entry.size) });
+	std::sort(used.begin(), used.end(), [](Entry const& a, Entry const& b) { return a.sector < b.sector; });
+
+	uint32_t next = HEADER_SECTORS;
+	for (auto const& range : used) {
+		if (range.sector > next)
+			m_free.emplace_back(Entry{ next, range.sector - next });
+		next = std::max(next, range.sector + range.size);
+	}
+	if (next < m_num_sectors)
+		m_free.emplace_back(Entry{ next, m_num_sectors - next });
+}
+
+int RegionFile::entry_index(int x, int y, int z) {
+	assert(x >= 0 && x < REGION_FILE_SIZE);
+	assert(y >= 0 && y < REGION_FILE_SIZE);
+	assert(z >= 0 && z < REGION_FILE_SIZE);
+	return (z * REGION_FILE_SIZE + y) * REGION_FILE_SIZE + x;
+}
+
+void RegionFile::map() {
+	m_region = bip::mapped_region();
+	m_mapping.reset();
+	m_file.flush();
+	m_mapping = std::make_unique<bip::file_mapping>(m_path.string().c_str(), bip::read_only);
+	m_region = bip::mapped_region(*m_mapping, bip::read_only);
+}
+
+bool RegionFile::read(int x, int y, int z, PalettedVoxels& voxels) {
+	auto const& entry = m_entries[entry_index(x, y, z)];
+	if (!entry.sector)
+		return false;
+
+	auto begin = uint64_t(entry.sector) * SECTOR_SIZE;
+	if (!m_mapping || begin + entry.size > m_region.get_size())
+		map();
+	if (begin + entry.size > m_region.get_size())
+		return false;
+
+	auto const* data = static_cast<uint8_t const*>(m_region.get_address()) + begin;
+	return voxels.decode(data, entry.size);
+}
+
+void RegionFile::write(int x, int y, int z, std::vector<uint8_t> const& payload) {
+	auto index = entry_index(x, y, z);
+	auto& entry = m_entries[index];
+	auto size = uint32_t(payload.size());
+	auto count = sector_count(size);
+	auto old_count = entry.sector ? sector_count(entry.size) : 0;
+
+	if (old_count < count) {
+		//Allocated before the old sectors are freed so the payload never
+		//lands on them
+		auto sector = allocate_sectors(count);
+		if (entry.sector)
+			free_sectors(entry.sector, old_count);
+		entry.sector = sector;
+	}
+	else if (old_count > count) {
+		free_sectors(entry.sector + count, old_count - count);
+	}
+	entry.size = size;
+
+	//A mapped file can not grow on every platform
+	m_region = bip::mapped_region();
+	m_mapping.reset();
+
+	//Payload first, a crash in between leaves the old table entry valid
+	//unless the payload was rewritten in place
+	std::vector<char> padding(count * SECTOR_SIZE - size, 0);
+	m_file.seekp(std::streamoff(entry.sector) * SECTOR_SIZE);
+	m_file.write(reinterpret_cast<char const*>(payload.data()), size);
+	m_file.write(padding.data(), padding.size());
+	m_file.seekp(std::streamoff(offsetof(Header, entries) + index * sizeof(Entry)));
+	m_file.write(reinterpret_cast<char const*>(&entry), sizeof(Entry));
+	m_file.flush();
+	if (!m_file) {
+		m_file.clear();
+		throw std::runtime_error("Unable to write region file " + m_path.string());
+	}
+}
+
+uint32_t RegionFile::allocate_sectors(uint32_t count) {
+	for (auto range = m_free.begin(); range != m_free.end(); ++range) {
+		if (range->size < count)
+			continue;
+		auto sector = range->sector;
+		range->sector += count;
+		range->size -= count;
+		if (!range->size)
+			m_free.erase(range);
+		return sector;
+	}
+
+	auto sector = m_num_sectors;
+	m_num_sectors += count;
+	return sector;
+}
+
+void RegionFile::free_sectors(uint32_t sector, uint32_t count) {
+	auto next = std::lower_bound(m_free.begin(), m_free.end(), sector,
+		[](Entry const& range, uint32_t sector) { return range.sector < sector; });
+	next = m_free.insert(next, Entry{ sector, count });
+	if (next + 1 != m_free.end() && next->sector + next->size == (next + 1)->sector) {
+		next->size += (next + 1)->size;
+		m_free.erase(next + 1);
+	}
+	if (next != m_free.begin() && (next - 1)->sector + (next - 1)->size == next->sector) {
+		(next - 1)->size += next->size;
+		m_free.erase(next);
+	}
+}
+
+RegionStore::RegionStore(fs::path directory)
+	: m_directory(std::move(directory)) {
+	fs::create_directories(m_directory);
+}
+
+RegionFile* RegionStore::open(int x, int y, int z, bool create) {
+	const int shift = RegionFile::REGION_FILE_SHIFT;
+	auto key = ChunkMap::pack_key(x >> shift, y >> shift, z >> shift);
+	auto found = m_files.find(key);
+	if (found != m_files.end() && (found->second || !create))
+		return found->second.get();
+
+	auto name = "r." + std::to_string(x >> shift) + "." + std::to_string(y >> shift)
+		+ "." + std::to_string(z >> shift) + ".vbr";
+	auto path = m_directory / name;
+	std::unique_ptr<RegionFile> file;
+	if (create || fs::exists(path))
+		file = std::make_unique<RegionFile>(path, create);
+
+	auto* result = file.get();
+	m_files[key] = std::move(file);
+	return result;
+}
+
+bool RegionStore::load(int x, int y, int z, PalettedVoxels& voxels) {
+	const int mask = RegionFile::REGION_FILE_SIZE - 1;
+	try {
+		auto* file = open(x, y, z, false);
+		return file && file->read(x & mask, y & mask, z & mask, voxels);
+	}
+	catch (std::exception const&) {
+		//Chunks of an unreadable region file are generated again
+		return false;
+	}
+}
+
+void RegionStore::save(int x, int y, int z, PalettedVoxels const& voxels) {
+	const int mask = RegionFile::REGION_FILE_SIZE - 1;
+	m_payload.clear();
+	voxels.encode(m_payload);
+	try {
+		open(x, y, z, true)->write(x & mask, y & mask, z & mask, m_payload);
+	}
+	catch (std::exception const& e) {
+		std::fprintf(stderr, "Chunk %d %d %d not saved: %s\n", x, y, z, e.what());
+	}
+}
@@ -1,12 +1,22 @@
+#include <algorithm>
+#include <tuple>
 #include <boost/filesystem.hpp>
 #include "bgfx/bgfx.h"
 #include "bgfx_utils.h"
 #include "voxel.hh"
+#include "arena.hh"
+#include "chunkmap.hh"
 #include "common.h"
 #include "renderer.hh"
+#include "profiler.hh"
 
 namespace fs = boost::filesystem;
 
+namespace {
+	//Face records per instance, see PackedVoxelVertex::ms_record_decl
+	const uint32_t FACE_RECORDS_PER_INSTANCE = 2;
+}
+
 enum Material {
 	Rock,
 	Dirt,
@@ -32,62 +42,138 @@ void Renderer::init(fs::path data_path) {
 
 	load_texture_or_throw(m_texture_color,	"fieldstone-rgba.tga");
 	load_texture_or_throw(m_texture_normal, "fieldstone-n.tga");
-	load_shader_or_throw(m_bump_mapping_shader, "vs_bump", "fs_bump");
+	load_shader_or_throw(m_bump_mapping_shader, "vs_bump_packed", "fs_bump");
+
+	//Face records are decoded with integer ops, vs_voxel_instanced is not
+	//built for the renderers lacking them
+	const auto renderer = bgfx::getRendererType();
+	const bool integer_ops = renderer != bgfx::RendererType::Direct3D9 && renderer != bgfx::RendererType::OpenGLES;
+	if (integer_ops && bgfx::getCaps()->supported & BGFX_CAPS_INSTANCING) {
+		load_shader_or_throw(m_face_record_shader, "vs_voxel_instanced", "fs_bump");
+
+		//Quad corner and record of the instance, see vs_voxel_instanced
+		bgfx::VertexDecl decl;
+		decl.begin()
+			.add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Float)
+			.end();
+		const float corners[FACE_RECORDS_PER_INSTANCE * 4][2] = {
+			{ 0.0f, 0.0f }, { 1.0f, 0.0f }, { 2.0f, 0.0f }, { 3.0f, 0.0f },
+			{ 0.0f, 1.0f }, { 1.0f, 1.0f }, { 2.0f, 1.0f }, { 3.0f, 1.0f },
+		};
+		if (!m_face_corners.create(bgfx::copy(corners, sizeof(corners)), decl))
+			throw std::runtime_error("Unable to create face record corners.");
+	}
 
 	// Create texture sampler uniforms.
 	s_texColor.create("s_texColor", bgfx::UniformType::Int1);
 	s_texNormal.create("s_texNormal", bgfx::UniformType::Int1);
-	m_numLights = 4;
-	u_lightPosRadius.create("u_lightPosRadius", bgfx::UniformType::Vec4, m_numLights);
-	u_lightRgbInnerR.create("u_lightRgbInnerR", bgfx::UniformType::Vec4, m_numLights);
+	u_skyColor.create("u_skyColor", bgfx::UniformType::Vec4);
+	u_blockColor.create("u_blockColor", bgfx::UniformType::Vec4);
 }
 
 void Renderer::init_frame(float stime) {
-	float lightPosRadius[4][4];
-	for (uint32_t ii = 0; ii < m_numLights; ++ii)
-	{
-		lightPosRadius[ii][0] = bx::fsin((stime*(0.1f + ii*0.17f) + ii*bx::kPiHalf*1.37f))*3.0f;
-		lightPosRadius[ii][1] = bx::fcos((stime*(0.2f + ii*0.29f) + ii*bx::kPiHalf*1.49f))*3.0f;
-		lightPosRadius[ii][2] = -2.5f;
-		lightPosRadius[ii][3] = 3.0f;
-	}
-
-	bgfx::setUniform(u_lightPosRadius.handle(), lightPosRadius, m_numLights);
+	//Light levels are baked into the vertices by the LightEngine, only the
+	//colours they scale change here. Sky light follows a slow day, so night
+	//falls without relighting a single chunk.
+	const float DAY_SECONDS = 600.0f;
+	const float daylight = 0.6f + 0.4f * bx::fcos(stime * 2.0f * bx::kPi / DAY_SECONDS);
+	const float sky_color[4] = { 0.95f * daylight, 0.95f * daylight, daylight, 0.0f };
+	const float block_color[4] = { 1.0f, 0.8f, 0.55f, 0.0f };
+
+	bgfx::setUniform(u_skyColor.handle(), sky_color);
+	bgfx::setUniform(u_blockColor.handle(), block_color);
+}
 
-	float lightRgbInnerR[4][4] =
-	{
-		{ 1.0f, 0.7f, 0.2f, 0.8f },
-		{ 0.7f, 0.2f, 1.0f, 0.8f },
-		{ 0.2f, 1.0f, 0.7f, 0.8f },
-		{ 1.0f, 0.4f, 0.2f, 0.8f },
+uint32_t Renderer::render(std::vector<VoxelChunk const*> const& chunks, GeometryArena const& arena) {
+	PROFILE_ZONE(SubmitChunks);
+	struct Draw {
+		VoxelType type;
+		uint32_t page;
+		uint32_t start;
+		uint32_t count;
+		uint32_t capacity;
+		bool face_records;
 	};
 
-	bgfx::setUniform(u_lightRgbInnerR.handle(), lightRgbInnerR, m_numLights);
-}
+	std::vector<Draw> draws;
+	for (auto const* chunk : chunks) {
+		for (auto const& buffer : chunk->get_buffers()) {
+			for (auto const& part : buffer.second.parts) {
+				auto const& allocation = part.allocation;
+				if (!allocation.is_valid() || part.num_uploaded == 0)
+					continue;
+				draws.emplace_back(Draw{ buffer.first, allocation.page, allocation.start,
+					part.num_uploaded, allocation.capacity, arena.has_face_records(allocation.page) });
+			}
+		}
+	}
 
-void Renderer::render(VoxelChunk const& chunk) {
-	for (auto const& buffer : chunk.get_buffers()) {
-		switch (buffer.first) {
+	std::sort(draws.begin(), draws.end(), [](Draw const& a, Draw const& b) {
+		return std::tie(a.type, a.page, a.start) < std::tie(b.type, b.page, b.start);
+	});
+
+	const int size[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, VOXEL_CHUNK_DEPTH };
+	uint32_t submits = 0;
+	for (size_t i = 0; i < draws.size();) {
+		//Allocations back to back in a page draw as one range, the unused
+		//vertices at the end of each are zero and make degenerate quads
+		auto const& first = draws[i];
+		auto end = first.start + first.count;
+		auto next_start = first.start + first.capacity;
+		size_t j = i + 1;
+		for (; j < draws.size(); ++j) {
+			auto const& draw = draws[j];
+			if (draw.type != first.type || draw.page != first.page || draw.start != next_start)
+				break;
+			end = draw.start + draw.count;
+			next_start = draw.start + draw.capacity;
+		}
+		i = j;
+
+		int region[3];
+		ChunkMap::unpack_key(arena.get_page_region(first.page), region[0], region[1], region[2]);
+		float mtx[16];
+		bx::mtxTranslate(mtx,
+			float(region[0] * ChunkMap::REGION_SIZE * size[0]),
+			float(region[1] * ChunkMap::REGION_SIZE * size[1]),
+			float(region[2] * ChunkMap::REGION_SIZE * size[2]));
+
+		switch (first.type) {
 		case VoxelType::V_EMPTY:
 			break;
 		case VoxelType::V_DIRT:
-			render_rock(buffer.second.vertex_buffer, buffer.second.index_buffer);
-			break;
 		case VoxelType::V_ROCK:
-			break;
 		case VoxelType::V_GRASS:
+		case VoxelType::V_LAMP:
+			render_rock(arena.get_page_buffer(first.page), first.start, end - first.start,
+				first.face_records, arena.get_quad_indices(), mtx);
+			++submits;
 			break;
 		}
 	}
+	return submits;
 }
 
-void Renderer::render_rock(DynamicVertexBuffer const& vb, DynamicIndexBuffer const& ib) {
+void Renderer::render_rock(DynamicVertexBuffer const& vb, uint32_t first_vertex, uint32_t num_vertices,
+	bool face_records, IndexBuffer const& ib, float const* mtx) {
+	bgfx::setTransform(mtx);
+
 	// Bind textures.
 	bgfx::setTexture(0, s_texColor.handle(), m_texture_color.handle());
 	bgfx::setTexture(1, s_texNormal.handle(), m_texture_normal.handle());
 
-	bgfx::setVertexBuffer(0, vb.handle());
-	bgfx::setIndexBuffer(ib.handle());
+	if (face_records) {
+		//Record allocations hold whole pairs, a trailing unused record is zero
+		bgfx::setVertexBuffer(0, m_face_corners.handle());
+		bgfx::setIndexBuffer(ib.handle(), 0, FACE_RECORDS_PER_INSTANCE * 6);
+		bgfx::setInstanceDataBuffer(vb.handle(), first_vertex / FACE_RECORDS_PER_INSTANCE,
+			(num_vertices + FACE_RECORDS_PER_INSTANCE - 1) / FACE_RECORDS_PER_INSTANCE);
+	}
+	else {
+		//The shared quad indices start at 0, the vertex range moves them to the allocation
+		bgfx::setVertexBuffer(0, vb.handle(), first_vertex, num_vertices);
+		bgfx::setIndexBuffer(ib.handle(), 0, num_vertices / 4 * 6);
+	}
 
 	// Set render states.
 	bgfx::setState(0
@@ -99,5 +185,5 @@ void Renderer::render_rock(DynamicVertexBuffer const& vb, DynamicIndexBuffer con
 	);
 
 	// Submit primitive for rendering to view 0.
-	bgfx::submit(0, m_bump_mapping_shader.handle());
-}
\ No newline at end of file
+	bgfx::submit(0, face_records ? m_face_record_shader.handle() : m_bump_mapping_shader.handle());
+}
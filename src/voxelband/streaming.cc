@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "bx/timer.h"
+#include "streaming.hh"
+#include "profiler.hh"
+
+namespace {
+	//The queue is rebuilt when the view turns further than about 25 degrees
+	const float REBUILD_VIEW_COS = 0.9f;
+}
+
+ChunkStreamer::ChunkStreamer(Settings const& settings, uint32_t seed, RegionStore* store)
+	: m_settings(settings)
+	, m_generator(seed)
+	, m_store(store) {
+
+	m_settings.radius = std::max(m_settings.radius, 0);
+	m_settings.unload_margin = std::max(m_settings.unload_margin, 0);
+	m_settings.max_in_flight = std::max(m_settings.max_in_flight, 1u);
+	auto num_workers = std::max(m_settings.num_workers, 1u);
+	for (unsigned int i = 0; i < num_workers; ++i)
+		m_workers.emplace_back(start_thread("Stream worker " + std::to_string(i), [this]() { worker(); }));
+}
+
+ChunkStreamer::~ChunkStreamer() {
+	{
+		std::lock_guard<std::mutex> lock(m_job_mutex);
+		m_stopping = true;
+	}
+	m_job_ready.notify_all();
+
+	for (auto& thread : m_workers)
+		thread.join();
+}
+
+void ChunkStreamer::update(ChunkMap& chunks, float const* eye, float const* view_dir) {
+	PROFILE_ZONE(StreamChunks);
+	int camera[3];
+	for (int i = 0; i < 3; ++i)
+		camera[i] = voxel_chunk_coord(int(std::floor(eye[i])), i);
+
+	float dir[3] = { view_dir[0], view_dir[1], view_dir[2] };
+	float length = std::sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+	if (length > 0.0f) {
+		for (auto& d : dir)
+			d /= length;
+	}
+
+	bool moved = !m_has_camera || !std::equal(camera, camera + 3, m_camera);
+	bool turned = dir[0] * m_view_dir[0] + dir[1] * m_view_dir[1] + dir[2] * m_view_dir[2] < REBUILD_VIEW_COS;
+	if (moved || turned) {
+		m_has_camera = true;
+		std::copy(camera, camera + 3, m_camera);
+		std::copy(dir, dir + 3, m_view_dir);
+		if (moved)
+			unload(chunks);
+		rebuild_queue(chunks, dir);
+	}
+
+	insert_finished(chunks);
+	dispatch(chunks);
+}
+
+bool ChunkStreamer::in_radius(int x, int y, int z, int radius) const {
+	int dx = x - m_camera[0];
+	int dy = y - m_camera[1];
+	int dz = z - m_camera[2];
+	return dx * dx + dy * dy + dz * dz <= radius * radius;
+}
+
+void ChunkStreamer::rebuild_queue(ChunkMap& chunks, float const* view_dir) {
+	const int radius = m_settings.radius;
+	m_queue.clear();
+	for (int dz = -radius; dz <= radius; ++dz) {
+		for (int dy = -radius; dy <= radius; ++dy) {
+			for (int dx = -radius; dx <= radius; ++dx) {
+				int x = m_camera[0] + dx;
+				int y = m_camera[1] + dy;
+				int z = m_camera[2] + dz;
+				if (!in_radius(x, y, z, radius) || chunks.find(x, y, z)
+					|| m_in_flight.count(ChunkMap::pack_key(x, y, z)))
+					continue;
+
+				//Distance scaled by 1 straight ahead up to 3 straight behind
+				float distance = std::sqrt(float(dx * dx + dy * dy + dz * dz));
+				float facing = distance > 0.0f
+					? (dx * view_dir[0] + dy * view_dir[1] + dz * view_dir[2]) / distance : 1.0f;
+				m_queue.emplace_back(Request{ x, y, z, distance * (2.0f - facing) });
+			}
+		}
+	}
+
+	std::sort(m_queue.begin(), m_queue.end(), [](Request const& a, Request const& b) {
+		return a.priority > b.priority;
+	});
+}
+
+void ChunkStreamer::unload(ChunkMap& chunks) {
+	const int radius = m_settings.radius + m_settings.unload_margin;
+	std::vector<std::array<int, 3>> far;
+	chunks.for_each([&](int x, int y, int z, VoxelChunk& chunk) {
+		if (in_radius(x, y, z, radius))
+			return;
+
+		far.emplace_back(std::array<int, 3>{ { x, y, z } });
+		if (m_store && chunk.is_modified()) {
+			auto job = std::make_unique<Job>();
+			job->x = x;
+			job->y = y;
+			job->z = z;
+			job->save = true;
+			job->voxels = chunk.get_voxels();
+			m_saving.insert(ChunkMap::pack_key(x, y, z));
+			push_job(std::move(job));
+		}
+	});
+
+	for (auto const& position : far)
+		chunks.erase(position[0], position[1], position[2]);
+}
+
+void ChunkStreamer::dispatch(ChunkMap& chunks) {
+	//Chunks whose save was still queued when they came back into range
+	for (auto request = m_deferred.begin(); request != m_deferred.end();) {
+		if (m_in_flight.size() >= m_settings.max_in_flight)
+			return;
+
+		auto key = ChunkMap::pack_key(request->x, request->y, request->z);
+		if (m_saving.count(key)) {
+			++request;
+			continue;
+		}
+
+		if (in_radius(request->x, request->y, request->z, m_settings.radius)
+			&& !chunks.find(request->x, request->y, request->z) && !m_in_flight.count(key)) {
+			auto job = std::make_unique<Job>();
+			job->x = request->x;
+			job->y = request->y;
+			job->z = request->z;
+			m_in_flight.insert(key);
+			push_job(std::move(job));
+		}
+		request = m_deferred.erase(request);
+	}
+
+	while (!m_queue.empty() && m_in_flight.size() < m_settings.max_in_flight) {
+		auto request = m_queue.back();
+		m_queue.pop_back();
+
+		auto key = ChunkMap::pack_key(request.x, request.y, request.z);
+		if (chunks.find(request.x, request.y, request.z) || m_in_flight.count(key))
+			continue;
+		if (m_saving.count(key)) {
+			m_deferred.emplace_back(request);
+			continue;
+		}
+
+		auto job = std::make_unique<Job>();
+		job->x = request.x;
+		job->y = request.y;
+		job->z = request.z;
+		m_in_flight.insert(key);
+		push_job(std::move(job));
+	}
+}
+
+void ChunkStreamer::insert_finished(ChunkMap& chunks) {
+	const int64_t start = bx::getHPCounter();
+	const int64_t budget = int64_t(m_settings.budget_ms * double(bx::getHPFrequency()) / 1000.0);
+	const int unload_radius = m_settings.radius + m_settings.unload_margin;
+
+	while (auto job = pop_result()) {
+		auto key = ChunkMap::pack_key(job->x, job->y, job->z);
+		if (job->save) {
+			m_saving.erase(key);
+			continue;
+		}
+
+		//The camera may have moved away while the chunk was loading
+		m_in_flight.erase(key);
+		if (in_radius(job->x, job->y, job->z, unload_radius) && !chunks.find(job->x, job->y, job->z)) {
+			VoxelChunk chunk;
+			chunk.set_meshing_mode(m_settings.meshing_mode);
+			chunk.set_voxels(std::move(job->voxels));
+			chunks.insert(job->x, job->y, job->z, std::move(chunk));
+		}
+
+		if (bx::getHPCounter() - start >= budget)
+			break;
+	}
+}
+
+void ChunkStreamer::push_job(std::unique_ptr<Job> job) {
+	{
+		std::lock_guard<std::mutex> lock(m_job_mutex);
+		m_jobs.emplace_back(std::move(job));
+	}
+	m_job_ready.notify_one();
+}
+
+std::unique_ptr<ChunkStreamer::Job> ChunkStreamer::pop_result() {
+	std::lock_guard<std::mutex> lock(m_result_mutex);
+	if (m_results.empty())
+		return nullptr;
+
+	auto job = std::move(m_results.front());
+	m_results.pop_front();
+	return job;
+}
+
+void ChunkStreamer::worker() {
+	for (;;) {
+		std::unique_ptr<Job> job;
+		{
+			std::unique_lock<std::mutex> lock(m_job_mutex);
+			m_job_ready.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+			//Queued saves are still written when stopping
+			if (m_jobs.empty())
+				return;
+
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+			if (m_stopping && !job->save)
+				continue;
+		}
+
+		if (job->save) {
+			{
+				PROFILE_ZONE(SaveChunk);
+				std::lock_guard<std::mutex> lock(m_store_mutex);
+				m_store->save(job->x, job->y, job->z, job->voxels);
+			}
+			job->voxels = PalettedVoxels{};
+		}
+		else {
+			bool loaded = false;
+			if (m_store) {
+				PROFILE_ZONE(LoadChunk);
+				std::lock_guard<std::mutex> lock(m_store_mutex);
+				loaded = m_store->load(job->x, job->y, job->z, job->voxels);
+			}
+			if (!loaded) {
+				PROFILE_ZONE(GenerateChunk);
+				m_generator.generate(job->x, job->y, job->z, job->voxels);
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(m_result_mutex);
+		m_results.emplace_back(std::move(job));
+	}
+}
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "terrain.hh"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	include <emmintrin.h>
+#	define VOXELBAND_TERRAIN_SSE2 1
+#endif
+
+namespace {
+	//The first octave has cells of 2^BASE_CELL_SHIFT voxels, every further
+	//octave halves them
+	const int BASE_CELL_SHIFT = 7;
+	const int NUM_OCTAVES = 5;
+	//Samples are evaluated four at a time from one noise cell, chunk columns
+	//start on cell borders
+	const int LANES = 4;
+	static_assert((1 << (BASE_CELL_SHIFT - NUM_OCTAVES + 1)) % LANES == 0, "Noise cells narrower than the lanes");
+	static_assert(VOXEL_CHUNK_WIDTH % LANES == 0, "Chunk width not a multiple of the lanes");
+
+	const float GRADIENTS[8][2] = {
+		{ 1.0f, 1.0f }, { -1.0f, 1.0f }, { 1.0f, -1.0f }, { -1.0f, -1.0f },
+		{ 1.0f, 0.0f }, { -1.0f, 0.0f }, { 0.0f, 1.0f }, { 0.0f, -1.0f },
+	};
+
+	uint32_t hash(int x, int z, uint32_t seed) {
+		uint32_t h = seed ^ (uint32_t(x) * 0x27d4eb2du) ^ (uint32_t(z) * 0x165667b1u);
+		h ^= h >> 15;
+		h *= 0x85ebca6bu;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h;
+	}
+
+	float fade(float t) {
+		return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+	}
+
+	//Add amplitude times one octave of gradient noise with cells of 2^shift
+	//voxels to the sums of the column starting at voxel x0, z0
+	void add_octave(int x0, int z0, int shift, uint32_t seed, float amplitude, float* sums) {
+		const int cell_mask = (1 << shift) - 1;
+		const float inv_cell = 1.0f / float(1 << shift);
+
+		for (int vz = 0; vz < VOXEL_CHUNK_DEPTH; ++vz) {
+			const int z = z0 + vz;
+			const int cz = z >> shift;
+			const float dz = float(z & cell_mask) * inv_cell;
+			const float v = fade(dz);
+			float* row = sums + vz * VOXEL_CHUNK_WIDTH;
+
+			//Corner gradient terms of the current cell, n = a + g * dx
+			int cx = INT32_MIN;
+			float a[4] = {}, g[4] = {};
+			for (int vx = 0; vx < VOXEL_CHUNK_WIDTH; vx += LANES) {
+				const int x = x0 + vx;
+				if (x >> shift != cx) {
+					cx = x >> shift;
+					auto const* g00 = GRADIENTS[hash(cx, cz, seed) & 7];
+					auto const* g10 = GRADIENTS[hash(cx + 1, cz, seed) & 7];
+					auto const* g01 = GRADIENTS[hash(cx, cz + 1, seed) & 7];
+					auto const* g11 = GRADIENTS[hash(cx + 1, cz + 1, seed) & 7];
+					a[0] = g00[1] * dz;
+					a[1] = g10[1] * dz - g10[0];
+					a[2] = g01[1] * (dz - 1.0f);
+					a[3] = g11[1] * (dz - 1.0f) - g11[0];
+					g[0] = g00[0];
+					g[1] = g10[0];
+					g[2] = g01[0];
+					g[3] = g11[0];
+				}
+				const float dx0 = float(x & cell_mask) * inv_cell;
+
+#if defined(VOXELBAND_TERRAIN_SSE2)
+				const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+				__m128 dx = _mm_add_ps(_mm_set1_ps(dx0), _mm_mul_ps(lanes, _mm_set1_ps(inv_cell)));
+				__m128 u = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(dx, dx), dx), _mm_add_ps(_mm_mul_ps(dx,
+					_mm_sub_ps(_mm_mul_ps(dx, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f)));
+				__m128 n00 = _mm_add_ps(_mm_set1_ps(a[0]), _mm_mul_ps(_mm_set1_ps(g[0]), dx));
+				__m128 n10 = _mm_add_ps(_mm_set1_ps(a[1]), _mm_mul_ps(_mm_set1_ps(g[1]), dx));
+				__m128 n01 = _mm_add_ps(_mm_set1_ps(a[2]), _mm_mul_ps(_mm_set1_ps(g[2]), dx));
+				__m128 n11 = _mm_add_ps(_mm_set1_ps(a[3]), _mm_mul_ps(_mm_set1_ps(g[3]), dx));
+				__m128 n0 = _mm_add_ps(n00, _mm_mul_ps(_mm_sub_ps(n10, n00), u));
+				__m128 n1 = _mm_add_ps(n01, _mm_mul_ps(_mm_sub_ps(n11, n01), u));
+				__m128 n = _mm_add_ps(n0, _mm_mul_ps(_mm_sub_ps(n1, n0), _mm_set1_ps(v)));
+				_mm_storeu_ps(row + vx, _mm_add_ps(_mm_loadu_ps(row + vx), _mm_mul_ps(n, _mm_set1_ps(amplitude))));
+#else
+				for (int lane = 0; lane < LANES; ++lane) {
+					float dx = dx0 + float(lane) * inv_cell;
+					float u = fade(dx);
+					float n0 = a[0] + g[0] * dx;
+					n0 += (a[1] + g[1] * dx - n0) * u;
+					float n1 = a[2] + g[2] * dx;
+					n1 += (a[3] + g[3] * dx - n1) * u;
+					row[vx + lane] += (n0 + (n1 - n0) * v) * amplitude;
+				}
+#endif
+			}
+		}
+	}
+}
+
+TerrainGenerator::TerrainGenerator(uint32_t seed)
+	: m_seed(seed) {
+}
+
+std::shared_ptr<TerrainGenerator::Column const> TerrainGenerator::make_column(int x, int z) const {
+	std::array<float, VOXEL_CHUNK_WIDTH * VOXEL_CHUNK_DEPTH> sums = {};
+	float amplitude = 0.5f;
+	for (int octave = 0; octave < NUM_OCTAVES; ++octave) {
+		add_octave(x * VOXEL_CHUNK_WIDTH, z * VOXEL_CHUNK_DEPTH, BASE_CELL_SHIFT - octave,
+			m_seed + uint32_t(octave) * 0x9e3779b9u, amplitude, sums.data());
+		amplitude *= 0.5f;
+	}
+
+	auto column = std::make_shared<Column>();
+	column->min_height = BASE_HEIGHT + AMPLITUDE;
+	column->max_height = BASE_HEIGHT - AMPLITUDE;
+	for (size_t i = 0; i < sums.size(); ++i) {
+		int height = BASE_HEIGHT + int(std::floor(sums[i] * AMPLITUDE));
+		height = std::min(std::max(height, BASE_HEIGHT - AMPLITUDE), BASE_HEIGHT + AMPLITUDE);
+		column->heights[i] = int16_t(height);
+		column->min_height = std::min(column->min_height, height);
+		column->max_height = std::max(column->max_height, height);
+	}
+	return column;
+}
+
+std::shared_ptr<TerrainGenerator::Column const> TerrainGenerator::get_column(int x, int z) const {
+	const uint64_t key = (uint64_t(uint32_t(x)) << 32) | uint32_t(z);
+	{
+		std::lock_guard<std::mutex> lock(m_column_mutex);
+		auto found = m_columns.find(key);
+		if (found != m_columns.end())
+			return found->second;
+	}
+
+	//Threads racing for a column build the same heights, the first one is kept
+	auto column = make_column(x, z);
+
+	std::lock_guard<std::mutex> lock(m_column_mutex);
+	auto inserted = m_columns.emplace(key, std::move(column));
+	if (inserted.second) {
+		m_column_order.emplace_back(key);
+		if (m_column_order.size() > MAX_CACHED_COLUMNS) {
+			m_columns.erase(m_column_order.front());
+			m_column_order.pop_front();
+		}
+	}
+	return inserted.first->second;
+}
+
+void TerrainGenerator::generate(int x, int y, int z, PalettedVoxels& voxels) const {
+	const int bottom = y * VOXEL_CHUNK_HEIGHT;
+	const int top = bottom + VOXEL_CHUNK_HEIGHT;
+
+	//Chunks wholly above or below the surface range skip the height map
+	if (bottom >= BASE_HEIGHT + AMPLITUDE) {
+		voxels.fill(VoxelType::V_EMPTY);
+		return;
+	}
+	if (top <= BASE_HEIGHT - AMPLITUDE - 1 - DIRT_DEPTH) {
+		voxels.fill(VoxelType::V_ROCK);
+		return;
+	}
+
+	auto column = get_column(x, z);
+	if (bottom >= column->max_height) {
+		voxels.fill(VoxelType::V_EMPTY);
+		return;
+	}
+	if (top <= column->min_height - 1 - DIRT_DEPTH) {
+		voxels.fill(VoxelType::V_ROCK);
+		return;
+	}
+
+	std::vector<VoxelType> out(NUM_VOXELS);
+	for (int vz = 0; vz < VOXEL_CHUNK_DEPTH; ++vz) {
+		auto const* heights = column->heights.data() + vz * VOXEL_CHUNK_WIDTH;
+		for (int vy = 0; vy < VOXEL_CHUNK_HEIGHT; ++vy) {
+			const int wy = bottom + vy;
+			auto* row = out.data() + (vz * VOXEL_CHUNK_HEIGHT + vy) * VOXEL_CHUNK_WIDTH;
+			for (int vx = 0; vx < VOXEL_CHUNK_WIDTH; ++vx) {
+				const int surface = heights[vx];
+				row[vx] = wy >= surface ? VoxelType::V_EMPTY
+					: wy == surface - 1 ? VoxelType::V_GRASS
+					: wy >= surface - 1 - DIRT_DEPTH ? VoxelType::V_DIRT
+					: VoxelType::V_ROCK;
+			}
+		}
+	}
+	voxels.pack(out.data());
+}
@@ -1,10 +1,17 @@
 #include <iostream>
-#include <variant>
+#include <algorithm>
+#include <atomic>
 #include <boost/filesystem.hpp>
 
 #include "bgfx/bgfx.h"
+#include "bx/uint32_t.h"
 #include "bgfx_utils.h"
 #include "voxel.hh"
+#include "facemask.hh"
+#include "mesher.hh"
+#include "chunkmap.hh"
+#include "arena.hh"
+#include "profiler.hh"
 
 static const uint16_t s_cubeTriList[] =
 {
@@ -39,12 +46,337 @@ static const uint16_t s_cubeTriStrip[] =
 	5,
 };
 
+namespace {
+	//Narrowest index width holding palette_size entries
+	unsigned int palette_bits(size_t palette_size) {
+		for (unsigned int bits : { 0u, 1u, 2u, 4u, 8u })
+			if (palette_size <= (size_t(1) << bits))
+				return bits;
+		return 16;
+	}
+
+	//Every index of a word set to value
+	uint64_t repeat_index(uint32_t value, unsigned int bits) {
+		return uint64_t(value) * (~uint64_t(0) / ((uint64_t(1) << bits) - 1));
+	}
+
+	void put_varint(std::vector<uint8_t>& out, uint32_t value) {
+		while (value >= 0x80) {
+			out.emplace_back(uint8_t(value | 0x80));
+			value >>= 7;
+		}
+		out.emplace_back(uint8_t(value));
+	}
+
+	bool get_varint(uint8_t const*& data, uint8_t const* end, uint32_t& value) {
+		value = 0;
+		for (int shift = 0; shift < 35 && data != end; shift += 7) {
+			uint8_t byte = *data++;
+			value |= uint32_t(byte & 0x7f) << shift;
+			if (!(byte & 0x80))
+				return true;
+		}
+		return false;
+	}
+}
+
+static_assert(NUM_VOXELS <= (1 << 16), "A chunk never needs more than 16 bit palette indices");
+
+PalettedVoxels::PalettedVoxels() {
+	fill(VoxelType::V_EMPTY);
+}
+
+bool PalettedVoxels::set(unsigned int index, VoxelType voxel_type) {
+	assert(index < NUM_VOXELS);
+
+	uint32_t old_value = m_bits ? read(index) : 0;
+	if (m_palette[old_value] == voxel_type)
+		return false;
+
+	uint32_t value = palette_index(voxel_type);
+	--m_counts[old_value];
+	++m_counts[value];
+	write(index, value);
+
+	//Back to a single type, e.g. a chunk that was dug out completely
+	if (m_counts[value] == NUM_VOXELS)
+		fill(voxel_type);
+	return true;
+}
+
+void PalettedVoxels::fill(VoxelType voxel_type) {
+	m_palette.assign(1, voxel_type);
+	m_counts.assign(1, NUM_VOXELS);
+	m_words.clear();
+	m_words.shrink_to_fit();
+	m_bits = 0;
+}
+
+void PalettedVoxels::pack(VoxelType const* voxels) {
+	//Types below SMALL_TYPES are counted and looked up in tables, the rare
+	//larger ones search the palette
+	const unsigned int SMALL_TYPES = 256;
+	//Neighbouring voxels mostly share a type, counting them in separate
+	//tables keeps the increments independent
+	const unsigned int COUNT_TABLES = 4;
+	std::array<std::array<uint32_t, SMALL_TYPES>, COUNT_TABLES> partial_counts = {};
+	bool has_large = false;
+	for (unsigned int index = 0; index < NUM_VOXELS; ++index) {
+		auto type = unsigned(voxels[index]);
+		if (type < SMALL_TYPES)
+			++partial_counts[index % COUNT_TABLES][type];
+		else
+			has_large = true;
+	}
+	std::array<uint32_t, SMALL_TYPES> type_counts = {};
+	for (auto const& counts : partial_counts)
+		for (unsigned int type = 0; type < SMALL_TYPES; ++type)
+			type_counts[type] += counts[type];
+
+	m_palette.clear();
+	m_counts.clear();
+	std::array<uint32_t, SMALL_TYPES> lookup;
+	for (unsigned int type = 0; type < SMALL_TYPES; ++type) {
+		lookup[type] = uint32_t(m_palette.size());
+		if (type_counts[type]) {
+			m_palette.emplace_back(VoxelType(type));
+			m_counts.emplace_back(type_counts[type]);
+		}
+	}
+
+	auto large_index = [this](VoxelType type) {
+		auto found = std::find(m_palette.begin(), m_palette.end(), type);
+		if (found != m_palette.end())
+			return uint32_t(found - m_palette.begin());
+		m_palette.emplace_back(type);
+		m_counts.emplace_back(0);
+		return uint32_t(m_palette.size() - 1);
+	};
+	if (has_large) {
+		for (unsigned int index = 0; index < NUM_VOXELS; ++index) {
+			if (unsigned(voxels[index]) >= SMALL_TYPES)
+				++m_counts[large_index(voxels[index])];
+		}
+	}
+
+	m_bits = palette_bits(m_palette.size());
+	m_words.clear();
+	if (!m_bits) {
+		m_words.shrink_to_fit();
+		return;
+	}
+
+	const unsigned int per_word = 64 / m_bits;
+	m_words.resize(NUM_VOXELS / per_word);
+	for (size_t word = 0; word < m_words.size(); ++word) {
+		auto const* in = voxels + word * per_word;
+		uint64_t bits = 0;
+		for (unsigned int i = 0; i < per_word; ++i) {
+			auto type = unsigned(in[i]);
+			auto value = type < SMALL_TYPES ? lookup[type] : large_index(in[i]);
+			bits |= uint64_t(value) << (i * m_bits);
+		}
+		m_words[word] = bits;
+	}
+}
+
+void PalettedVoxels::unpack(VoxelType* out, unsigned int begin, unsigned int end) const {
+	assert(begin <= end && end <= NUM_VOXELS);
+
+	if (!m_bits) {
+		std::fill(out, out + (end - begin), m_palette[0]);
+		return;
+	}
+
+	for (unsigned int index = begin; index < end; ++index)
+		*out++ = m_palette[read(index)];
+}
+
+void PalettedVoxels::compact() {
+	std::vector<uint32_t> remap(m_palette.size(), 0);
+	std::vector<VoxelType> palette;
+	std::vector<uint32_t> counts;
+	for (size_t i = 0; i < m_palette.size(); ++i) {
+		if (!m_counts[i])
+			continue;
+		remap[i] = uint32_t(palette.size());
+		palette.emplace_back(m_palette[i]);
+		counts.emplace_back(m_counts[i]);
+	}
+
+	auto bits = palette_bits(palette.size());
+	if (palette.size() == m_palette.size() && bits == m_bits)
+		return;
+
+	repack(bits, remap);
+	m_palette = std::move(palette);
+	m_counts = std::move(counts);
+	m_palette.shrink_to_fit();
+	m_counts.shrink_to_fit();
+}
+
+size_t PalettedVoxels::memory_usage() const {
+	return sizeof(*this)
+		+ m_palette.capacity() * sizeof(VoxelType)
+		+ m_counts.capacity() * sizeof(uint32_t)
+		+ m_words.capacity() * sizeof(uint64_t);
+}
+
+//Palette size, palette, then (run length, index) pairs covering every voxel,
+//all as LEB128 varints. Runs skip whole words of one index at a time.
+void PalettedVoxels::encode(std::vector<uint8_t>& out) const {
+	put_varint(out, uint32_t(m_palette.size()));
+	for (auto type : m_palette)
+		put_varint(out, uint32_t(type));
+	if (!m_bits)
+		return;
+
+	const unsigned int per_word = 64 / m_bits;
+	uint32_t value = read(0);
+	uint32_t run = 0;
+	unsigned int index = 0;
+	while (index < NUM_VOXELS) {
+		if (index % per_word == 0 && m_words[index / per_word] == repeat_index(value, m_bits)) {
+			run += per_word;
+			index += per_word;
+			continue;
+		}
+
+		auto next = read(index);
+		if (next != value) {
+			put_varint(out, run);
+			put_varint(out, value);
+			value = next;
+			run = 0;
+		}
+		++run;
+		++index;
+	}
+	put_varint(out, run);
+	put_varint(out, value);
+}
+
+bool PalettedVoxels::decode(uint8_t const* data, size_t size) {
+	auto const* end = data + size;
+	auto fail = [this] {
+		fill(VoxelType::V_EMPTY);
+		return false;
+	};
+
+	uint32_t palette_size;
+	if (!get_varint(data, end, palette_size) || palette_size == 0 || palette_size > NUM_VOXEL_TYPES)
+		return fail();
+	m_palette.resize(palette_size);
+	for (uint32_t i = 0; i < palette_size; ++i) {
+		uint32_t value;
+		if (!get_varint(data, end, value) || value >= NUM_VOXEL_TYPES)
+			return fail();
+		m_palette[i] = VoxelType(value);
+		if (std::find(m_palette.begin(), m_palette.begin() + i, m_palette[i]) != m_palette.begin() + i)
+			return fail();
+	}
+
+	m_counts.assign(palette_size, 0);
+	m_bits = palette_bits(palette_size);
+	if (!m_bits) {
+		if (data != end)
+			return fail();
+		m_counts[0] = NUM_VOXELS;
+		m_words.clear();
+		return true;
+	}
+
+	m_words.assign(NUM_VOXELS * m_bits / 64, 0);
+	const unsigned int per_word = 64 / m_bits;
+	unsigned int index = 0;
+	while (index < NUM_VOXELS) {
+		uint32_t run, value;
+		if (!get_varint(data, end, run) || !get_varint(data, end, value)
+			|| run == 0 || run > NUM_VOXELS - index || value >= palette_size)
+			return fail();
+
+		m_counts[value] += run;
+		auto run_end = index + run;
+		for (; index < run_end && index % per_word; ++index)
+			write(index, value);
+		auto pattern = repeat_index(value, m_bits);
+		for (; index + per_word <= run_end; index += per_word)
+			m_words[index / per_word] = pattern;
+		for (; index < run_end; ++index)
+			write(index, value);
+	}
+	//Runs covered the chunk exactly, anything after them is not ours
+	if (data != end)
+		return fail();
+	return true;
+}
+
+void PalettedVoxels::write(unsigned int index, uint32_t value) {
+	auto bit = index * m_bits;
+	auto mask = uint64_t((1u << m_bits) - 1) << (bit % 64);
+	auto& word = m_words[bit / 64];
+	word = (word & ~mask) | (uint64_t(value) << (bit % 64));
+}
+
+uint32_t PalettedVoxels::palette_index(VoxelType voxel_type) {
+	uint32_t free_entry = UINT32_MAX;
+	for (uint32_t i = 0; i < m_palette.size(); ++i) {
+		if (m_palette[i] == voxel_type)
+			return i;
+		if (!m_counts[i] && free_entry == UINT32_MAX)
+			free_entry = i;
+	}
+
+	if (free_entry != UINT32_MAX) {
+		m_palette[free_entry] = voxel_type;
+		return free_entry;
+	}
+
+	auto bits = palette_bits(m_palette.size() + 1);
+	if (bits != m_bits) {
+		std::vector<uint32_t> remap(m_palette.size());
+		for (uint32_t i = 0; i < remap.size(); ++i)
+			remap[i] = i;
+		repack(bits, remap);
+	}
+
+	m_palette.emplace_back(voxel_type);
+	m_counts.emplace_back(0);
+	return uint32_t(m_palette.size() - 1);
+}
+
+//Re-encode every index through remap at a new width
+void PalettedVoxels::repack(unsigned int bits, std::vector<uint32_t> const& remap) {
+	if (!bits) {
+		m_words.clear();
+		m_words.shrink_to_fit();
+		m_bits = 0;
+		return;
+	}
+
+	std::vector<uint64_t> words(NUM_VOXELS * bits / 64, 0);
+	for (unsigned int index = 0; index < NUM_VOXELS; ++index) {
+		auto bit = index * bits;
+		words[bit / 64] |= uint64_t(remap[m_bits ? read(index) : 0]) << (bit % 64);
+	}
+
+	m_words = std::move(words);
+	m_bits = bits;
+}
+
 VoxelChunk::VoxelChunk()
+	: m_generation(new_generation())
 {
 }
 
+uint64_t VoxelChunk::new_generation() {
+	static std::atomic<uint64_t> next(1);
+	return next++;
+}
+
 
 VoxelChunk::~VoxelChunk() {
+	release_geometry();
 }
 
 bool solid_block(VoxelType block_type) {
@@ -57,109 +389,155 @@ bool solid_block(VoxelType* block_type) {
 	return solid_block(*block_type);
 }
 
-struct Normal { float x, y, z; Normal(float ix, float iy, float iz) : x(ix), y(iy), z(iz) { } };
-struct FrontNormal : Normal {	FrontNormal()	: Normal(0.0f,	0.0f,	-1.0f)	{} };
-struct BackNormal : Normal {	BackNormal()	: Normal(0.0f,	0.0f,	 1.0f)	{} };
-struct LeftNormal : Normal {	LeftNormal()	: Normal(-1.0f, 0.0f,	 0.0f)  {} };
-struct RightNormal : Normal {	RightNormal()	: Normal(1.0f,	0.0f,	 0.0f)	{} };
-struct UpNormal : Normal {		UpNormal()		: Normal(0.0f,	1.0f,	 0.0f)  {} };
-struct DownNormal : Normal {	DownNormal()	: Normal(0.0f, -1.0f,	 0.0f)  {} };
-
-using NormalDirection = std::variant<
-	FrontNormal,
-	BackNormal,
-	LeftNormal,
-	RightNormal,
-	UpNormal,
-	DownNormal
->;
-
-uint32_t get_normal(NormalDirection direction) {
-	return std::visit([](Normal const& n) {return encodeNormalRgba8(n.x, n.y, n.z); }, direction);
+//Arena allocations grow with headroom so single block edits can be uploaded in place
+uint32_t grow_capacity(uint32_t num_vertices) {
+	const uint32_t granularity = 256;
+	auto capacity = num_vertices + num_vertices / 2;
+	return (capacity + granularity - 1) / granularity * granularity;
 }
 
-PosNormalTangentTexcoordVertex make_vertex(
-	unsigned int x, unsigned int y, unsigned int z, 
-	NormalDirection normal,
-	int16_t u, int16_t v) {
-	return PosNormalTangentTexcoordVertex{ float(x), float(y), float(z), get_normal(normal), 0, u, v };
+void VoxelChunk::gather_borders(
+	ChunkBorders& borders,
+	int lod,
+	VoxelChunk const* left,
+	VoxelChunk const* right,
+	VoxelChunk const* above,
+	VoxelChunk const* below,
+	VoxelChunk const* front,
+	VoxelChunk const* back) {
+
+	VoxelType row[VOXEL_CHUNK_WIDTH];
+	auto row_of = [&row](VoxelChunk const* chunk, int y, int z) {
+		auto begin = unsigned(z * VOXEL_SLICE_SIZE + y * VOXEL_CHUNK_WIDTH);
+		chunk->m_voxel.unpack(row, begin, begin + VOXEL_CHUNK_WIDTH);
+		return static_cast<VoxelType const*>(row);
+	};
+
+	//A missing neighbour chunk hides the faces bordering it
+	const uint32_t all_solid = ~0u;
+
+	//Missing and uniform neighbours have the same bits in every word.
+	//Uniform chunks look the same at every level of detail, other neighbours
+	//match this chunk's surface when both are at the same level and are
+	//sampled downsampled as they are meshed. Where the level changes the
+	//neighbour borders on air, so both sides emit skirt walls that close the
+	//cracks between their surfaces.
+	auto uniform_bits = [all_solid, lod](VoxelChunk const* chunk, uint32_t& bits) {
+		if (chunk && !chunk->m_voxel.is_uniform()) {
+			if (chunk->m_lod == lod)
+				return false;
+			bits = 0;
+			return true;
+		}
+		bits = !chunk || solid_block(chunk->m_voxel.get(0)) ? all_solid : 0;
+		return true;
+	};
+
+	//The words of every border are laid out as downsample_border fills them
+	auto gather_downsampled = [lod](auto& words, VoxelChunk const* chunk, VoxelFace facing) {
+		static_assert(sizeof(words) == VOXEL_CHUNK_WIDTH * sizeof(uint32_t), "Border planes are one word per row");
+		downsample_border(chunk->m_voxel, facing, lod, words.data());
+	};
+
+	uint32_t bits;
+	if (uniform_bits(below, bits))
+		borders.below.fill(bits);
+	else if (lod > 0)
+		gather_downsampled(borders.below, below, FACE_TOP);
+	else for (int z = 0; z < VOXEL_CHUNK_DEPTH; ++z)
+		borders.below[z] = pack_solid_row(row_of(below, VOXEL_CHUNK_HEIGHT - 1, z));
+
+	if (uniform_bits(above, bits))
+		borders.above.fill(bits);
+	else if (lod > 0)
+		gather_downsampled(borders.above, above, FACE_BOTTOM);
+	else for (int z = 0; z < VOXEL_CHUNK_DEPTH; ++z)
+		borders.above[z] = pack_solid_row(row_of(above, 0, z));
+
+	if (uniform_bits(front, bits))
+		borders.front.fill(bits);
+	else if (lod > 0)
+		gather_downsampled(borders.front, front, FACE_BACK);
+	else for (int y = 0; y < VOXEL_CHUNK_HEIGHT; ++y)
+		borders.front[y] = pack_solid_row(row_of(front, y, VOXEL_CHUNK_DEPTH - 1));
+
+	if (uniform_bits(back, bits))
+		borders.back.fill(bits);
+	else if (lod > 0)
+		gather_downsampled(borders.back, back, FACE_FRONT);
+	else for (int y = 0; y < VOXEL_CHUNK_HEIGHT; ++y)
+		borders.back[y] = pack_solid_row(row_of(back, y, 0));
+
+	auto gather_column = [](auto& words, VoxelChunk const* chunk, unsigned int x) {
+		words.fill(0);
+		for (int z = 0; z < VOXEL_CHUNK_DEPTH; ++z) {
+			for (int y = 0; y < VOXEL_CHUNK_HEIGHT; ++y) {
+				int row = voxel_row(y, z);
+				words[row / 32] |= uint32_t(solid_block(chunk->get(x, y, z))) << (row % 32);
+			}
+		}
+	};
+
+	if (uniform_bits(left, bits))
+		borders.left.fill(bits);
+	else if (lod > 0)
+		gather_downsampled(borders.left, left, FACE_RIGHT);
+	else
+		gather_column(borders.left, left, VOXEL_CHUNK_WIDTH - 1);
+
+	if (uniform_bits(right, bits))
+		borders.right.fill(bits);
+	else if (lod > 0)
+		gather_downsampled(borders.right, right, FACE_LEFT);
+	else
+		gather_column(borders.right, right, 0);
+
+	//Faces against a missing neighbour are hidden, its light is never read
+	auto gather_light = [&borders](VoxelFace face, VoxelChunk const* chunk) {
+		auto& plane = borders.light[face];
+		if (!chunk || !chunk->m_light) {
+			plane.fill(UNLIT_LIGHT);
+			return;
+		}
+		auto const& levels = chunk->m_light->levels;
+		auto facing = opposite_face(face);
+		for (int b = 0; b < VOXEL_CHUNK_WIDTH; ++b)
+			for (int a = 0; a < VOXEL_CHUNK_WIDTH; ++a)
+				plane[b * VOXEL_CHUNK_WIDTH + a] = levels[border_voxel_index(facing, a, b)];
+	};
+	gather_light(FACE_LEFT, left);
+	gather_light(FACE_RIGHT, right);
+	gather_light(FACE_BOTTOM, below);
+	gather_light(FACE_TOP, above);
+	gather_light(FACE_FRONT, front);
+	gather_light(FACE_BACK, back);
 }
 
-auto add_vertex = [](auto &t, unsigned int x, unsigned int y, unsigned int z, NormalDirection normal, int16_t u, int16_t v) {
-	t.emplace_back(make_vertex( x, y, z, normal, u, v));
-};
-
-auto add_triangle = [] (auto& t, size_t base, unsigned int v1, unsigned int v2, unsigned int v3) {
-	t.emplace_back(uint16_t(base + v1));
-	t.emplace_back(uint16_t(base + v2));
-	t.emplace_back(uint16_t(base + v3));
-};
-
-auto add_left_face = [](auto& vertices, auto& indices, auto& index_base, auto x, auto y, auto z) {
-	add_vertex(vertices, x,		y + 1,	z + 1,	LeftNormal{},	0x7fff,		 0);
-	add_vertex(vertices, x,		y + 1,	z,		LeftNormal{},	0x7fff,	0x7fff);
-	add_vertex(vertices, x,		y,		z + 1,	LeftNormal{},	     0,		 0);
-	add_vertex(vertices, x,		y,		z,		LeftNormal{},		 0,	0x7fff);
-	add_triangle(indices, index_base, 0, 2, 1);
-	add_triangle(indices, index_base, 1, 2, 3);
-	index_base += 4;
-};
-
-auto add_right_face = [](auto& vertices, auto& indices, auto& index_base, auto x, auto y, auto z) {
-	add_vertex(vertices, x + 1, y + 1,	z + 1,	RightNormal{},	0x7fff,	     0);
-	add_vertex(vertices, x + 1, y + 1,	z,		RightNormal{},	0x7fff,	0x7fff);
-	add_vertex(vertices, x + 1, y,		z + 1,	RightNormal{},	     0,	     0);
-	add_vertex(vertices, x + 1, y,		z,		RightNormal{},	     0,	0x7fff);
-	add_triangle(indices, index_base, 0, 1, 2);
-	add_triangle(indices, index_base, 1, 3, 2);
-	index_base += 4;
-};
+void VoxelChunk::update_buffers(
+	VoxelChunk* left,
+	VoxelChunk* right,
+	VoxelChunk* above,
+	VoxelChunk* below,
+	VoxelChunk* front,
+	VoxelChunk* back) {
 
-auto add_bottom_face = [](auto& vertices, auto& indices, auto& index_base, auto x, auto y, auto z) {
-	auto n = indices.size();
-	add_vertex(vertices, x,		y,		z + 1,	DownNormal{},	     0,	     0);
-	add_vertex(vertices, x + 1, y,		z + 1,	DownNormal{},	0x7fff,	     0);
-	add_vertex(vertices, x,		y,		z,		DownNormal{},	     0,	0x7fff);
-	add_vertex(vertices, x + 1, y,		z,		DownNormal{},	0x7fff,	0x7fff);
-	add_triangle(indices, index_base, 0, 1, 2);
-	add_triangle(indices, index_base, 2, 1, 3);
-	index_base += 4;
-};
+	//Applying the pending result later would overwrite a newer mesh
+	if (!m_dirty_slabs || m_mesh_pending)
+		return;
 
-auto add_front_face = [](auto& vertices, auto& indices, auto& index_base, auto x, auto y, auto z) {
-	auto n = indices.size();
-	add_vertex(vertices,     x,	1 + y,	z,	FrontNormal{},	     0,	     0);
-	add_vertex(vertices,     x,	    y,	z,	FrontNormal{},	     0,	0x7fff);
-	add_vertex(vertices, 1 + x, 1 + y,	z,	FrontNormal{},	0x7fff,		 0);
-	add_vertex(vertices, 1 + x,     y,	z,	FrontNormal{},	0x7fff,	0x7fff);
-	add_triangle(indices, index_base, 0, 1, 2);
-	add_triangle(indices, index_base, 2, 1, 3);
-	index_base += 4;
-};
+	//Empty chunks have no faces whatever their neighbours hold
+	ChunkBorders borders;
+	if (!is_empty())
+		gather_borders(borders, m_lod, left, right, above, below, front, back);
 
-auto add_back_face = [](auto& vertices, auto& indices, auto& index_base, auto x, auto y, auto z) {
-	auto n = indices.size();
-	add_vertex(vertices,     x,	y + 1,	z + 1,	BackNormal{},	     0,	     0);
-	add_vertex(vertices, x + 1, y + 1,	z + 1,	BackNormal{},	0x7fff,	     0);
-	add_vertex(vertices,     x,	    y,	z + 1,	BackNormal{},	     0,	0x7fff);
-	add_vertex(vertices, x + 1,     y,	z + 1,	BackNormal{},	0x7fff,	0x7fff);
-	add_triangle(indices, index_base, 0, 1, 2);
-	add_triangle(indices, index_base, 3, 2, 1);
-	index_base += 4;
-};
+	ChunkMeshResult result;
+	mesh_chunk(m_voxel, borders, m_light.get(), m_meshing_mode, m_lod, m_dirty_slabs, result);
+	m_dirty_slabs = 0;
 
-auto add_top_face = [](auto& vertices, auto& indices, auto& index_base, auto x, auto y, auto z) {
-	auto n = indices.size();
-	add_vertex(vertices, x,		y + 1,	z,		UpNormal{},	     0,	0x7fff);
-	add_vertex(vertices, x + 1, y + 1,	z,		UpNormal{},	0x7fff,	0x7fff);
-	add_vertex(vertices, x + 1, y + 1,	z + 1,	UpNormal{},	0x7fff,	     0);
-	add_vertex(vertices, x,		y + 1,	z + 1,	UpNormal{},	     0,	     0);
-	add_triangle(indices, index_base, 0, 1, 2);
-	add_triangle(indices, index_base, 3, 0, 2);
-	index_base += 4;
-};
+	apply_mesh(result);
+}
 
-void VoxelChunk::update_buffers(
+std::unique_ptr<ChunkMeshJob> VoxelChunk::make_mesh_job(
 	VoxelChunk* left,
 	VoxelChunk* right,
 	VoxelChunk* above,
@@ -167,144 +545,220 @@ void VoxelChunk::update_buffers(
 	VoxelChunk* front,
 	VoxelChunk* back) {
 
+	assert(!m_mesh_pending);
+
+	auto job = std::make_unique<ChunkMeshJob>();
+	job->generation = m_generation;
+	job->mode = m_meshing_mode;
+	job->lod = m_lod;
+	job->slabs = m_dirty_slabs;
+	job->voxels = m_voxel;
+	job->light = m_light;
+	if (!is_empty())
+		gather_borders(job->borders, m_lod, left, right, above, below, front, back);
+
+	m_dirty_slabs = 0;
+	m_mesh_pending = true;
+	return job;
+}
+
+void VoxelChunk::apply_mesh(ChunkMeshResult& result) {
+	PROFILE_ZONE(ApplyMesh);
+	m_mesh_pending = false;
+	m_connectivity = result.connectivity;
+	m_occluder = result.occluder;
+
+	//Quads and face records never share a buffer, slabs the result lacks
+	//are meshed again in the new layout
+	bool face_records = result.mode == MeshingMode::FaceRecords;
+	if (face_records != m_face_records) {
+		release_geometry();
+		m_buffers.clear();
+		m_slab_bounds.fill(MeshBounds{});
+		m_dirty_slabs |= ALL_VOXEL_SLABS & ~result.slabs;
+		m_face_records = face_records;
+	}
+
+	m_mesh_bounds = MeshBounds{};
+	for (int slab = 0; slab < NUM_VOXEL_SLABS; ++slab) {
+		if (result.slabs & (1u << slab)) {
+			replace_slab(slab, result.meshes[slab]);
+			m_slab_bounds[slab] = result.bounds[slab];
+		}
+		m_mesh_bounds.add(m_slab_bounds[slab]);
+	}
+
 	for (auto& buffer : m_buffers) {
-		buffer.second.vertices.clear();
-		buffer.second.indices.clear();
+		upload_buffer(buffer.first, buffer.second);
 	}
 
-	unsigned int x = 0, y = 0, z = 0;
-	
-	for (VoxelType* current_voxel = m_voxel.data(); 
-		 z < VOXEL_CHUNK_DEPTH;
-		 current_voxel++) {
-
-		if ( solid_block(*current_voxel) ) {
-			auto& voxel_buffer = get_buffer_or(*current_voxel, []() {return VoxelBuffer{}; });
-			auto& vertices = voxel_buffer.vertices;
-			auto& indices = voxel_buffer.indices;
-
-			auto index_base = vertices.size();
-			//left face
-			if (x == 0 ) {
-				if (left) {
-					if (!solid_block(left->get(VOXEL_CHUNK_WIDTH - 1, y, z)))
-						add_left_face(vertices, indices, index_base, x, y, z);
-				}
-			}
-			else if(!solid_block(current_voxel - 1)) {
-				add_left_face(vertices, indices, index_base, x, y, z);
-			}
-			//right face
-			if (x == VOXEL_CHUNK_WIDTH - 1) {
-				if (right) {
-					if (!solid_block(right->get(0, y, z)))
-						add_right_face(vertices, indices, index_base, x, y, z);
-				}
-			}
-			else if(!solid_block(current_voxel + 1)) {
-				add_right_face(vertices, indices, index_base, x, y, z);
-			}
-			//top face
-			if (y == VOXEL_CHUNK_HEIGHT - 1) {
-				if (above) {
-					if (!solid_block(above->get(x, 0, z)))
-						add_top_face(vertices, indices, index_base, x, y, z);
-				}
-			}
-			else if(!solid_block(current_voxel + VOXEL_CHUNK_WIDTH)) {
-				add_top_face(vertices, indices, index_base, x, y, z);
-			}
-			//bottom face
-			if (y == 0) {
-				if (below) {
-					if (!solid_block(below->get(x, VOXEL_CHUNK_HEIGHT - 1, z)))
-						add_bottom_face(vertices, indices, index_base, x, y, z);
-				}
-			}
-			else if(!solid_block(current_voxel - VOXEL_CHUNK_HEIGHT)) {
-				add_bottom_face(vertices, indices, index_base, x, y, z);
-			}
-			//front face
-			if (z == 0) {
-				if (front) {
-					if (!solid_block(front->get(x, y, VOXEL_CHUNK_DEPTH - 1)))
-						add_front_face(vertices, indices, index_base, x, y, z);
-				}
-			}
-			else if(!solid_block(current_voxel - VOXEL_SLICE_SIZE)) {
-				add_front_face(vertices, indices, index_base, x, y, z);
-			}
-			//back face
-			if (z == VOXEL_CHUNK_DEPTH - 1) {
-				if (back) {
-					if (!solid_block(back->get(x, y, 0)))
-						add_back_face(vertices, indices, index_base, x, y, z);
-				}
-			}
-			else if(!solid_block(current_voxel + VOXEL_SLICE_SIZE)) {	
-				add_back_face(vertices, indices, index_base, x, y, z);
-			}
+	//Changed while the job was in flight
+	queue_meshing();
+}
+
+void VoxelChunk::replace_slab(int slab, SlabMesh& mesh) {
+	auto splice = [slab](VoxelBuffer& buffer, std::vector<PackedVoxelVertex> const& slab_vertices) {
+		auto& vertices = buffer.vertices;
+		auto begin = buffer.slab_start[slab];
+		auto end = buffer.slab_start[slab + 1];
+		auto old_count = end - begin;
+		auto new_count = uint32_t(slab_vertices.size());
+		if (old_count == 0 && new_count == 0)
+			return;
+
+		if (old_count == new_count) {
+			std::copy(slab_vertices.begin(), slab_vertices.end(), vertices.begin() + begin);
+			buffer.dirty_end = std::max(buffer.dirty_end, end);
 		}
-		
-		++x;
-		if (x >= VOXEL_CHUNK_WIDTH) {
-			x = 0;
-			++y;
-			if (y >= VOXEL_CHUNK_HEIGHT) {
-				y = 0;
-				++z;
-			}
+		else {
+			//Everything behind this slab moves
+			vertices.erase(vertices.begin() + begin, vertices.begin() + end);
+			vertices.insert(vertices.begin() + begin, slab_vertices.begin(), slab_vertices.end());
+			for (int s = slab + 1; s <= NUM_VOXEL_SLABS; ++s)
+				buffer.slab_start[s] = buffer.slab_start[s] - old_count + new_count;
+			buffer.dirty_end = uint32_t(vertices.size());
 		}
-	}
+		buffer.dirty_begin = std::min(buffer.dirty_begin, begin);
+	};
 
 	for (auto& buffer : m_buffers) {
-		auto& vertices = buffer.second.vertices;
-		if (vertices.size() == 0)
-			continue;
-		auto& indices = buffer.second.indices;
-		calcTangents(&vertices[0]
-			, vertices.size()
-			, PosNormalTangentTexcoordVertex::ms_decl
-			, &indices[0]
-			, indices.size()
-		);
-
-		update_vertex_buffer(buffer.second);
-		update_index_buffer(buffer.second);
+		auto slab_vertices = mesh.find(buffer.first);
+		if (slab_vertices == mesh.end())
+			splice(buffer.second, {});
 	}
 
-	
+	for (auto& slab_vertices : mesh)
+		splice(get_buffer_or(slab_vertices.first, []() {return VoxelBuffer{}; }), slab_vertices.second);
 }
 
+void VoxelChunk::upload_buffer(VoxelType type, VoxelBuffer& vb) {
+	PROFILE_ZONE(UploadBuffer);
+	auto num_vertices = uint32_t(vb.vertices.size());
+	auto dirty_end = std::min(vb.dirty_end, num_vertices);
+	auto dirty_begin = vb.dirty_begin;
+	vb.dirty_begin = UINT32_MAX;
+	vb.dirty_end = 0;
+
+	if (!m_arena)
+		return;
+
+	//Corners are stored relative to the region so a page draws with one transform
+	std::array<uint8_t, 3> origin;
+	const int size[3] = { VOXEL_CHUNK_WIDTH, VOXEL_CHUNK_HEIGHT, VOXEL_CHUNK_DEPTH };
+	for (int i = 0; i < 3; ++i)
+		origin[i] = uint8_t((m_position[i] & (ChunkMap::REGION_SIZE - 1)) * size[i]);
+
+	//Meshes too large for 16 bit indices are uploaded in parts that draw on their own
+	auto num_parts = (num_vertices + MAX_DRAW_VERTICES - 1) / MAX_DRAW_VERTICES;
+	for (auto part = num_parts; part < vb.parts.size(); ++part)
+		m_arena->free(vb.parts[part].allocation);
+	vb.parts.resize(num_parts);
+
+	auto region = ChunkMap::region_key(m_position[0], m_position[1], m_position[2]);
+	for (uint32_t index = 0; index < num_parts; ++index) {
+		auto& part = vb.parts[index];
+		auto begin = index * MAX_DRAW_VERTICES;
+		auto count = std::min(num_vertices - begin, MAX_DRAW_VERTICES);
+
+		if (!part.allocation.is_valid() || count > part.allocation.capacity) {
+			m_arena->free(part.allocation);
+			part.allocation = m_arena->allocate(region, type, std::min(grow_capacity(count), MAX_DRAW_VERTICES),
+				m_face_records);
+			m_arena->write(part.allocation, 0, vb.vertices.data() + begin, count, origin);
+			part.num_uploaded = count;
+			continue;
+		}
+
+		auto write_begin = std::max(dirty_begin, begin);
+		auto write_end = std::min(dirty_end, begin + count);
+		if (write_begin < write_end)
+			m_arena->write(part.allocation, write_begin - begin, vb.vertices.data() + write_begin,
+				write_end - write_begin, origin);
 
-void VoxelChunk::update_vertex_buffer(VoxelBuffer& vb) {
-	if (vb.vertex_buffer.is_valid()) {
-		vb.vertex_buffer.update(
-			0,
-			bgfx::makeRef(vb.vertices.data()
-				, vb.vertices.size() * sizeof(PosNormalTangentTexcoordVertex))
-		);
+		//The shrunk tail must draw nothing
+		if (count < part.num_uploaded)
+			m_arena->clear(part.allocation, count, part.num_uploaded - count);
+		part.num_uploaded = count;
 	}
-	else {
-		if (!vb.vertex_buffer.create(
-			bgfx::makeRef(vb.vertices.data(), vb.vertices.size() * sizeof(PosNormalTangentTexcoordVertex))
-			, PosNormalTangentTexcoordVertex::ms_decl
-			, BGFX_BUFFER_ALLOW_RESIZE
-		))
-			throw std::runtime_error("Unable to create vertex buffer.");
+}
+
+void VoxelChunk::release_geometry() {
+	for (auto& buffer : m_buffers) {
+		if (m_arena) {
+			for (auto& part : buffer.second.parts)
+				m_arena->free(part.allocation);
+		}
+		buffer.second.parts.clear();
 	}
 }
 
-void VoxelChunk::update_index_buffer(VoxelBuffer& vb) {
-	if (vb.index_buffer.is_valid()) {
-		vb.index_buffer.update(0,
-			bgfx::makeRef(vb.indices.data(), vb.indices.size() * sizeof(uint16_t))
-		);
+void VoxelChunk::mark_dirty(unsigned int z) {
+	assert(z < VOXEL_CHUNK_DEPTH);
+
+	//Front and back faces of the neighbouring slice change as well
+	unsigned int slab = z / VOXEL_SLAB_DEPTH;
+	m_dirty_slabs |= 1u << slab;
+	if (z % VOXEL_SLAB_DEPTH == 0 && slab > 0)
+		m_dirty_slabs |= 1u << (slab - 1);
+	if (z % VOXEL_SLAB_DEPTH == VOXEL_SLAB_DEPTH - 1 && slab + 1 < NUM_VOXEL_SLABS)
+		m_dirty_slabs |= 1u << (slab + 1);
+	queue_meshing();
+}
+
+void VoxelChunk::set_lod(int lod) {
+	assert(lod >= 0 && lod <= MAX_VOXEL_LOD);
+	if (m_lod == lod)
+		return;
+
+	//Neighbours switch between matching borders and skirts
+	m_lod = lod;
+	mark_all_dirty();
+	for (int face = 0; face < NUM_FACES; ++face) {
+		if (auto* neighbour = m_neighbours[face])
+			neighbour->mark_border_dirty(opposite_face(VoxelFace(face)));
 	}
-	else {
-		vb.index_buffer.create(
-			bgfx::makeRef(vb.indices.data(), vb.indices.size() * sizeof(uint16_t))
-			, BGFX_BUFFER_ALLOW_RESIZE
-		);
+}
+
+void VoxelChunk::apply_edit(VoxelType const* voxels, uint32_t changed_slices, uint32_t border_faces) {
+	m_voxel.pack(voxels);
+	m_modified = true;
+	mark_changed(changed_slices, border_faces);
+}
+
+void VoxelChunk::set_light(std::shared_ptr<ChunkLight const> light, uint32_t changed_slices, uint32_t border_faces) {
+	m_light = std::move(light);
+	mark_changed(changed_slices, border_faces);
+}
+
+void VoxelChunk::mark_changed(uint32_t changed_slices, uint32_t border_faces) {
+	static_assert(VOXEL_CHUNK_DEPTH <= 32, "Changed slices are tracked in a 32 bit mask");
+
+	for (unsigned int z = 0; z < VOXEL_CHUNK_DEPTH; ++z) {
+		if (changed_slices & (1u << z))
+			mark_dirty(z);
+	}
+	for (int face = 0; face < NUM_FACES; ++face) {
+		if (border_faces & (1u << face) && m_neighbours[face])
+			m_neighbours[face]->mark_border_dirty(opposite_face(VoxelFace(face)));
+	}
+}
+
+void VoxelChunk::mark_all_dirty() {
+	m_dirty_slabs = ALL_VOXEL_SLABS;
+	queue_meshing();
+}
+
+void VoxelChunk::queue_meshing() {
+	if (!m_map || m_mesh_queued || !m_dirty_slabs || m_mesh_pending)
+		return;
+	m_mesh_queued = true;
+	m_map->m_mesh_queue.emplace_back(ChunkMap::pack_key(m_position[0], m_position[1], m_position[2]));
+}
+
+void VoxelChunk::mark_border_dirty(VoxelFace face) {
+	switch (face) {
+	case FACE_FRONT: mark_dirty(0); break;
+	case FACE_BACK: mark_dirty(VOXEL_CHUNK_DEPTH - 1); break;
+	default: mark_all_dirty(); break;
 	}
 }
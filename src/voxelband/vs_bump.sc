@@ -1,5 +1,5 @@
 $input a_position, a_normal, a_tangent, a_texcoord0
-$output v_wpos, v_view, v_normal, v_tangent, v_bitangent, v_texcoord0
+$output v_wpos, v_view, v_normal, v_tangent, v_bitangent, v_texcoord0, v_color0
 
 /*
  * Copyright 2011-2017 Branimir Karadzic. All rights reserved.
@@ -34,4 +34,5 @@ void main()
 	v_bitangent = viewBitangent;
 
 	v_texcoord0 = a_texcoord0;
+	v_color0 = vec4_splat(1.0);
 }
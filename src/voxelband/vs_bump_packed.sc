@@ -0,0 +1,49 @@
+$input a_texcoord1, a_color0
+$output v_wpos, v_view, v_normal, v_tangent, v_bitangent, v_texcoord0, v_color0
+
+/*
+ * Variant of vs_bump for PackedVoxelVertex. a_texcoord1 holds the
+ * chunk-local corner position in xyz and the VoxelFace index in w.
+ */
+
+#include "common.sh"
+
+void main()
+{
+	vec4 corner = floor(a_texcoord1 * 255.0 + 0.5);
+	float axis = floor(corner.w * 0.5);
+	float side = mod(corner.w, 2.0) * 2.0 - 1.0;
+	vec3 axisMask = vec3_splat(1.0) - step(vec3_splat(0.5), abs(vec3(0.0, 1.0, 2.0) - axis) );
+
+	// Faces along x map u to y, all others map u to x. v runs along -z,
+	// or along -y for faces along z.
+	vec3 normal = axisMask * side;
+	vec4 tangent = vec4(1.0 - axisMask.x, axisMask.x, 0.0, -side);
+	vec2 texcoord = vec2(
+		mix(corner.x, corner.y, axisMask.x),
+		-mix(corner.z, corner.y, axisMask.z)
+		);
+
+	vec3 wpos = mul(u_model[0], vec4(corner.xyz, 1.0) ).xyz;
+	gl_Position = mul(u_viewProj, vec4(wpos, 1.0) );
+
+	vec3 wnormal = mul(u_model[0], vec4(normal, 0.0) ).xyz;
+	vec3 wtangent = mul(u_model[0], vec4(tangent.xyz, 0.0) ).xyz;
+
+	vec3 viewNormal = normalize(mul(u_view, vec4(wnormal, 0.0) ).xyz);
+	vec3 viewTangent = normalize(mul(u_view, vec4(wtangent, 0.0) ).xyz);
+	vec3 viewBitangent = cross(viewNormal, viewTangent) * tangent.w;
+	mat3 tbn = mat3(viewTangent, viewBitangent, viewNormal);
+
+	v_wpos = wpos;
+
+	vec3 view = mul(u_view, vec4(wpos, 0.0) ).xyz;
+	v_view = mul(view, tbn);
+
+	v_normal = viewNormal;
+	v_tangent = viewTangent;
+	v_bitangent = viewBitangent;
+
+	v_texcoord0 = texcoord;
+	v_color0 = a_color0;
+}
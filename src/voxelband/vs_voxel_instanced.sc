@@ -0,0 +1,77 @@
+$input a_texcoord0, i_data0
+$output v_wpos, v_view, v_normal, v_tangent, v_bitangent, v_texcoord0, v_color0
+
+/*
+ * Variant of vs_bump_packed for face records drawn as instances. i_data0
+ * holds two records bit for bit, see PackedVoxelVertex::ms_record_decl.
+ * a_texcoord0 holds the quad corner in x and the record in y. Needs
+ * unsigned integer ops, built for GLSL 130 and not for DX9 or GLES 2.
+ */
+
+#include "common.sh"
+
+void main()
+{
+	uvec4 records = floatBitsToUint(i_data0);
+	uvec2 record = a_texcoord0.y < 0.5 ? records.xy : records.zw;
+
+	vec3 voxel = vec3(uvec3(record.x, record.x >> 8u, record.x >> 16u) & uvec3(255u, 255u, 255u) );
+	float face = float(record.x >> 24u);
+	vec4 color = vec4(uvec4(record.y, record.y >> 8u, record.y >> 16u, record.y >> 24u)
+		& uvec4(255u, 255u, 255u, 255u) ) / 255.0;
+
+	// Corners in the order the mesher emits quads, so the shared quad
+	// indices wind every face the same way.
+	float c0 = mod(a_texcoord0.x, 2.0);
+	float c1 = floor(a_texcoord0.x * 0.5);
+	vec3 offset;
+	if (face < 0.5)
+		offset = vec3(0.0, 1.0 - c0, 1.0 - c1);
+	else if (face < 1.5)
+		offset = vec3(1.0, 1.0 - c1, 1.0 - c0);
+	else if (face < 2.5)
+		offset = vec3(c0, 0.0, 1.0 - c1);
+	else if (face < 3.5)
+		offset = vec3(1.0 - c1, 1.0, c0);
+	else if (face < 4.5)
+		offset = vec3(c1, 1.0 - c0, 0.0);
+	else
+		offset = vec3(c0, 1.0 - c1, 1.0);
+
+	// Unused records are zero, alpha included, and collapse to a point
+	vec4 corner = vec4(voxel + offset * step(0.5, color.w), face);
+
+	float axis = floor(corner.w * 0.5);
+	float side = mod(corner.w, 2.0) * 2.0 - 1.0;
+	vec3 axisMask = vec3_splat(1.0) - step(vec3_splat(0.5), abs(vec3(0.0, 1.0, 2.0) - axis) );
+
+	vec3 normal = axisMask * side;
+	vec4 tangent = vec4(1.0 - axisMask.x, axisMask.x, 0.0, -side);
+	vec2 texcoord = vec2(
+		mix(corner.x, corner.y, axisMask.x),
+		-mix(corner.z, corner.y, axisMask.z)
+		);
+
+	vec3 wpos = mul(u_model[0], vec4(corner.xyz, 1.0) ).xyz;
+	gl_Position = mul(u_viewProj, vec4(wpos, 1.0) );
+
+	vec3 wnormal = mul(u_model[0], vec4(normal, 0.0) ).xyz;
+	vec3 wtangent = mul(u_model[0], vec4(tangent.xyz, 0.0) ).xyz;
+
+	vec3 viewNormal = normalize(mul(u_view, vec4(wnormal, 0.0) ).xyz);
+	vec3 viewTangent = normalize(mul(u_view, vec4(wtangent, 0.0) ).xyz);
+	vec3 viewBitangent = cross(viewNormal, viewTangent) * tangent.w;
+	mat3 tbn = mat3(viewTangent, viewBitangent, viewNormal);
+
+	v_wpos = wpos;
+
+	vec3 view = mul(u_view, vec4(wpos, 0.0) ).xyz;
+	v_view = mul(view, tbn);
+
+	v_normal = viewNormal;
+	v_tangent = viewTangent;
+	v_bitangent = viewBitangent;
+
+	v_texcoord0 = texcoord;
+	v_color0 = color;
+}
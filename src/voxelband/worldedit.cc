@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cmath>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "worldedit.hh"
+#include "profiler.hh"
+
+namespace {
+	//Bits of the faces whose border holds chunk-local voxel x, y, z
+	uint32_t border_faces(int x, int y, int z) {
+		uint32_t faces = 0;
+		if (x == 0) faces |= 1u << FACE_LEFT;
+		if (x == VOXEL_CHUNK_WIDTH - 1) faces |= 1u << FACE_RIGHT;
+		if (y == 0) faces |= 1u << FACE_BOTTOM;
+		if (y == VOXEL_CHUNK_HEIGHT - 1) faces |= 1u << FACE_TOP;
+		if (z == 0) faces |= 1u << FACE_FRONT;
+		if (z == VOXEL_CHUNK_DEPTH - 1) faces |= 1u << FACE_BACK;
+		return faces;
+	}
+}
+
+WorldEdit::WorldEdit(ChunkMap& chunks)
+	: m_chunks(chunks) {
+}
+
+WorldEdit::PendingChunk* WorldEdit::pending(int x, int y, int z) {
+	auto key = ChunkMap::pack_key(x, y, z);
+	auto found = m_pending.find(key);
+	if (found != m_pending.end())
+		return &found->second;
+
+	auto* chunk = m_chunks.find(x, y, z);
+	if (!chunk)
+		return nullptr;
+
+	auto& pending = m_pending[key];
+	pending.chunk = chunk;
+	pending.voxels.resize(NUM_VOXELS);
+	chunk->get_voxels().unpack(pending.voxels.data(), 0, NUM_VOXELS);
+	return &pending;
+}
+
+template<typename Tfun>
+void WorldEdit::edit_box(Voxel const& min, Voxel const& max, Tfun fun) {
+	Voxel first, last;
+	for (int i = 0; i < 3; ++i) {
+		if (min[i] >= max[i])
+			return;
+		first[i] = voxel_chunk_coord(min[i], i);
+		last[i] = voxel_chunk_coord(max[i] - 1, i);
+	}
+
+	for (int cz = first[2]; cz <= last[2]; ++cz) {
+		for (int cy = first[1]; cy <= last[1]; ++cy) {
+			for (int cx = first[0]; cx <= last[0]; ++cx) {
+				auto* chunk = pending(cx, cy, cz);
+				if (!chunk)
+					continue;
+
+				//The part of the box inside this chunk, chunk-local
+				const Voxel origin = { { cx * VOXEL_CHUNK_WIDTH, cy * VOXEL_CHUNK_HEIGHT, cz * VOXEL_CHUNK_DEPTH } };
+				Voxel begin, end;
+				for (int i = 0; i < 3; ++i) {
+					begin[i] = std::max(min[i] - origin[i], 0);
+					end[i] = std::min(max[i] - origin[i], VOXEL_CHUNK_SIZE[i]);
+				}
+
+				for (int z = begin[2]; z < end[2]; ++z) {
+					for (int y = begin[1]; y < end[1]; ++y) {
+						for (int x = begin[0]; x < end[0]; ++x) {
+							auto& voxel = chunk->voxels[voxel_index(x, y, z)];
+							auto type = fun(origin[0] + x, origin[1] + y, origin[2] + z, voxel);
+							if (type == voxel)
+								continue;
+
+							voxel = type;
+							chunk->changed_slices |= 1u << z;
+							chunk->border_faces |= border_faces(x, y, z);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+VoxelType WorldEdit::get(int x, int y, int z) {
+	const int position[3] = { voxel_chunk_coord(x, 0), voxel_chunk_coord(y, 1), voxel_chunk_coord(z, 2) };
+	const int local[3] = {
+		x - position[0] * VOXEL_CHUNK_WIDTH, y - position[1] * VOXEL_CHUNK_HEIGHT, z - position[2] * VOXEL_CHUNK_DEPTH
+	};
+
+	auto found = m_pending.find(ChunkMap::pack_key(position[0], position[1], position[2]));
+	if (found != m_pending.end())
+		return found->second.voxels[voxel_index(local[0], local[1], local[2])];
+	if (auto const* chunk = m_chunks.find(position[0], position[1], position[2]))
+		return chunk->get(unsigned(local[0]), unsigned(local[1]), unsigned(local[2]));
+	return VoxelType::V_EMPTY;
+}
+
+void WorldEdit::set(int x, int y, int z, VoxelType type) {
+	fill_box(Voxel{ { x, y, z } }, Voxel{ { x + 1, y + 1, z + 1 } }, type);
+}
+
+void WorldEdit::fill_box(Voxel const& min, Voxel const& max, VoxelType type) {
+	edit_box(min, max, [type](int, int, int, VoxelType) {
+		return type;
+	});
+}
+
+void WorldEdit::fill_sphere(std::array<float, 3> const& center, float radius, VoxelType type) {
+	Voxel min, max;
+	for (int i = 0; i < 3; ++i) {
+		min[i] = int(std::floor(center[i] - radius));
+		max[i] = int(std::ceil(center[i] + radius)) + 1;
+	}
+
+	const float radius_sq = radius * radius;
+	edit_box(min, max, [&](int x, int y, int z, VoxelType old) {
+		float dx = float(x) + 0.5f - center[0];
+		float dy = float(y) + 0.5f - center[1];
+		float dz = float(z) + 0.5f - center[2];
+		return dx * dx + dy * dy + dz * dz <= radius_sq ? type : old;
+	});
+}
+
+void WorldEdit::replace(Voxel const& min, Voxel const& max, VoxelType from, VoxelType to) {
+	edit_box(min, max, [from, to](int, int, int, VoxelType old) {
+		return old == from ? to : old;
+	});
+}
+
+void WorldEdit::copy_region(Voxel const& min, Voxel const& max, Voxel const& destination) {
+	Voxel size;
+	for (int i = 0; i < 3; ++i) {
+		if (min[i] >= max[i])
+			return;
+		size[i] = max[i] - min[i];
+	}
+
+	//Read the whole source first so overlapping boxes copy the old voxels
+	std::vector<VoxelType> source(size_t(size[0]) * size[1] * size[2]);
+	auto* out = source.data();
+	for (int z = min[2]; z < max[2]; ++z)
+		for (int y = min[1]; y < max[1]; ++y)
+			for (int x = min[0]; x < max[0]; ++x)
+				*out++ = get(x, y, z);
+
+	const Voxel end = { { destination[0] + size[0], destination[1] + size[1], destination[2] + size[2] } };
+	edit_box(destination, end, [&](int x, int y, int z, VoxelType) {
+		auto sx = x - destination[0];
+		auto sy = y - destination[1];
+		auto sz = z - destination[2];
+		return source[(size_t(sz) * size[1] + sy) * size[0] + sx];
+	});
+}
+
+unsigned int WorldEdit::commit() {
+	PROFILE_ZONE(CommitEdit);
+	unsigned int changed = 0;
+	for (auto& entry : m_pending) {
+		auto& pending = entry.second;
+		if (!pending.changed_slices)
+			continue;
+
+		pending.chunk->apply_edit(pending.voxels.data(), pending.changed_slices, pending.border_faces);
+		auto const& position = pending.chunk->get_position();
+		m_chunks.voxels_changed(position[0], position[1], position[2]);
+		++changed;
+	}
+	m_pending.clear();
+	return changed;
+}
@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <nlohmann/json.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "bx/commandline.h"
+#include "bx/timer.h"
+#include "voxel.hh"
+#include "chunkmap.hh"
+#include "mesher.hh"
+#include "terrain.hh"
+
+//Headless benchmark of remeshing, voxel access and chunk lookups over a few
+//canonical fill patterns. Chunks are given no arena, so meshes stay on the
+//CPU and neither a window nor a GPU is needed. Prints JSON to stdout or to
+//--output, a summary per pattern to stderr.
+//
+//	voxelband_bench [--iterations N] [--seed N] [--output file]
+
+bgfx::VertexDecl PackedVoxelVertex::ms_decl;
+bgfx::VertexDecl PackedVoxelVertex::ms_record_decl;
+
+namespace {
+	std::atomic<uint64_t> g_allocations{ 0 };
+}
+
+//Every heap allocation is counted, allocations per remesh show how much of
+//a remesh goes to growing buffers
+void* operator new(size_t size) {
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (auto* memory = std::malloc(size ? size : 1))
+		return memory;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+	std::free(memory);
+}
+
+namespace {
+	enum class Pattern {
+		Empty,
+		Solid,
+		Checkerboard,
+		Random,
+		Terrain
+	};
+
+	const Pattern PATTERNS[] = { Pattern::Empty, Pattern::Solid, Pattern::Checkerboard, Pattern::Random, Pattern::Terrain };
+	const MeshingMode MODES[] = { MeshingMode::PerFace, MeshingMode::Greedy, MeshingMode::FaceRecords };
+
+	//The world is a cube of chunks this many a side, the middle one is measured
+	const int WORLD_SIZE = 3;
+
+	char const* pattern_name(Pattern pattern) {
+		switch (pattern) {
+		case Pattern::Empty: return "empty";
+		case Pattern::Solid: return "solid";
+		case Pattern::Checkerboard: return "checkerboard";
+		case Pattern::Random: return "random50";
+		case Pattern::Terrain: return "terrain";
+		}
+		return "";
+	}
+
+	char const* mode_name(MeshingMode mode) {
+		switch (mode) {
+		case MeshingMode::PerFace: return "per_face";
+		case MeshingMode::Greedy: return "greedy";
+		case MeshingMode::FaceRecords: return "face_records";
+		}
+		return "";
+	}
+
+	double elapsed_ns(int64_t start) {
+		return double(bx::getHPCounter() - start) * 1e9 / double(bx::getHPFrequency());
+	}
+
+	//Chunk row whose middle chunk is closest to half solid, so the measured
+	//chunk holds the surface whatever the seed
+	int find_surface_row(TerrainGenerator const& generator) {
+		const int lowest = (TerrainGenerator::BASE_HEIGHT - TerrainGenerator::AMPLITUDE) / VOXEL_CHUNK_HEIGHT - 1;
+		const int highest = (TerrainGenerator::BASE_HEIGHT + TerrainGenerator::AMPLITUDE) / VOXEL_CHUNK_HEIGHT;
+		int best_row = 0;
+		int best_distance = NUM_VOXELS;
+		for (int row = lowest; row <= highest; ++row) {
+			PalettedVoxels voxels;
+			generator.generate(0, row, 0, voxels);
+			int solid = 0;
+			for (unsigned int i = 0; i < NUM_VOXELS; ++i)
+				solid += voxels.get(i) != VoxelType::V_EMPTY;
+			if (std::abs(solid - NUM_VOXELS / 2) < best_distance) {
+				best_distance = std::abs(solid - NUM_VOXELS / 2);
+				best_row = row;
+			}
+		}
+		return best_row;
+	}
+
+	//Voxels of chunk x, y, z, patterns continue across chunk borders. Terrain
+	//chunk row 0 is the generator's surface_row.
+	void fill_pattern(Pattern pattern, int x, int y, int z, uint32_t seed,
+		TerrainGenerator const& generator, int surface_row, PalettedVoxels& voxels) {
+
+		if (pattern == Pattern::Terrain) {
+			generator.generate(x, y + surface_row, z, voxels);
+			return;
+		}
+
+		std::vector<VoxelType> out(NUM_VOXELS, VoxelType::V_EMPTY);
+		std::mt19937 rng(seed ^ uint32_t(ChunkMap::pack_key(x, y, z)));
+		for (int vz = 0; vz < VOXEL_CHUNK_DEPTH; ++vz) {
+			for (int vy = 0; vy < VOXEL_CHUNK_HEIGHT; ++vy) {
+				for (int vx = 0; vx < VOXEL_CHUNK_WIDTH; ++vx) {
+					bool solid = false;
+					switch (pattern) {
+					case Pattern::Empty: break;
+					case Pattern::Solid: solid = true; break;
+					case Pattern::Checkerboard: solid = (vx + vy + vz) % 2 == 0; break;
+					case Pattern::Random: solid = rng() & 1; break;
+					case Pattern::Terrain: break;
+					}
+					if (solid)
+						out[(vz * VOXEL_CHUNK_HEIGHT + vy) * VOXEL_CHUNK_WIDTH + vx] = VoxelType::V_DIRT;
+				}
+			}
+		}
+		voxels.pack(out.data());
+	}
+
+	nlohmann::json bench_meshing(VoxelChunk& chunk, MeshingMode mode, int iterations) {
+		auto remesh = [&chunk]() {
+			chunk.mark_all_dirty();
+			chunk.update_buffers(chunk.get_neighbour(FACE_LEFT), chunk.get_neighbour(FACE_RIGHT),
+				chunk.get_neighbour(FACE_TOP), chunk.get_neighbour(FACE_BOTTOM),
+				chunk.get_neighbour(FACE_FRONT), chunk.get_neighbour(FACE_BACK));
+		};
+
+		//The first remesh sizes the buffers and the mesher's scratch space
+		chunk.set_meshing_mode(mode);
+		remesh();
+
+		auto allocations = g_allocations.load();
+		auto start = bx::getHPCounter();
+		for (int i = 0; i < iterations; ++i)
+			remesh();
+		double remesh_ns = elapsed_ns(start) / iterations;
+		allocations = g_allocations.load() - allocations;
+
+		uint64_t vertices = 0;
+		for (auto const& buffer : chunk.get_buffers())
+			vertices += buffer.second.vertices.size();
+		uint64_t faces = chunk.has_face_records() ? vertices : vertices / 4;
+
+		nlohmann::json result;
+		result["mode"] = mode_name(mode);
+		result["remesh_ns"] = remesh_ns;
+		result["ns_per_voxel"] = remesh_ns / NUM_VOXELS;
+		result["faces"] = faces;
+		result["faces_per_sec"] = remesh_ns > 0.0 ? double(faces) * 1e9 / remesh_ns : 0.0;
+		result["vertex_bytes"] = vertices * sizeof(PackedVoxelVertex);
+		//Quads draw from the arena's shared 16 bit quad indices, this is
+		//what the mesh would need on its own. Face records need none.
+		result["index_bytes"] = chunk.has_face_records() ? 0 : faces * 6 * sizeof(uint16_t);
+		result["allocations_per_remesh"] = double(allocations) / iterations;
+		return result;
+	}
+
+	nlohmann::json bench_access(VoxelChunk const& chunk, int iterations) {
+		//Set into a fresh chunk, so palettes and index widths grow as in a load
+		auto start = bx::getHPCounter();
+		for (int i = 0; i < iterations; ++i) {
+			VoxelChunk copy;
+			for (unsigned int z = 0; z < VOXEL_CHUNK_DEPTH; ++z)
+				for (unsigned int y = 0; y < VOXEL_CHUNK_HEIGHT; ++y)
+					for (unsigned int x = 0; x < VOXEL_CHUNK_WIDTH; ++x)
+						copy.set(x, y, z, chunk.get(x, y, z));
+		}
+		double set_ns = elapsed_ns(start) / iterations;
+
+		unsigned int checksum = 0;
+		start = bx::getHPCounter();
+		for (int i = 0; i < iterations; ++i) {
+			for (unsigned int z = 0; z < VOXEL_CHUNK_DEPTH; ++z)
+				for (unsigned int y = 0; y < VOXEL_CHUNK_HEIGHT; ++y)
+					for (unsigned int x = 0; x < VOXEL_CHUNK_WIDTH; ++x)
+						checksum += unsigned(chunk.get(x, y, z));
+		}
+		double get_ns = elapsed_ns(start) / iterations;
+
+		nlohmann::json result;
+		//Includes the get of the source voxel
+		result["set_ns_per_voxel"] = set_ns / NUM_VOXELS;
+		result["get_ns_per_voxel"] = get_ns / NUM_VOXELS;
+		result["checksum"] = checksum;
+		return result;
+	}
+
+	//Lookups of every loaded chunk and of the shell of missing chunks around them
+	nlohmann::json bench_lookups(ChunkMap const& chunks, int iterations) {
+		const int lo = -WORLD_SIZE / 2;
+		const int hi = lo + WORLD_SIZE;
+		std::vector<std::array<int, 3>> hits, misses;
+		for (int z = lo - 1; z <= hi; ++z) {
+			for (int y = lo - 1; y <= hi; ++y) {
+				for (int x = lo - 1; x <= hi; ++x) {
+					bool inside = x >= lo && x < hi && y >= lo && y < hi && z >= lo && z < hi;
+					(inside ? hits : misses).emplace_back(std::array<int, 3>{ { x, y, z } });
+				}
+			}
+		}
+
+		size_t found = 0;
+		auto time_lookups = [&](std::vector<std::array<int, 3>> const& positions) {
+			auto start = bx::getHPCounter();
+			for (int i = 0; i < iterations * 100; ++i)
+				for (auto const& position : positions)
+					found += chunks.find(position[0], position[1], position[2]) != nullptr;
+			return elapsed_ns(start) / (double(iterations) * 100.0 * double(positions.size()));
+		};
+
+		nlohmann::json result;
+		result["find_hit_ns"] = time_lookups(hits);
+		result["find_miss_ns"] = time_lookups(misses);
+		result["found"] = found;
+		return result;
+	}
+}
+
+int main(int argc, char const* argv[]) {
+	bx::CommandLine cmdLine(argc, argv);
+	int iterations = 50;
+	cmdLine.hasArg(iterations, '\0', "iterations");
+	iterations = std::max(iterations, 1);
+	int seed = 1;
+	cmdLine.hasArg(seed, '\0', "seed");
+
+	TerrainGenerator generator(static_cast<uint32_t>(seed));
+	int surface_row = find_surface_row(generator);
+	nlohmann::json report;
+	report["iterations"] = iterations;
+	report["seed"] = seed;
+	report["voxels_per_chunk"] = NUM_VOXELS;
+
+	for (auto pattern : PATTERNS) {
+		ChunkMap chunks;
+		const int lo = -WORLD_SIZE / 2;
+		for (int z = lo; z < lo + WORLD_SIZE; ++z) {
+			for (int y = lo; y < lo + WORLD_SIZE; ++y) {
+				for (int x = lo; x < lo + WORLD_SIZE; ++x) {
+					PalettedVoxels voxels;
+					fill_pattern(pattern, x, y, z, uint32_t(seed), generator, surface_row, voxels);
+					VoxelChunk chunk;
+					chunk.set_voxels(std::move(voxels));
+					chunks.insert(x, y, z, std::move(chunk));
+				}
+			}
+		}
+
+		auto& chunk = *chunks.find(0, 0, 0);
+		nlohmann::json result;
+		result["pattern"] = pattern_name(pattern);
+		result["bits_per_voxel"] = chunk.get_voxels().bits_per_voxel();
+		result["access"] = bench_access(chunk, iterations);
+		result["lookups"] = bench_lookups(chunks, iterations);
+		for (auto mode : MODES) {
+			auto meshing = bench_meshing(chunk, mode, iterations);
+			std::fprintf(stderr, "%-13s %-13s %9.0f ns/remesh %7.2f ns/voxel %8llu faces %6.1f allocs\n",
+				pattern_name(pattern), mode_name(mode),
+				meshing["remesh_ns"].get<double>(), meshing["ns_per_voxel"].get<double>(),
+				(unsigned long long)meshing["faces"].get<uint64_t>(),
+				meshing["allocations_per_remesh"].get<double>());
+			result["meshing"].emplace_back(std::move(meshing));
+		}
+		report["patterns"].emplace_back(std::move(result));
+	}
+
+	if (auto const* path = cmdLine.findOption("output")) {
+		std::ofstream out(path);
+		if (!out)
+			throw std::runtime_error(std::string("Unable to write ") + path);
+		out << report.dump(4) << std::endl;
+	}
+	else
+		std::cout << report.dump(4) << std::endl;
+	return 0;
+}
@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <boost/filesystem.hpp>
+
+#include "bgfx/bgfx.h"
+#include "bgfx_utils.h"
+#include "bx/commandline.h"
+#include "voxel.hh"
+#include "chunkmap.hh"
+#include "light.hh"
+#include "raycast.hh"
+#include "terrain.hh"
+#include "worldedit.hh"
+
+//Randomized checks of the world code against plain reference versions:
+//PalettedVoxels encode and decode round trips, ChunkMap insert and erase
+//against std::map, raycast against a walk of every voxel along the ray and
+//LightEngine against a flood fill of the whole world. Needs no window or
+//GPU. Prints a line per check and exits with 1 when any of them fails.
+//
+//	voxelband_tests [--seed N]
+
+bgfx::VertexDecl PackedVoxelVertex::ms_decl;
+bgfx::VertexDecl PackedVoxelVertex::ms_record_decl;
+
+namespace {
+	using Position = std::array<int, 3>;
+
+	bool report(char const* name, unsigned int checks, unsigned int failures) {
+		std::printf("%-12s %8u checks %6u failures\n", name, checks, failures);
+		return failures == 0;
+	}
+
+	VoxelType random_type(std::mt19937& rng, unsigned int num_types) {
+		return VoxelType(rng() % num_types);
+	}
+
+	//Voxels of a few kinds of chunk: uniform, long runs, noise over a small
+	//palette and noise built by set calls, optionally compacted
+	void random_voxels(std::mt19937& rng, std::vector<VoxelType>& expected, PalettedVoxels& voxels) {
+		unsigned int num_types = 1 + rng() % NUM_VOXEL_TYPES;
+		expected.resize(NUM_VOXELS);
+		switch (rng() % 4) {
+		case 0:
+			std::fill(expected.begin(), expected.end(), random_type(rng, num_types));
+			break;
+		case 1:
+			for (unsigned int i = 0; i < unsigned(NUM_VOXELS);) {
+				auto run = std::min(unsigned(NUM_VOXELS) - i, unsigned(1 + rng() % 3000));
+				std::fill_n(expected.begin() + i, run, random_type(rng, num_types));
+				i += run;
+			}
+			break;
+		default:
+			for (auto& voxel : expected)
+				voxel = random_type(rng, num_types);
+			break;
+		}
+
+		if (rng() % 2) {
+			voxels.pack(expected.data());
+		}
+		else {
+			voxels.fill(expected[0]);
+			for (unsigned int i = 0; i < unsigned(NUM_VOXELS); ++i)
+				voxels.set(i, expected[i]);
+		}
+		if (rng() % 2) {
+			//Leave unused palette entries behind for compact to drop
+			for (unsigned int i = 0; i < 64; ++i) {
+				auto index = rng() % NUM_VOXELS;
+				voxels.set(index, random_type(rng, NUM_VOXEL_TYPES));
+				voxels.set(index, expected[index]);
+			}
+			voxels.compact();
+		}
+	}
+
+	bool check_paletted_voxels(std::mt19937& rng) {
+		unsigned int checks = 0, failures = 0;
+		std::vector<VoxelType> expected, unpacked(NUM_VOXELS);
+		std::vector<uint8_t> encoded;
+		for (int iteration = 0; iteration < 300; ++iteration) {
+			PalettedVoxels voxels;
+			random_voxels(rng, expected, voxels);
+			voxels.unpack(unpacked.data(), 0, NUM_VOXELS);
+			failures += unpacked != expected;
+
+			encoded.clear();
+			voxels.encode(encoded);
+			PalettedVoxels decoded;
+			if (decoded.decode(encoded.data(), encoded.size())) {
+				decoded.unpack(unpacked.data(), 0, NUM_VOXELS);
+				failures += unpacked != expected;
+			}
+			else {
+				++failures;
+			}
+
+			//Truncated or padded encodings are rejected
+			failures += decoded.decode(encoded.data(), encoded.size() - 1);
+			encoded.push_back(0);
+			failures += decoded.decode(encoded.data(), encoded.size());
+			checks += 4;
+		}
+		return report("paletted", checks, failures);
+	}
+
+	bool check_chunk_map(std::mt19937& rng) {
+		unsigned int checks = 0, failures = 0;
+		ChunkMap chunks;
+		//Voxel type every chunk was filled with, by position
+		std::map<Position, VoxelType> expected;
+		const int range = 6;
+		std::uniform_int_distribution<int> coord(-range, range - 1);
+
+		auto verify = [&]() {
+			failures += chunks.size() != expected.size();
+			for (int z = -range; z < range; ++z) {
+				for (int y = -range; y < range; ++y) {
+					for (int x = -range; x < range; ++x) {
+						auto* chunk = chunks.find(x, y, z);
+						auto found = expected.find(Position{ { x, y, z } });
+						++checks;
+						if (!chunk || found == expected.end()) {
+							failures += !chunk != (found == expected.end());
+							continue;
+						}
+						failures += chunk->get_position() != found->first;
+						failures += chunk->get_voxels().get(0) != found->second;
+						for (int face = 0; face < NUM_FACES; ++face) {
+							auto* neighbour = chunks.find(x + VOXEL_FACE_OFFSET[face][0],
+								y + VOXEL_FACE_OFFSET[face][1], z + VOXEL_FACE_OFFSET[face][2]);
+							failures += chunk->get_neighbour(VoxelFace(face)) != neighbour;
+						}
+					}
+				}
+			}
+
+			size_t visited = 0;
+			chunks.for_each([&](int x, int y, int z, VoxelChunk&) {
+				++visited;
+				failures += !expected.count(Position{ { x, y, z } });
+			});
+			failures += visited != expected.size();
+		};
+
+		for (int round = 0; round < 20; ++round) {
+			//Grow the map, then erase most of it again to leave long probe chains
+			bool growing = round % 4 != 3;
+			for (int i = 0; i < 400; ++i) {
+				Position position = { { coord(rng), coord(rng), coord(rng) } };
+				if (growing || rng() % 4 == 0) {
+					auto type = random_type(rng, NUM_VOXEL_TYPES);
+					PalettedVoxels voxels;
+					voxels.fill(type);
+					VoxelChunk chunk;
+					chunk.set_voxels(std::move(voxels));
+					chunks.insert(position[0], position[1], position[2], std::move(chunk));
+					expected[position] = type;
+				}
+				else {
+					bool erased = chunks.erase(position[0], position[1], position[2]);
+					failures += erased != (expected.erase(position) != 0);
+					++checks;
+				}
+			}
+			verify();
+		}
+		return report("chunk map", checks, failures);
+	}
+
+	VoxelType world_voxel(ChunkMap const& chunks, int x, int y, int z) {
+		const Position chunk = { { voxel_chunk_coord(x, 0), voxel_chunk_coord(y, 1), voxel_chunk_coord(z, 2) } };
+		auto const* found = chunks.find(chunk[0], chunk[1], chunk[2]);
+		if (!found)
+			return VoxelType::V_EMPTY;
+		return found->get_voxels().get(voxel_index(x - chunk[0] * VOXEL_CHUNK_WIDTH,
+			y - chunk[1] * VOXEL_CHUNK_HEIGHT, z - chunk[2] * VOXEL_CHUNK_DEPTH));
+	}
+
+	//Amanatides and Woo one voxel at a time, without skipping chunks
+	bool raycast_voxels(ChunkMap const& chunks, Ray const& ray, float max_distance, VoxelHit& hit) {
+		float length = std::sqrt(ray.m_dir[0] * ray.m_dir[0] + ray.m_dir[1] * ray.m_dir[1] + ray.m_dir[2] * ray.m_dir[2]);
+		int voxel[3], step[3];
+		float t_max[3], t_delta[3];
+		for (int i = 0; i < 3; ++i) {
+			float dir = ray.m_dir[i] / length;
+			float origin = std::floor(ray.m_pos[i]);
+			voxel[i] = int(origin);
+			step[i] = dir > 0.0f ? 1 : dir < 0.0f ? -1 : 0;
+			t_delta[i] = step[i] ? float(step[i]) / dir : INFINITY;
+			t_max[i] = step[i] > 0 ? (origin + 1.0f - ray.m_pos[i]) * t_delta[i]
+				: step[i] < 0 ? (ray.m_pos[i] - origin) * t_delta[i] : INFINITY;
+		}
+
+		float t = 0.0f;
+		int axis = -1;
+		for (;;) {
+			auto type = world_voxel(chunks, voxel[0], voxel[1], voxel[2]);
+			if (type != VoxelType::V_EMPTY) {
+				hit.voxel = { { voxel[0], voxel[1], voxel[2] } };
+				hit.type = type;
+				hit.face = axis < 0 ? NUM_FACES : VoxelFace(axis * 2 + (step[axis] > 0 ? 0 : 1));
+				hit.distance = t;
+				return true;
+			}
+			axis = t_max[0] < t_max[1] ? (t_max[0] < t_max[2] ? 0 : 2) : (t_max[1] < t_max[2] ? 1 : 2);
+			t = t_max[axis];
+			if (t > max_distance)
+				return false;
+			voxel[axis] += step[axis];
+			t_max[axis] += t_delta[axis];
+		}
+	}
+
+	bool check_raycast(std::mt19937& rng, TerrainGenerator const& generator) {
+		unsigned int checks = 0, failures = 0;
+		ChunkMap chunks;
+		//Terrain with some chunks missing and loose voxels floating above it
+		for (int z = -4; z < 4; ++z) {
+			for (int y = -2; y < 4; ++y) {
+				for (int x = -4; x < 4; ++x) {
+					if (rng() % 5 == 0)
+						continue;
+					PalettedVoxels voxels;
+					generator.generate(x, y, z, voxels);
+					VoxelChunk chunk;
+					chunk.set_voxels(std::move(voxels));
+					if (y >= 2) {
+						for (int i = 0; i < 40; ++i)
+							chunk.set(rng() % VOXEL_CHUNK_WIDTH, rng() % VOXEL_CHUNK_HEIGHT, rng() % VOXEL_CHUNK_DEPTH, VoxelType::V_DIRT);
+					}
+					chunks.insert(x, y, z, std::move(chunk));
+				}
+			}
+		}
+
+		std::uniform_real_distribution<float> position(-120.0f, 120.0f), direction(-1.0f, 1.0f);
+		for (int i = 0; i < 20000; ++i) {
+			Ray ray;
+			ray.m_pos[0] = position(rng);
+			ray.m_pos[1] = position(rng) * 0.5f + 64.0f;
+			ray.m_pos[2] = position(rng);
+			for (auto& dir : ray.m_dir)
+				dir = direction(rng);
+			//Rays along the chunk borders' planes and straight up
+			if (i % 10 == 0)
+				ray.m_dir[i % 3] = 0.0f;
+			if (i % 17 == 0)
+				ray.m_dir[0] = ray.m_dir[2] = 0.0f;
+			if (!(ray.m_dir[0] || ray.m_dir[1] || ray.m_dir[2]))
+				ray.m_dir[1] = 1.0f;
+
+			VoxelHit hit, expected;
+			bool found = raycast(chunks, ray, 300.0f, hit);
+			bool found_expected = raycast_voxels(chunks, ray, 300.0f, expected);
+			++checks;
+			failures += found != found_expected || (found && (hit.voxel != expected.voxel
+				|| hit.face != expected.face || std::fabs(hit.distance - expected.distance) > 1e-3f));
+		}
+		return report("raycast", checks, failures);
+	}
+
+	void wait_for_light(LightEngine& light, ChunkMap& chunks) {
+		while (light.num_pending())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		light.apply(chunks);
+	}
+
+	//Sky light enters the top of chunks with no chunk above and falls down
+	//undimmed at full level, block light starts at emitting voxels. Both
+	//spread through empty voxels of loaded chunks only.
+	std::map<Position, std::vector<uint8_t>> flood_fill_light(ChunkMap& chunks) {
+		std::map<Position, std::vector<uint8_t>> levels;
+		std::map<Position, std::vector<VoxelType>> voxels;
+		chunks.for_each([&](int x, int y, int z, VoxelChunk& chunk) {
+			levels[Position{ { x, y, z } }].assign(NUM_VOXELS, 0);
+			auto& out = voxels[Position{ { x, y, z } }];
+			out.resize(NUM_VOXELS);
+			chunk.get_voxels().unpack(out.data(), 0, NUM_VOXELS);
+		});
+
+		auto at = [&](Position const& voxel, uint8_t*& level, VoxelType& type) {
+			const Position chunk = { { voxel_chunk_coord(voxel[0], 0), voxel_chunk_coord(voxel[1], 1), voxel_chunk_coord(voxel[2], 2) } };
+			auto found = levels.find(chunk);
+			if (found == levels.end())
+				return false;
+			auto index = voxel_index(voxel[0] - chunk[0] * VOXEL_CHUNK_WIDTH,
+				voxel[1] - chunk[1] * VOXEL_CHUNK_HEIGHT, voxel[2] - chunk[2] * VOXEL_CHUNK_DEPTH);
+			level = &found->second[index];
+			type = voxels[chunk][index];
+			return true;
+		};
+
+		std::vector<Position> sky, block;
+		for (auto const& entry : voxels) {
+			auto const& chunk = entry.first;
+			bool covered = chunks.find(chunk[0], chunk[1] + 1, chunk[2]) != nullptr;
+			for (int z = 0; z < VOXEL_CHUNK_DEPTH; ++z) {
+				for (int y = 0; y < VOXEL_CHUNK_HEIGHT; ++y) {
+					for (int x = 0; x < VOXEL_CHUNK_WIDTH; ++x) {
+						const Position voxel = { { chunk[0] * VOXEL_CHUNK_WIDTH + x,
+							chunk[1] * VOXEL_CHUNK_HEIGHT + y, chunk[2] * VOXEL_CHUNK_DEPTH + z } };
+						uint8_t* level = nullptr;
+						VoxelType type = VoxelType::V_EMPTY;
+						at(voxel, level, type);
+						if (int emission = voxel_emission(type)) {
+							*level = make_light(sky_light(*level), emission);
+							block.push_back(voxel);
+						}
+						if (y == VOXEL_CHUNK_HEIGHT - 1 && !covered && type == VoxelType::V_EMPTY) {
+							*level = make_light(MAX_LIGHT_LEVEL, block_light(*level));
+							sky.push_back(voxel);
+						}
+					}
+				}
+			}
+		}
+
+		for (int channel = 0; channel < 2; ++channel) {
+			bool is_sky = channel == 0;
+			auto& queue = is_sky ? sky : block;
+			for (size_t next = 0; next < queue.size(); ++next) {
+				auto voxel = queue[next];
+				uint8_t* level = nullptr;
+				VoxelType type = VoxelType::V_EMPTY;
+				at(voxel, level, type);
+				int current = is_sky ? sky_light(*level) : block_light(*level);
+				for (int face = 0; face < NUM_FACES; ++face) {
+					int spread = is_sky && face == FACE_BOTTOM && current == MAX_LIGHT_LEVEL ? current : current - 1;
+					const Position neighbour = { { voxel[0] + VOXEL_FACE_OFFSET[face][0],
+						voxel[1] + VOXEL_FACE_OFFSET[face][1], voxel[2] + VOXEL_FACE_OFFSET[face][2] } };
+					uint8_t* neighbour_level;
+					VoxelType neighbour_type;
+					if (spread <= 0 || !at(neighbour, neighbour_level, neighbour_type) || neighbour_type != VoxelType::V_EMPTY)
+						continue;
+					if ((is_sky ? sky_light(*neighbour_level) : block_light(*neighbour_level)) >= spread)
+						continue;
+					*neighbour_level = is_sky ? make_light(spread, block_light(*neighbour_level))
+						: make_light(sky_light(*neighbour_level), spread);
+					queue.push_back(neighbour);
+				}
+			}
+		}
+		return levels;
+	}
+
+	unsigned int compare_light(ChunkMap& chunks) {
+		unsigned int failures = 0;
+		for (auto const& entry : flood_fill_light(chunks)) {
+			auto const& light = chunks.find(entry.first[0], entry.first[1], entry.first[2])->get_light();
+			if (!light || !std::equal(light->levels.begin(), light->levels.end(), entry.second.begin()))
+				++failures;
+		}
+		return failures;
+	}
+
+	bool check_light(std::mt19937& rng, TerrainGenerator const& generator) {
+		unsigned int checks = 0, failures = 0;
+		ChunkMap chunks;
+		LightEngine light;
+		chunks.set_light_engine(&light);
+
+		//Inserted in random order so light crosses borders both ways
+		std::vector<Position> positions;
+		for (int z = -3; z < 3; ++z)
+			for (int y = -1; y < 3; ++y)
+				for (int x = -3; x < 3; ++x)
+					positions.push_back(Position{ { x, y, z } });
+		std::shuffle(positions.begin(), positions.end(), rng);
+		for (auto const& position : positions) {
+			PalettedVoxels voxels;
+			generator.generate(position[0], position[1], position[2], voxels);
+			VoxelChunk chunk;
+			chunk.set_voxels(std::move(voxels));
+			chunks.insert(position[0], position[1], position[2], std::move(chunk));
+		}
+		wait_for_light(light, chunks);
+		failures += compare_light(chunks);
+		checks += unsigned(chunks.size());
+
+		//Caves, lamps and overhangs, each relit incrementally
+		std::uniform_int_distribution<int> horizontal(-90, 90), vertical(-30, 90);
+		for (int i = 0; i < 12; ++i) {
+			WorldEdit edit(chunks);
+			const Position at = { { horizontal(rng), vertical(rng), horizontal(rng) } };
+			switch (i % 3) {
+			case 0:
+				edit.fill_sphere({ { at[0] + 0.5f, at[1] + 0.5f, at[2] + 0.5f } }, 6.0f, VoxelType::V_EMPTY);
+				break;
+			case 1:
+				edit.fill_box(at, Position{ { at[0] + 3, at[1] + 3, at[2] + 3 } }, VoxelType::V_LAMP);
+				break;
+			default:
+				edit.fill_box(Position{ { at[0] - 5, at[1], at[2] - 5 } }, Position{ { at[0] + 5, at[1] + 1, at[2] + 5 } }, VoxelType::V_ROCK);
+				break;
+			}
+			edit.commit();
+			wait_for_light(light, chunks);
+		}
+		failures += compare_light(chunks);
+		checks += unsigned(chunks.size());
+
+		{
+			WorldEdit edit(chunks);
+			edit.replace(Position{ { -96, -32, -96 } }, Position{ { 96, 96, 96 } }, VoxelType::V_LAMP, VoxelType::V_EMPTY);
+			edit.commit();
+			wait_for_light(light, chunks);
+		}
+		failures += compare_light(chunks);
+		checks += unsigned(chunks.size());
+
+		//A roof shades the chunks below until it is erased again
+		for (int z = -3; z < 3; ++z) {
+			for (int x = -3; x < 3; ++x) {
+				PalettedVoxels voxels;
+				voxels.fill(x == 0 && z == 0 ? VoxelType::V_ROCK : VoxelType::V_EMPTY);
+				VoxelChunk chunk;
+				chunk.set_voxels(std::move(voxels));
+				chunks.insert(x, 3, z, std::move(chunk));
+			}
+		}
+		wait_for_light(light, chunks);
+		failures += compare_light(chunks);
+		checks += unsigned(chunks.size());
+
+		chunks.erase(0, 3, 0);
+		wait_for_light(light, chunks);
+		failures += compare_light(chunks);
+		checks += unsigned(chunks.size());
+
+		chunks.set_light_engine(nullptr);
+		return report("light", checks, failures);
+	}
+}
+
+int main(int argc, char const* argv[]) {
+	bx::CommandLine cmdLine(argc, argv);
+	int seed = 1;
+	cmdLine.hasArg(seed, '\0', "seed");
+
+	std::mt19937 rng(static_cast<uint32_t>(seed));
+	TerrainGenerator generator(static_cast<uint32_t>(seed));
+	bool passed = check_paletted_voxels(rng);
+	passed &= check_chunk_map(rng);
+	passed &= check_raycast(rng, generator);
+	passed &= check_light(rng, generator);
+	return passed ? 0 : 1;
+}